@@ -0,0 +1,434 @@
+#define _GNU_SOURCE
+#include "statement.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Micro-benchmarks for the B+tree hot paths, linked straight against the
+ * engine sources so no REPL or pipe sits between the timer and the code.
+ *
+ * Every case runs `warmup` untimed samples and then `samples` timed ones. A
+ * sample is `ops_per_sample` calls of the case's op, preceded by an untimed
+ * setup, and is recorded as ns/op. Results go to stdout as JSON.
+ */
+#define BENCH_DEFAULT_ROWS 100000
+#define BENCH_DEFAULT_SAMPLES 200
+#define BENCH_DEFAULT_WARMUP 20
+#define BENCH_MIN_ROWS 1000 /* enough for the root to be an internal node */
+#define BENCH_DEFAULT_DB "bench.db"
+#define BENCH_SCRATCH_DB "bench_scratch.db"
+#define BENCH_LOOKUPS 4096
+#define BENCH_MISS_PAGES 1024
+
+typedef struct {
+    Table*   table;   /* prebuilt table with `rows` random keys */
+    Table*   scratch; /* rebuilt by the insert cases */
+    uint32_t rows;
+
+    uint32_t  lookup_keys[BENCH_LOOKUPS];
+    uint32_t  lookup_pages[BENCH_LOOKUPS];
+    Row       row; /* payload for every insert; only the id changes */
+    uint32_t  next_key;
+    Cursor    cursor;
+    Statement statement; /* filter for the scan case, row for the insert cases */
+    Scan      scan;
+    uint32_t* insert_keys; /* 1..rows shuffled */
+} Bench;
+
+typedef struct {
+    const char* name;
+    uint32_t (*ops_per_sample)(Bench* bench);
+    void (*setup)(Bench* bench);
+    void (*op)(Bench* bench, uint32_t i);
+} BenchCase;
+
+static volatile uint32_t sink;
+static uint32_t          rng_state = 2463534242u;
+
+static uint32_t rng_next() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void insert_key(Table* table, Row* row, uint32_t key) {
+    Cursor cursor;
+    row->id = key;
+    table_find(table, key, &cursor);
+    leaf_node_insert(&cursor, key, row);
+}
+
+/* Drops every page but the header and an empty root leaf, keeping their buffers cached */
+static void reset_table(Table* table) {
+    table->pager->num_pages = table->root_page_num + 1;
+    void* root              = get_page_for_write(table->pager, table->root_page_num);
+    initialize_leaf_node(root);
+    set_node_root(root, true);
+}
+
+static uint32_t ops_lookups(Bench* bench) {
+    (void) bench;
+    return BENCH_LOOKUPS;
+}
+
+static uint32_t ops_one(Bench* bench) {
+    (void) bench;
+    return 1;
+}
+
+static uint32_t ops_leaf_capacity(Bench* bench) {
+    return bench->scratch->pager->layout.leaf_node_max_cells;
+}
+
+static uint32_t ops_rows(Bench* bench) {
+    return bench->rows;
+}
+
+static uint32_t ops_miss_pages(Bench* bench) {
+    uint32_t num_pages = bench->table->pager->num_pages;
+    return num_pages < BENCH_MISS_PAGES ? num_pages : BENCH_MISS_PAGES;
+}
+
+/* Random keys, each paired with the leaf a descent for it ends in */
+static void setup_leaf_lookups(Bench* bench) {
+    for (uint32_t i = 0; i < BENCH_LOOKUPS; i++) {
+        Cursor   cursor;
+        uint32_t key = rng_next() % (bench->rows * 4) + 1;
+        table_find(bench->table, key, &cursor);
+        bench->lookup_keys[i]  = key;
+        bench->lookup_pages[i] = cursor.page_num;
+    }
+}
+
+static void op_leaf_node_find(Bench* bench, uint32_t i) {
+    Cursor cursor;
+    leaf_node_find(bench->table, bench->lookup_pages[i], bench->lookup_keys[i], &cursor);
+    sink = cursor.cell_num;
+}
+
+/* Random keys, each paired with a random internal node */
+static void setup_internal_lookups(Bench* bench) {
+    Pager*   pager          = bench->table->pager;
+    uint32_t internal_pages = 0;
+    for (uint32_t page_num = bench->table->root_page_num; page_num < pager->num_pages; page_num++) {
+        if (get_node_type(get_page(pager, page_num)) == NODE_INTERNAL) {
+            bench->lookup_pages[internal_pages++ % BENCH_LOOKUPS] = page_num;
+        }
+    }
+    if (internal_pages > BENCH_LOOKUPS) {
+        internal_pages = BENCH_LOOKUPS;
+    }
+    for (uint32_t i = 0; i < BENCH_LOOKUPS; i++) {
+        bench->lookup_keys[i]  = rng_next() % (bench->rows * 4) + 1;
+        bench->lookup_pages[i] = bench->lookup_pages[rng_next() % internal_pages];
+    }
+}
+
+static void op_internal_node_find_child(Bench* bench, uint32_t i) {
+    void* node = get_page(bench->table->pager, bench->lookup_pages[i]);
+    sink       = internal_node_find_child(node, bench->lookup_keys[i]);
+}
+
+static void setup_empty_leaf(Bench* bench) {
+    reset_table(bench->scratch);
+    bench->next_key = bench->scratch->pager->layout.leaf_node_max_cells;
+}
+
+/* Descending keys land in cell 0, so every insert shifts the whole leaf */
+static void op_leaf_node_insert(Bench* bench, uint32_t i) {
+    (void) i;
+    Cursor cursor = {bench->scratch, bench->scratch->root_page_num, 0, false};
+    bench->row.id = bench->next_key--;
+    leaf_node_insert(&cursor, bench->row.id, &bench->row);
+}
+
+/* Grows past the first root split, then fills the rightmost leaf to capacity */
+static void setup_full_leaf(Bench* bench) {
+    Table* table = bench->scratch;
+    reset_table(table);
+    bench->next_key = 1;
+
+    while (true) {
+        insert_key(table, &bench->row, bench->next_key++);
+        void* root = get_page(table->pager, table->root_page_num);
+        if (get_node_type(root) == NODE_LEAF) {
+            continue;
+        }
+        void* rightmost = get_page(table->pager, *internal_node_right_child(root));
+        if (*leaf_node_num_cells(rightmost) == table->pager->layout.leaf_node_max_cells) {
+            break;
+        }
+    }
+}
+
+static void op_leaf_node_insert_split(Bench* bench, uint32_t i) {
+    (void) i;
+    insert_key(bench->scratch, &bench->row, bench->next_key++);
+}
+
+/* Fills a root internal node to capacity, then its rightmost leaf */
+static void setup_full_internal(Bench* bench) {
+    Table* table = bench->scratch;
+    reset_table(table);
+    bench->next_key = 1;
+
+    while (true) {
+        insert_key(table, &bench->row, bench->next_key++);
+        void* root = get_page(table->pager, table->root_page_num);
+        if (get_node_type(root) == NODE_LEAF ||
+            *internal_node_num_keys(root) < table->pager->layout.internal_node_max_keys) {
+            continue;
+        }
+        void* rightmost = get_page(table->pager, *internal_node_right_child(root));
+        if (*leaf_node_num_cells(rightmost) == table->pager->layout.leaf_node_max_cells) {
+            break;
+        }
+    }
+}
+
+/* Empties the scratch table and turns its memtable on or off for the next run of inserts */
+static void setup_inserts(Bench* bench, uint32_t memtable_capacity) {
+    reset_table(bench->scratch);
+    memtable_resize(&bench->scratch->memtable, memtable_capacity);
+    bench->statement.type          = STATEMENT_INSERT;
+    bench->statement.row_to_insert = bench->row;
+    for (uint32_t i = bench->rows - 1; i > 0; i--) {
+        uint32_t j            = rng_next() % (i + 1);
+        uint32_t swap         = bench->insert_keys[i];
+        bench->insert_keys[i] = bench->insert_keys[j];
+        bench->insert_keys[j] = swap;
+    }
+}
+
+static void setup_random_inserts(Bench* bench) {
+    setup_inserts(bench, 0);
+}
+
+static void setup_buffered_inserts(Bench* bench) {
+    setup_inserts(bench, MEMTABLE_DEFAULT_CAPACITY);
+}
+
+static void setup_sequential_inserts(Bench* bench) {
+    setup_inserts(bench, 0);
+    for (uint32_t i = 0; i < bench->rows; i++) {
+        bench->insert_keys[i] = i + 1;
+    }
+}
+
+/* The last op also merges what is left in the memtable, so every row reaches the tree */
+static void op_execute_insert(Bench* bench, uint32_t i) {
+    bench->statement.row_to_insert.id = bench->insert_keys[i];
+    sink = execute_insert(&bench->statement, bench->scratch);
+    if (i + 1 == bench->rows) {
+        table_merge_memtable(bench->scratch);
+    }
+}
+
+static void setup_scan(Bench* bench) {
+    table_start(bench->table, &bench->cursor);
+}
+
+static void op_cursor_advance(Bench* bench, uint32_t i) {
+    (void) i;
+    cursor_advance(&bench->cursor);
+}
+
+/* Every row has the same email, so each scan_next tests one row and returns it */
+static void setup_filtered_scan(Bench* bench) {
+    char sql[] = "select where email contains example";
+    prepare_statement(sql, &bench->statement);
+    scan_open(&bench->scan, &bench->statement, bench->table);
+}
+
+static void op_scan_email_contains(Bench* bench, uint32_t i) {
+    (void) i;
+    sink = scan_next(&bench->scan);
+}
+
+static void setup_page_hits(Bench* bench) {
+    for (uint32_t i = 0; i < BENCH_LOOKUPS; i++) {
+        bench->lookup_pages[i] = rng_next() % bench->table->pager->num_pages;
+    }
+}
+
+static void op_get_page_hit(Bench* bench, uint32_t i) {
+    sink = *(uint8_t*) get_page(bench->table->pager, bench->lookup_pages[i]);
+}
+
+/* Evicts the leading pages so the next get_page reads them back from the file */
+static void setup_page_misses(Bench* bench) {
+    Pager* pager = bench->table->pager;
+    for (uint32_t page_num = 0; page_num < ops_miss_pages(bench); page_num++) {
+        PageTableEntry* entry = page_table_entry(&pager->pages, page_num);
+        frame_slab_free(&pager->frames, entry->frame);
+        entry->frame = NULL;
+    }
+}
+
+static void op_get_page_miss(Bench* bench, uint32_t i) {
+    sink = *(uint8_t*) get_page(bench->table->pager, i);
+}
+
+/* Page misses run last: they evict pages the other cases hold on to */
+static const BenchCase bench_cases[] = {
+    {"leaf_node_find", ops_lookups, setup_leaf_lookups, op_leaf_node_find},
+    {"internal_node_find_child", ops_lookups, setup_internal_lookups, op_internal_node_find_child},
+    {"leaf_node_insert", ops_leaf_capacity, setup_empty_leaf, op_leaf_node_insert},
+    {"leaf_node_insert_split", ops_one, setup_full_leaf, op_leaf_node_insert_split},
+    {"internal_node_split", ops_one, setup_full_internal, op_leaf_node_insert_split},
+    {"insert_sequential", ops_rows, setup_sequential_inserts, op_execute_insert},
+    {"insert_random", ops_rows, setup_random_inserts, op_execute_insert},
+    {"insert_random_memtable", ops_rows, setup_buffered_inserts, op_execute_insert},
+    {"cursor_advance", ops_rows, setup_scan, op_cursor_advance},
+    {"scan_email_contains", ops_rows, setup_filtered_scan, op_scan_email_contains},
+    {"get_page_hit", ops_lookups, setup_page_hits, op_get_page_hit},
+    {"get_page_miss", ops_miss_pages, setup_page_misses, op_get_page_miss},
+};
+
+static int compare_double(const void* a, const void* b) {
+    double x = *(const double*) a;
+    double y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of sorted samples */
+static double percentile(double* sorted, uint32_t count, double p) {
+    uint32_t rank = (uint32_t) (p / 100.0 * count + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    if (rank > count) {
+        rank = count;
+    }
+    return sorted[rank - 1];
+}
+
+static void run_case(Bench* bench, const BenchCase* bench_case, uint32_t samples,
+                     uint32_t warmup, bool last) {
+    double*  ns_per_op = malloc(samples * sizeof(double));
+    uint32_t ops       = bench_case->ops_per_sample(bench);
+
+    for (uint32_t sample = 0; sample < warmup + samples; sample++) {
+        bench_case->setup(bench);
+        uint64_t start = now_ns();
+        for (uint32_t i = 0; i < ops; i++) {
+            bench_case->op(bench, i);
+        }
+        uint64_t elapsed = now_ns() - start;
+        if (sample >= warmup) {
+            ns_per_op[sample - warmup] = (double) elapsed / ops;
+        }
+    }
+
+    double total = 0;
+    for (uint32_t i = 0; i < samples; i++) {
+        total += ns_per_op[i];
+    }
+    qsort(ns_per_op, samples, sizeof(double), compare_double);
+
+    printf("    {\"name\": \"%s\", \"ops_per_sample\": %u, ", bench_case->name, ops);
+    printf("\"ns_per_op\": {");
+    printf("\"mean\": %.2f, \"min\": %.2f, \"p50\": %.2f, \"p90\": %.2f, \"p99\": %.2f, "
+           "\"max\": %.2f}}%s\n",
+           total / samples, ns_per_op[0], percentile(ns_per_op, samples, 50),
+           percentile(ns_per_op, samples, 90), percentile(ns_per_op, samples, 99),
+           ns_per_op[samples - 1], last ? "" : ",");
+    free(ns_per_op);
+}
+
+static uint32_t parse_number(const char* flag, const char* value, uint32_t min) {
+    char*         end;
+    unsigned long count = value ? strtoul(value, &end, 10) : 0;
+    if (value == NULL || *end != '\0' || count < min || count > UINT32_MAX) {
+        printf("%s needs a number of at least %u\n", flag, min);
+        exit(EXIT_FAILURE);
+    }
+    return count;
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t    rows      = BENCH_DEFAULT_ROWS;
+    uint32_t    samples   = BENCH_DEFAULT_SAMPLES;
+    uint32_t    warmup    = BENCH_DEFAULT_WARMUP;
+    uint32_t    page_size = DEFAULT_PAGE_SIZE;
+    const char* db_path   = BENCH_DEFAULT_DB;
+
+    for (int i = 1; i < argc; i++) {
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(argv[i], "--rows") == 0) {
+            rows = parse_number(argv[i], value, BENCH_MIN_ROWS);
+        } else if (strcmp(argv[i], "--samples") == 0) {
+            samples = parse_number(argv[i], value, 1);
+        } else if (strcmp(argv[i], "--warmup") == 0) {
+            warmup = parse_number(argv[i], value, 0);
+        } else if (strcmp(argv[i], "--page-size") == 0) {
+            page_size = parse_number(argv[i], value, MIN_PAGE_SIZE);
+            if (!page_size_valid(page_size)) {
+                printf("--page-size needs a power of two up to %u\n", MAX_PAGE_SIZE);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--db") == 0 && value != NULL) {
+            db_path = value;
+        } else {
+            printf("Usage: %s [--rows N] [--samples N] [--warmup N] [--page-size N] [--db PATH]\n",
+                   argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        i++;
+    }
+
+    Bench bench       = {0};
+    bench.rows        = rows;
+    bench.insert_keys = malloc(rows * sizeof(uint32_t));
+    for (uint32_t i = 0; i < rows; i++) {
+        bench.insert_keys[i] = i + 1;
+    }
+    strcpy(bench.row.username, "bench_user");
+    strcpy(bench.row.email, "bench_user@example.com");
+
+    /* Random keys give the half-full leaves of a real workload; reopen so the file has them */
+    unlink(db_path);
+    Table* table = db_open(db_path, page_size);
+    for (uint32_t inserted = 0; inserted < rows;) {
+        Cursor   cursor;
+        uint32_t key = rng_next() % (rows * 4) + 1;
+        table_find(table, key, &cursor);
+        void* node   = get_page(table->pager, cursor.page_num);
+        bool  exists = cursor.cell_num < *leaf_node_num_cells(node) &&
+                      *leaf_node_key(node, cursor.cell_num) == key;
+        if (!exists) {
+            insert_key(table, &bench.row, key);
+            inserted++;
+        }
+    }
+    db_close(table);
+
+    unlink(BENCH_SCRATCH_DB);
+    bench.table   = db_open(db_path, page_size);
+    bench.scratch = db_open(BENCH_SCRATCH_DB, page_size);
+
+    uint32_t num_cases = sizeof(bench_cases) / sizeof(bench_cases[0]);
+    printf("{\n  \"page_size\": %u,\n  \"rows\": %u,\n  \"pages\": %u,\n", page_size, rows,
+           bench.table->pager->num_pages);
+    printf("  \"samples\": %u,\n  \"warmup\": %u,\n  \"benchmarks\": [\n", samples, warmup);
+    for (uint32_t i = 0; i < num_cases; i++) {
+        run_case(&bench, &bench_cases[i], samples, warmup, i + 1 == num_cases);
+    }
+    printf("  ]\n}\n");
+
+    db_close(bench.table);
+    db_close(bench.scratch);
+    free(bench.insert_keys);
+    unlink(db_path);
+    unlink(BENCH_SCRATCH_DB);
+    return 0;
+}
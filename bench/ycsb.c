@@ -0,0 +1,509 @@
+#define _GNU_SOURCE
+#include "cqlite.h"
+#include "histogram.h"
+#include "shard.h"
+#include "table.h"
+#include "warmup.h"
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * End-to-end workload driver in the style of YCSB, run through the public
+ * API like any embedding application would. A load phase inserts `records`
+ * rows, then the run phase issues `operations` reads, inserts, scans and
+ * read-modify-writes in the workload's proportions, picking keys from a
+ * uniform, zipfian or latest distribution.
+ *
+ * Workloads a to f follow YCSB's core workloads. There is no update
+ * statement, so a's and b's updates are inserts of new rows and f's
+ * read-modify-write reads a row and inserts a new one.
+ *
+ *   a  50% read, 50% insert         zipfian
+ *   b  95% read, 5% insert          zipfian
+ *   c  100% read                    zipfian
+ *   d  95% read, 5% insert          latest
+ *   e  95% scan, 5% insert          zipfian; scans of 1 to max_scan rows
+ *   f  50% read, 50% read+insert    zipfian
+ *
+ * Record n has id n + 1, or with the default hashed insert order that
+ * multiplied by an odd constant modulo 2^31, which scatters both the load
+ * and the run phase's inserts over the key space. Zipfian picks are hashed
+ * too, so the popular rows are not neighbours; latest picks count back from
+ * the newest insert.
+ *
+ * Everything the run does is decided by the seed, so one seed replays the
+ * same operations on the same keys; `digest` hashes that sequence to show
+ * it. Results go to stdout as JSON: throughput per `interval_ms` and over
+ * the whole run, and latency percentiles per operation.
+ *
+ * The database at `--db` is created for the run and removed after it. A path
+ * that already exists is only replaced with `--force`.
+ */
+#define YCSB_DEFAULT_RECORDS 100000
+#define YCSB_DEFAULT_OPERATIONS 100000
+#define YCSB_DEFAULT_SEED 1
+#define YCSB_DEFAULT_MAX_SCAN 100
+#define YCSB_DEFAULT_THETA 0.99
+#define YCSB_DEFAULT_INTERVAL_MS 1000
+#define YCSB_DEFAULT_DB "ycsb.db"
+#define YCSB_MAX_RECORDS 0x7fffffffu
+#define YCSB_KEY_MULTIPLIER 2654435761u
+
+typedef enum { OP_READ, OP_INSERT, OP_SCAN, OP_RMW, OP_COUNT } Operation;
+typedef enum { DIST_UNIFORM, DIST_ZIPFIAN, DIST_LATEST } Distribution;
+
+static const char* OPERATION_NAMES[OP_COUNT] = {"read", "insert", "scan", "rmw"};
+static const char* DISTRIBUTION_NAMES[]      = {"uniform", "zipfian", "latest"};
+
+typedef struct {
+    char         name;
+    double       proportions[OP_COUNT];
+    Distribution distribution;
+} Workload;
+
+static const Workload WORKLOADS[] = {
+    {'a', {0.50, 0.50, 0, 0}, DIST_ZIPFIAN}, {'b', {0.95, 0.05, 0, 0}, DIST_ZIPFIAN},
+    {'c', {1.00, 0, 0, 0}, DIST_ZIPFIAN},    {'d', {0.95, 0.05, 0, 0}, DIST_LATEST},
+    {'e', {0, 0.05, 0.95, 0}, DIST_ZIPFIAN}, {'f', {0.50, 0, 0, 0.50}, DIST_ZIPFIAN},
+};
+
+/*
+ * Gray et al.'s zipfian generator, as in YCSB, over ranks 0 to `items` - 1.
+ * zeta(n) is summed once and extended as inserts add items.
+ */
+typedef struct {
+    double   theta;
+    uint64_t items;
+    double   zeta2;
+    double   zetan;
+    double   alpha;
+    double   eta;
+} Zipfian;
+
+typedef struct {
+    cqlite*      db;
+    cqlite_stmt* insert;
+    cqlite_stmt* read;
+    cqlite_stmt* scan;
+    uint64_t     rng_state;
+    uint64_t     digest;
+    bool         hashed;
+    Distribution distribution;
+    Zipfian      zipfian;
+    uint32_t     max_scan;
+    uint64_t     items; /* rows inserted so far, load phase included */
+    uint64_t     rows_returned;
+    uint64_t     errors[OP_COUNT];
+    uint64_t     counts[OP_COUNT];
+    Histogram    latency[OP_COUNT];
+} Ycsb;
+
+/* splitmix64, so a seed of 0 is as good as any other */
+static uint64_t rng_next(Ycsb* ycsb) {
+    uint64_t z = (ycsb->rng_state += 0x9e3779b97f4a7c15u);
+    z          = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9u;
+    z          = (z ^ (z >> 27)) * 0x94d049bb133111ebu;
+    return z ^ (z >> 31);
+}
+
+static double rng_double(Ycsb* ycsb) {
+    return (rng_next(ycsb) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static uint64_t fnv1a(uint64_t hash, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        hash ^= (value >> (i * 8)) & 0xff;
+        hash *= 1099511628211u;
+    }
+    return hash;
+}
+
+static void zipfian_grow(Zipfian* zipfian, uint64_t items) {
+    for (uint64_t i = zipfian->items + 1; i <= items; i++) {
+        zipfian->zetan += 1.0 / pow((double) i, zipfian->theta);
+    }
+    zipfian->items = items;
+    zipfian->eta   = (1 - pow(2.0 / items, 1 - zipfian->theta)) /
+                   (1 - zipfian->zeta2 / zipfian->zetan);
+}
+
+static void zipfian_init(Zipfian* zipfian, double theta, uint64_t items) {
+    memset(zipfian, 0, sizeof(Zipfian));
+    zipfian->theta = theta;
+    zipfian->zeta2 = 1 + 1.0 / pow(2, theta);
+    zipfian->alpha = 1 / (1 - theta);
+    zipfian_grow(zipfian, items);
+}
+
+static uint64_t zipfian_next(Zipfian* zipfian, double u) {
+    double uz = u * zipfian->zetan;
+    if (uz < 1) {
+        return 0;
+    }
+    if (uz < 1 + pow(0.5, zipfian->theta)) {
+        return 1;
+    }
+    uint64_t rank = zipfian->items * pow(zipfian->eta * u - zipfian->eta + 1, zipfian->alpha);
+    return rank < zipfian->items ? rank : zipfian->items - 1;
+}
+
+static uint32_t record_key(Ycsb* ycsb, uint64_t record) {
+    if (!ycsb->hashed) {
+        return record + 1;
+    }
+    /* Odd multipliers permute the integers modulo 2^31, so keys never collide */
+    return ((record + 1) * YCSB_KEY_MULTIPLIER) & YCSB_MAX_RECORDS;
+}
+
+/* A record already inserted, by the run's distribution */
+static uint64_t choose_record(Ycsb* ycsb) {
+    switch (ycsb->distribution) {
+        case DIST_UNIFORM:
+            return rng_next(ycsb) % ycsb->items;
+        case DIST_ZIPFIAN:
+            return fnv1a(14695981039346656037u, zipfian_next(&ycsb->zipfian, rng_double(ycsb))) %
+                   ycsb->items;
+        case DIST_LATEST:
+            return ycsb->items - 1 - zipfian_next(&ycsb->zipfian, rng_double(ycsb));
+    }
+    return 0;
+}
+
+static Operation choose_operation(Ycsb* ycsb, const double* proportions) {
+    double u = rng_double(ycsb);
+    for (int op = 0; op < OP_COUNT - 1; op++) {
+        if (u < proportions[op]) {
+            return op;
+        }
+        u -= proportions[op];
+    }
+    return OP_COUNT - 1;
+}
+
+static void prepare(cqlite* db, const char* sql, cqlite_stmt** stmt) {
+    CqliteResult result = cqlite_prepare(db, sql, stmt);
+    if (result != CQLITE_OK) {
+        printf("Unable to prepare \"%s\": %s\n", sql, cqlite_errstr(result));
+        exit(EXIT_FAILURE);
+    }
+}
+
+static bool insert_record(Ycsb* ycsb) {
+    char     username[COLUMN_USERNAME_SIZE + 1];
+    char     email[COLUMN_EMAIL_SIZE + 1];
+    uint64_t record = ycsb->items;
+    snprintf(username, sizeof(username), "user%" PRIu64, record);
+    snprintf(email, sizeof(email), "user%" PRIu64 "@example.com", record);
+
+    cqlite_bind_int(ycsb->insert, 1, record_key(ycsb, record));
+    cqlite_bind_text(ycsb->insert, 2, username);
+    cqlite_bind_text(ycsb->insert, 3, email);
+    bool inserted = cqlite_step(ycsb->insert) == CQLITE_DONE;
+    cqlite_reset(ycsb->insert);
+
+    ycsb->items++;
+    if (ycsb->distribution != DIST_UNIFORM) {
+        zipfian_grow(&ycsb->zipfian, ycsb->items);
+    }
+    return inserted;
+}
+
+/* Returns how many rows came back; their ids go into the digest */
+static uint64_t run_select(Ycsb* ycsb, cqlite_stmt* stmt) {
+    uint64_t rows = 0;
+    while (cqlite_step(stmt) == CQLITE_ROW) {
+        ycsb->digest = fnv1a(ycsb->digest, cqlite_column_int(stmt, CQLITE_COLUMN_ID));
+        rows++;
+    }
+    cqlite_reset(stmt);
+    ycsb->rows_returned += rows;
+    return rows;
+}
+
+static bool read_record(Ycsb* ycsb) {
+    cqlite_bind_int(ycsb->read, 1, record_key(ycsb, choose_record(ycsb)));
+    return run_select(ycsb, ycsb->read) == 1;
+}
+
+static bool run_operation(Ycsb* ycsb, Operation op) {
+    ycsb->digest = fnv1a(ycsb->digest, op);
+    switch (op) {
+        case OP_READ:
+            return read_record(ycsb);
+        case OP_INSERT:
+            return insert_record(ycsb);
+        case OP_SCAN:
+            cqlite_bind_int(ycsb->scan, 1, record_key(ycsb, choose_record(ycsb)));
+            cqlite_bind_int(ycsb->scan, 2, rng_next(ycsb) % ycsb->max_scan + 1);
+            return run_select(ycsb, ycsb->scan) > 0;
+        case OP_RMW:
+            return read_record(ycsb) && insert_record(ycsb);
+        default:
+            return false;
+    }
+}
+
+/* Only the files cqlite keeps for `path`: it, every shard its manifest numbered, and sidecars */
+static void remove_database(const char* path) {
+    char  file[4096];
+    FILE* manifest = shard_set_is_manifest(path) ? fopen(path, "rb") : NULL;
+    if (manifest != NULL) {
+        char     magic[sizeof(SHARD_MAGIC)];
+        uint32_t header[5]; /* version, page size, max pages, shards, next file number */
+        if (fread(magic, sizeof(magic), 1, manifest) == 1 &&
+            fread(header, sizeof(header), 1, manifest) == 1) {
+            for (uint32_t n = 0; n < header[4]; n++) {
+                snprintf(file, sizeof(file), "%s-%u", path, n);
+                unlink(file);
+                snprintf(file, sizeof(file), "%s-%u%s", path, n, WARMUP_SUFFIX);
+                unlink(file);
+            }
+        }
+        fclose(manifest);
+    }
+    snprintf(file, sizeof(file), "%s%s", path, WARMUP_SUFFIX);
+    unlink(file);
+    unlink(path);
+}
+
+static uint64_t parse_number(const char* flag, const char* value, uint64_t min, uint64_t max) {
+    char*              end;
+    unsigned long long number = value ? strtoull(value, &end, 10) : 0;
+    if (value == NULL || *end != '\0' || number < min || number > max) {
+        printf("%s needs a number from %" PRIu64 " to %" PRIu64 "\n", flag, min, max);
+        exit(EXIT_FAILURE);
+    }
+    return number;
+}
+
+static double parse_fraction(const char* flag, const char* value, double min, double max) {
+    char*  end;
+    double number = value ? strtod(value, &end) : 0;
+    if (value == NULL || *end != '\0' || !(number >= min && number <= max)) {
+        printf("%s needs a number from %g to %g\n", flag, min, max);
+        exit(EXIT_FAILURE);
+    }
+    return number;
+}
+
+static void usage(const char* program) {
+    printf("Usage: %s [--workload a-f] [--read P] [--insert P] [--scan P] [--rmw P]\n"
+           "       [--distribution uniform|zipfian|latest] [--theta T] [--records N]\n"
+           "       [--operations N] [--max-scan N] [--seed N] [--insert-order hashed|ordered]\n"
+           "       [--interval-ms N] [--page-size N] [--shards N] [--db PATH] [--force]\n",
+           program);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char* argv[]) {
+    Workload    workload    = WORKLOADS[0];
+    uint64_t    records     = YCSB_DEFAULT_RECORDS;
+    uint64_t    operations  = YCSB_DEFAULT_OPERATIONS;
+    uint64_t    seed        = YCSB_DEFAULT_SEED;
+    uint32_t    max_scan    = YCSB_DEFAULT_MAX_SCAN;
+    double      theta       = YCSB_DEFAULT_THETA;
+    uint32_t    interval_ms = YCSB_DEFAULT_INTERVAL_MS;
+    uint32_t    page_size   = DEFAULT_PAGE_SIZE;
+    uint32_t    num_shards  = 0;
+    bool        hashed      = true;
+    bool        force       = false;
+    const char* db_path     = YCSB_DEFAULT_DB;
+
+    /* A workload resets the mix, so flags after it adjust that workload */
+    for (int i = 1; i < argc; i++) {
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(argv[i], "--force") == 0) {
+            force = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--workload") == 0 && value != NULL && strlen(value) == 1 &&
+            value[0] >= 'a' && value[0] <= 'f') {
+            workload = WORKLOADS[value[0] - 'a'];
+        } else if (strcmp(argv[i], "--read") == 0) {
+            workload.proportions[OP_READ] = parse_fraction(argv[i], value, 0, 1);
+        } else if (strcmp(argv[i], "--insert") == 0) {
+            workload.proportions[OP_INSERT] = parse_fraction(argv[i], value, 0, 1);
+        } else if (strcmp(argv[i], "--scan") == 0) {
+            workload.proportions[OP_SCAN] = parse_fraction(argv[i], value, 0, 1);
+        } else if (strcmp(argv[i], "--rmw") == 0) {
+            workload.proportions[OP_RMW] = parse_fraction(argv[i], value, 0, 1);
+        } else if (strcmp(argv[i], "--distribution") == 0 && value != NULL) {
+            int d = 0;
+            int n = sizeof(DISTRIBUTION_NAMES) / sizeof(DISTRIBUTION_NAMES[0]);
+            while (d < n && strcmp(value, DISTRIBUTION_NAMES[d]) != 0) {
+                d++;
+            }
+            if (d == n) {
+                usage(argv[0]);
+            }
+            workload.distribution = d;
+        } else if (strcmp(argv[i], "--theta") == 0) {
+            theta = parse_fraction(argv[i], value, 0.01, 0.999);
+        } else if (strcmp(argv[i], "--records") == 0) {
+            records = parse_number(argv[i], value, 1, YCSB_MAX_RECORDS / 2);
+        } else if (strcmp(argv[i], "--operations") == 0) {
+            operations = parse_number(argv[i], value, 1, YCSB_MAX_RECORDS / 2);
+        } else if (strcmp(argv[i], "--max-scan") == 0) {
+            max_scan = parse_number(argv[i], value, 1, UINT32_MAX);
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            seed = parse_number(argv[i], value, 0, UINT64_MAX);
+        } else if (strcmp(argv[i], "--insert-order") == 0 && value != NULL &&
+                   (strcmp(value, "hashed") == 0 || strcmp(value, "ordered") == 0)) {
+            hashed = strcmp(value, "hashed") == 0;
+        } else if (strcmp(argv[i], "--interval-ms") == 0) {
+            interval_ms = parse_number(argv[i], value, 1, UINT32_MAX);
+        } else if (strcmp(argv[i], "--page-size") == 0) {
+            page_size = parse_number(argv[i], value, MIN_PAGE_SIZE, MAX_PAGE_SIZE);
+        } else if (strcmp(argv[i], "--shards") == 0) {
+            num_shards = parse_number(argv[i], value, 1, UINT32_MAX);
+        } else if (strcmp(argv[i], "--db") == 0 && value != NULL) {
+            db_path = value;
+        } else {
+            usage(argv[0]);
+        }
+        i++;
+    }
+
+    double total = 0;
+    for (int op = 0; op < OP_COUNT; op++) {
+        total += workload.proportions[op];
+    }
+    if (total <= 0) {
+        printf("The workload needs at least one operation with a proportion above 0\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int op = 0; op < OP_COUNT; op++) {
+        workload.proportions[op] /= total;
+    }
+
+    if (access(db_path, F_OK) == 0) {
+        if (!force) {
+            printf("%s already exists; pass --force to replace it\n", db_path);
+            exit(EXIT_FAILURE);
+        }
+        remove_database(db_path);
+    }
+    cqlite*      db     = NULL;
+    CqliteResult result = num_shards > 0
+                              ? cqlite_open_sharded(db_path, num_shards, page_size, &db)
+                              : cqlite_open_with_page_size(db_path, page_size, &db);
+    if (result != CQLITE_OK) {
+        printf("Unable to open %s: %s\n", db_path, cqlite_errstr(result));
+        exit(EXIT_FAILURE);
+    }
+
+    Ycsb* ycsb         = calloc(1, sizeof(Ycsb));
+    ycsb->db           = db;
+    ycsb->rng_state    = seed;
+    ycsb->digest       = 14695981039346656037u;
+    ycsb->hashed       = hashed;
+    ycsb->distribution = workload.distribution;
+    ycsb->max_scan     = max_scan;
+    prepare(db, "insert ? ? ?", &ycsb->insert);
+    prepare(db, "select where id = ?", &ycsb->read);
+    prepare(db, "select where id >= ? limit ?", &ycsb->scan);
+
+    /* Loaded without the zipfian, whose zeta is summed once over the whole load instead */
+    Distribution run_dist    = ycsb->distribution;
+    uint64_t     load_errors = 0;
+    uint64_t     load_start  = monotonic_ns();
+
+    ycsb->distribution = DIST_UNIFORM;
+    for (uint64_t i = 0; i < records; i++) {
+        load_errors += !insert_record(ycsb);
+    }
+    double load_s      = (monotonic_ns() - load_start) / 1e9;
+    ycsb->distribution = run_dist;
+    if (run_dist != DIST_UNIFORM) {
+        zipfian_init(&ycsb->zipfian, theta, ycsb->items);
+    }
+
+    uint64_t  max_intervals = 64;
+    uint64_t* intervals     = malloc(max_intervals * sizeof(uint64_t));
+    uint64_t  num_intervals = 0;
+    uint64_t  interval_ns   = (uint64_t) interval_ms * 1000000;
+    uint64_t  interval_ops  = 0;
+
+    uint64_t run_start     = monotonic_ns();
+    uint64_t next_interval = run_start + interval_ns;
+    for (uint64_t i = 0; i < operations; i++) {
+        Operation op    = choose_operation(ycsb, workload.proportions);
+        uint64_t  start = monotonic_ns();
+        bool      ok    = run_operation(ycsb, op);
+        uint64_t  end   = monotonic_ns();
+
+        histogram_record(&ycsb->latency[op], end - start);
+        ycsb->counts[op]++;
+        ycsb->errors[op] += !ok;
+        interval_ops++;
+        /* An operation longer than an interval leaves the ones it spanned at 0 */
+        while (end >= next_interval) {
+            if (num_intervals == max_intervals) {
+                max_intervals *= 2;
+                intervals = realloc(intervals, max_intervals * sizeof(uint64_t));
+            }
+            intervals[num_intervals++] = interval_ops;
+            interval_ops               = 0;
+            next_interval += interval_ns;
+        }
+    }
+    double run_s = (monotonic_ns() - run_start) / 1e9;
+
+    printf("{\n  \"workload\": \"%c\",\n  \"distribution\": \"%s\",\n", workload.name,
+           DISTRIBUTION_NAMES[workload.distribution]);
+    printf("  \"proportions\": {");
+    for (int op = 0; op < OP_COUNT; op++) {
+        printf("\"%s\": %.3f%s", OPERATION_NAMES[op], workload.proportions[op],
+               op + 1 < OP_COUNT ? ", " : "},\n");
+    }
+    printf("  \"seed\": %" PRIu64 ",\n  \"records\": %" PRIu64 ",\n  \"operations\": %" PRIu64
+           ",\n",
+           seed, records, operations);
+    printf("  \"page_size\": %u,\n  \"shards\": %u,\n  \"insert_order\": \"%s\",\n", page_size,
+           num_shards, hashed ? "hashed" : "ordered");
+    printf("  \"load\": {\"seconds\": %.3f, \"ops_per_sec\": %.1f, \"errors\": %" PRIu64 "},\n",
+           load_s, records / load_s, load_errors);
+    printf("  \"run\": {\"seconds\": %.3f, \"ops_per_sec\": %.1f, \"rows_returned\": %" PRIu64
+           ", \"digest\": \"%016" PRIx64 "\"},\n",
+           run_s, operations / run_s, ycsb->rows_returned, ycsb->digest);
+    printf("  \"interval_ms\": %u,\n  \"throughput\": [", interval_ms);
+    for (uint64_t i = 0; i < num_intervals; i++) {
+        printf("%s%.1f", i > 0 ? ", " : "", intervals[i] * 1000.0 / interval_ms);
+    }
+    /* The last, partial interval is scaled by its own length */
+    uint64_t tail_ns = monotonic_ns() - (next_interval - interval_ns);
+    if (interval_ops > 0) {
+        printf("%s%.1f", num_intervals > 0 ? ", " : "", interval_ops * 1e9 / tail_ns);
+    }
+    printf("],\n  \"latency_us\": [\n");
+
+    bool first = true;
+    for (int op = 0; op < OP_COUNT; op++) {
+        Histogram* histogram = &ycsb->latency[op];
+        if (ycsb->counts[op] == 0) {
+            continue;
+        }
+        printf("%s    {\"name\": \"%s\", \"count\": %" PRIu64 ", \"errors\": %" PRIu64
+               ", \"p50\": %.2f, \"p90\": %.2f, \"p99\": %.2f, \"p999\": %.2f, \"max\": %.2f}",
+               first ? "" : ",\n", OPERATION_NAMES[op], ycsb->counts[op], ycsb->errors[op],
+               histogram_percentile(histogram, 50) / 1000.0,
+               histogram_percentile(histogram, 90) / 1000.0,
+               histogram_percentile(histogram, 99) / 1000.0,
+               histogram_percentile(histogram, 99.9) / 1000.0, histogram->max / 1000.0);
+        first = false;
+    }
+    printf("\n  ]\n}\n");
+
+    cqlite_finalize(ycsb->insert);
+    cqlite_finalize(ycsb->read);
+    cqlite_finalize(ycsb->scan);
+    cqlite_close(db);
+    remove_database(db_path);
+    free(intervals);
+    free(ycsb);
+    return 0;
+}
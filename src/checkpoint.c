@@ -0,0 +1,179 @@
+#define _GNU_SOURCE
+#include "checkpoint.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Pages copied per trip through the pager lock */
+#define CHECKPOINT_BATCH_PAGES 64
+
+struct Checkpointer {
+    Pager*          pager;
+    pthread_t       thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t  wake;
+    bool            running;
+    bool            wake_pending;
+    uint32_t        interval_ms;
+    uint32_t        dirty_percent;
+};
+
+/* Copies up to a batch of dirty pages from *next on and marks them clean */
+static uint32_t checkpoint_collect(Pager* pager, uint32_t* next, void* snapshot,
+                                   uint32_t* page_nums) {
+    uint32_t        batch = 0;
+    PageTableEntry* entry;
+    pthread_mutex_lock(&pager->lock);
+    while (batch < CHECKPOINT_BATCH_PAGES &&
+           (entry = page_table_next(&pager->pages, next)) != NULL) {
+        if (entry->dirty) {
+            memcpy(snapshot + batch * pager->layout.page_size, entry->frame,
+                   pager->layout.page_size);
+            entry->dirty = false;
+            pager->num_dirty--;
+            page_nums[batch++] = *next;
+        }
+        (*next)++;
+    }
+    pthread_mutex_unlock(&pager->lock);
+    return batch;
+}
+
+/*
+ * Writes every page that is dirty when it is reached. Checkpoints are
+ * serialized so an older copy of a page can never land after a newer one.
+ */
+uint32_t checkpoint(Pager* pager) {
+    pthread_mutex_lock(&pager->checkpoint_lock);
+    uint32_t page_size = pager->layout.page_size;
+    void*    snapshot  = malloc(CHECKPOINT_BATCH_PAGES * page_size);
+    uint32_t page_nums[CHECKPOINT_BATCH_PAGES];
+    uint64_t write_ns[CHECKPOINT_BATCH_PAGES];
+    uint32_t next    = 0;
+    uint32_t written = 0;
+
+    uint32_t batch;
+    while ((batch = checkpoint_collect(pager, &next, snapshot, page_nums)) > 0) {
+        for (uint32_t i = 0; i < batch; i++) {
+            uint64_t start = monotonic_ns();
+            ssize_t  bytes = pwrite(pager->file_descriptor, snapshot + i * page_size, page_size,
+                                    (off_t) page_nums[i] * page_size);
+            if (bytes == -1) {
+                printf("Error writing: %d\n", errno);
+                exit(EXIT_FAILURE);
+            }
+            write_ns[i] = monotonic_ns() - start;
+        }
+
+        pthread_mutex_lock(&pager->lock);
+        for (uint32_t i = 0; i < batch; i++) {
+            histogram_record(&pager->latency.flush, write_ns[i]);
+        }
+        pager->stats.flushes += batch;
+        pager->stats.bytes_written += (uint64_t) batch * page_size;
+        pthread_mutex_unlock(&pager->lock);
+        written += batch;
+    }
+
+    free(snapshot);
+    pthread_mutex_unlock(&pager->checkpoint_lock);
+    return written;
+}
+
+static void* checkpointer_main(void* arg) {
+    Checkpointer* checkpointer = arg;
+
+    pthread_mutex_lock(&checkpointer->mutex);
+    while (checkpointer->running) {
+        if (!checkpointer->wake_pending) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            uint64_t nsec = deadline.tv_nsec + (uint64_t) checkpointer->interval_ms * 1000000;
+            deadline.tv_sec += nsec / 1000000000;
+            deadline.tv_nsec = nsec % 1000000000;
+            pthread_cond_timedwait(&checkpointer->wake, &checkpointer->mutex, &deadline);
+        }
+        if (!checkpointer->running) {
+            break;
+        }
+        checkpointer->wake_pending = false;
+
+        pthread_mutex_unlock(&checkpointer->mutex);
+        checkpoint(checkpointer->pager);
+        pthread_mutex_lock(&checkpointer->mutex);
+    }
+    pthread_mutex_unlock(&checkpointer->mutex);
+    return NULL;
+}
+
+void checkpointer_start(Pager* pager, uint32_t interval_ms, uint32_t dirty_percent) {
+    /* Nothing in memory ever turns dirty, so the thread would only ever wake up idle */
+    if (pager->in_memory) {
+        return;
+    }
+    if (pager->checkpointer != NULL) {
+        checkpointer_stop(pager);
+    }
+
+    Checkpointer* checkpointer  = calloc(1, sizeof(Checkpointer));
+    checkpointer->pager         = pager;
+    checkpointer->running       = true;
+    checkpointer->interval_ms   = interval_ms;
+    checkpointer->dirty_percent = dirty_percent;
+    pthread_mutex_init(&checkpointer->mutex, NULL);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&checkpointer->wake, &attr);
+    pthread_condattr_destroy(&attr);
+
+    /* Published under the lock so a statement in flight never sees it half built */
+    pthread_mutex_lock(&pager->lock);
+    pager->checkpointer = checkpointer;
+    pthread_mutex_unlock(&pager->lock);
+
+    if (pthread_create(&checkpointer->thread, NULL, checkpointer_main, checkpointer) != 0) {
+        printf("Unable to start the checkpointer thread\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void checkpointer_stop(Pager* pager) {
+    Checkpointer* checkpointer = pager->checkpointer;
+    if (checkpointer == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&checkpointer->mutex);
+    checkpointer->running = false;
+    pthread_cond_signal(&checkpointer->wake);
+    pthread_mutex_unlock(&checkpointer->mutex);
+    pthread_join(checkpointer->thread, NULL);
+
+    pthread_mutex_lock(&pager->lock);
+    pager->checkpointer = NULL;
+    pthread_mutex_unlock(&pager->lock);
+
+    pthread_cond_destroy(&checkpointer->wake);
+    pthread_mutex_destroy(&checkpointer->mutex);
+    free(checkpointer);
+}
+
+/* Called with a page newly dirtied; wakes the thread early past the threshold */
+void checkpointer_note_dirty(Pager* pager) {
+    Checkpointer* checkpointer = pager->checkpointer;
+    uint64_t      threshold    = (uint64_t) checkpointer->dirty_percent * pager->num_pages;
+    if ((uint64_t) pager->num_dirty * 100 < threshold) {
+        return;
+    }
+
+    pthread_mutex_lock(&checkpointer->mutex);
+    if (!checkpointer->wake_pending) {
+        checkpointer->wake_pending = true;
+        pthread_cond_signal(&checkpointer->wake);
+    }
+    pthread_mutex_unlock(&checkpointer->mutex);
+}
@@ -0,0 +1,277 @@
+#define _GNU_SOURCE
+#include "columnar.h"
+#include "statement.h"
+#include <endian.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    const char* name;
+    ColumnType  type;
+} ColumnSchema;
+
+static const ColumnSchema SCHEMA[] = {
+    {"id", COLUMN_TYPE_UINT32},
+    {"username", COLUMN_TYPE_UTF8},
+    {"email", COLUMN_TYPE_UTF8},
+};
+#define SCHEMA_COLUMNS (sizeof(SCHEMA) / sizeof(SCHEMA[0]))
+
+static bool write_bytes(FILE* file, const void* bytes, size_t size) {
+    return size == 0 || fwrite(bytes, size, 1, file) == 1;
+}
+
+static bool read_bytes(FILE* file, void* bytes, size_t size) {
+    return size == 0 || fread(bytes, size, 1, file) == 1;
+}
+
+static bool write_u32(FILE* file, uint32_t value) {
+    value = htole32(value);
+    return write_bytes(file, &value, sizeof(value));
+}
+
+static bool read_u32(FILE* file, uint32_t* value) {
+    bool ok = read_bytes(file, value, sizeof(*value));
+    *value  = le32toh(*value);
+    return ok;
+}
+
+/* Whole columns swap in place; on a little-endian host both loops do nothing */
+static void u32_to_le(uint32_t* values, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        values[i] = htole32(values[i]);
+    }
+}
+
+static void u32_from_le(uint32_t* values, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        values[i] = le32toh(values[i]);
+    }
+}
+
+static bool write_header(FILE* file) {
+    bool ok = write_bytes(file, COLUMNAR_MAGIC, sizeof(COLUMNAR_MAGIC)) &&
+              write_u32(file, COLUMNAR_VERSION) && write_u32(file, SCHEMA_COLUMNS);
+    for (uint32_t i = 0; ok && i < SCHEMA_COLUMNS; i++) {
+        uint8_t type        = (uint8_t) SCHEMA[i].type;
+        uint8_t name_length = (uint8_t) strlen(SCHEMA[i].name);
+        ok = write_bytes(file, &type, 1) && write_bytes(file, &name_length, 1) &&
+             write_bytes(file, SCHEMA[i].name, name_length);
+    }
+    return ok;
+}
+
+/* Only streams carrying exactly this table's columns are accepted */
+static ColumnarResult read_header(FILE* file) {
+    char     magic[sizeof(COLUMNAR_MAGIC)];
+    uint32_t version;
+    uint32_t num_columns;
+    if (!read_bytes(file, magic, sizeof(magic)) || !read_u32(file, &version) ||
+        !read_u32(file, &num_columns)) {
+        return COLUMNAR_BAD_FORMAT;
+    }
+    if (memcmp(magic, COLUMNAR_MAGIC, sizeof(magic)) != 0 || version != COLUMNAR_VERSION ||
+        num_columns != SCHEMA_COLUMNS) {
+        return COLUMNAR_BAD_FORMAT;
+    }
+    for (uint32_t i = 0; i < SCHEMA_COLUMNS; i++) {
+        uint8_t type;
+        uint8_t name_length;
+        char    name[UINT8_MAX];
+        if (!read_bytes(file, &type, 1) || !read_bytes(file, &name_length, 1) ||
+            !read_bytes(file, name, name_length)) {
+            return COLUMNAR_BAD_FORMAT;
+        }
+        if (type != SCHEMA[i].type || name_length != strlen(SCHEMA[i].name) ||
+            memcmp(name, SCHEMA[i].name, name_length) != 0) {
+            return COLUMNAR_BAD_FORMAT;
+        }
+    }
+    return COLUMNAR_OK;
+}
+
+/* Appends the field's bytes up to its NUL as row `row` of a string column */
+static void column_append(uint32_t* offsets, char* data, uint32_t row, const char* field,
+                          uint32_t field_size) {
+    const char* end    = memchr(field, '\0', field_size);
+    uint32_t    length = end != NULL ? (uint32_t) (end - field) : field_size;
+    memcpy(data + offsets[row], field, length);
+    offsets[row + 1] = offsets[row] + length;
+}
+
+static void batch_append(ColumnarBatch* batch, void* row) {
+    uint32_t n = batch->num_rows++;
+    memcpy(&batch->ids[n], (char*) row + ID_OFFSET, sizeof(uint32_t));
+    column_append(batch->username_offsets, batch->usernames, n, (char*) row + USERNAME_OFFSET,
+                  COLUMN_USERNAME_SIZE + 1);
+    column_append(batch->email_offsets, batch->emails, n, (char*) row + EMAIL_OFFSET,
+                  COLUMN_EMAIL_SIZE + 1);
+}
+
+/* Leaves the offsets little-endian; the next batch only reads offsets[0], which is 0 */
+static bool write_text_column(FILE* file, uint32_t num_rows, uint32_t* offsets,
+                              const char* data) {
+    size_t   offsets_size = (num_rows + 1) * sizeof(uint32_t);
+    uint32_t data_size    = offsets[num_rows];
+    u32_to_le(offsets, num_rows + 1);
+    return write_u32(file, (uint32_t) offsets_size + data_size) &&
+           write_bytes(file, offsets, offsets_size) && write_bytes(file, data, data_size);
+}
+
+static bool write_batch(FILE* file, ColumnarBatch* batch) {
+    uint32_t n = batch->num_rows;
+    u32_to_le(batch->ids, n);
+    return write_u32(file, n) && write_u32(file, n * sizeof(uint32_t)) &&
+           write_bytes(file, batch->ids, n * sizeof(uint32_t)) &&
+           write_text_column(file, n, batch->username_offsets, batch->usernames) &&
+           write_text_column(file, n, batch->email_offsets, batch->emails);
+}
+
+ColumnarResult columnar_export(Table* table, const char* path, uint32_t* num_rows) {
+    *num_rows            = 0;
+    ColumnarBatch* batch = malloc(sizeof(ColumnarBatch));
+    if (batch == NULL) {
+        return COLUMNAR_NO_MEMORY;
+    }
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        free(batch);
+        return COLUMNAR_IO_ERROR;
+    }
+    batch->num_rows            = 0;
+    batch->username_offsets[0] = 0;
+    batch->email_offsets[0]    = 0;
+
+    /* Leaves are walked in key order, so every batch goes out sorted by id */
+    bool   ok = write_header(file);
+    Cursor cursor;
+    table_start(table, &cursor);
+    uint32_t page_num = cursor.end_of_table ? 0 : cursor.page_num;
+    while (ok && page_num != 0) {
+        void*    node      = get_page(table->pager, page_num);
+        uint32_t num_cells = *leaf_node_num_cells(node);
+        for (uint32_t i = 0; ok && i < num_cells; i++) {
+            batch_append(batch, leaf_node_value(node, i));
+            if (batch->num_rows == COLUMNAR_BATCH_ROWS) {
+                ok = write_batch(file, batch);
+                *num_rows += batch->num_rows;
+                batch->num_rows = 0;
+            }
+        }
+        page_num = *leaf_node_next_leaf(node);
+    }
+    if (ok && batch->num_rows > 0) {
+        ok = write_batch(file, batch);
+        *num_rows += batch->num_rows;
+    }
+    ok = ok && write_u32(file, 0);
+    free(batch);
+
+    if (fclose(file) != 0 || !ok) {
+        return COLUMNAR_IO_ERROR;
+    }
+    return COLUMNAR_OK;
+}
+
+/* Reads a string column, checking its offsets before any row is built from it */
+static bool read_text_column(FILE* file, uint32_t num_rows, uint32_t* offsets, char* data,
+                             uint32_t max_length) {
+    uint32_t byte_length;
+    size_t   offsets_size = (num_rows + 1) * sizeof(uint32_t);
+    if (!read_u32(file, &byte_length) || byte_length < offsets_size ||
+        byte_length - offsets_size > (size_t) num_rows * max_length) {
+        return false;
+    }
+    if (!read_bytes(file, offsets, offsets_size) ||
+        !read_bytes(file, data, byte_length - offsets_size)) {
+        return false;
+    }
+    u32_from_le(offsets, num_rows + 1);
+    if (offsets[0] != 0 || offsets[num_rows] != byte_length - offsets_size) {
+        return false;
+    }
+    for (uint32_t i = 0; i < num_rows; i++) {
+        if (offsets[i + 1] < offsets[i] || offsets[i + 1] - offsets[i] > max_length) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool read_batch(FILE* file, ColumnarBatch* batch) {
+    uint32_t n = batch->num_rows;
+    uint32_t id_length;
+    if (!read_u32(file, &id_length) || id_length != n * sizeof(uint32_t) ||
+        !read_bytes(file, batch->ids, id_length)) {
+        return false;
+    }
+    u32_from_le(batch->ids, n);
+    return read_text_column(file, n, batch->username_offsets, batch->usernames,
+                            COLUMN_USERNAME_SIZE) &&
+           read_text_column(file, n, batch->email_offsets, batch->emails, COLUMN_EMAIL_SIZE);
+}
+
+static void copy_text(char* field, const uint32_t* offsets, const char* data, uint32_t row) {
+    uint32_t length = offsets[row + 1] - offsets[row];
+    memcpy(field, data + offsets[row], length);
+    field[length] = '\0';
+}
+
+/*
+ * Rows go through the regular insert path so every index stays in step. An
+ * exported stream is in id order, so each insert lands at the right edge of
+ * the tree and fills leaves in sequence. Rows whose id already exists are
+ * skipped and counted; any other failed insert ends the import.
+ */
+ColumnarResult columnar_import(Table* table, const char* path, uint32_t* num_rows,
+                               uint32_t* num_duplicates) {
+    *num_rows            = 0;
+    *num_duplicates      = 0;
+    ColumnarBatch* batch = malloc(sizeof(ColumnarBatch));
+    if (batch == NULL) {
+        return COLUMNAR_NO_MEMORY;
+    }
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        free(batch);
+        return COLUMNAR_IO_ERROR;
+    }
+
+    ColumnarResult result = read_header(file);
+    Statement      statement;
+    memset(&statement, 0, sizeof(statement));
+    statement.type = STATEMENT_INSERT;
+    Row* row       = &statement.row_to_insert;
+
+    while (result == COLUMNAR_OK) {
+        if (!read_u32(file, &batch->num_rows) || batch->num_rows > COLUMNAR_BATCH_ROWS) {
+            result = COLUMNAR_BAD_FORMAT;
+            break;
+        }
+        if (batch->num_rows == 0) {
+            break;
+        }
+        if (!read_batch(file, batch)) {
+            result = COLUMNAR_BAD_FORMAT;
+            break;
+        }
+        for (uint32_t i = 0; i < batch->num_rows; i++) {
+            row->id = batch->ids[i];
+            copy_text(row->username, batch->username_offsets, batch->usernames, i);
+            copy_text(row->email, batch->email_offsets, batch->emails, i);
+            ExecuteResult inserted = execute_insert(&statement, table);
+            if (inserted == EXECUTE_DUPLICATE_KEY) {
+                (*num_duplicates)++;
+            } else if (inserted == EXECUTE_SUCCESS) {
+                (*num_rows)++;
+            } else {
+                result = inserted == EXECUTE_LOG_FAILED ? COLUMNAR_LOG_FAILED : COLUMNAR_TABLE_FULL;
+                break;
+            }
+        }
+    }
+    free(batch);
+    fclose(file);
+    return result;
+}
@@ -0,0 +1,454 @@
+#define _GNU_SOURCE
+#include "cqlite.h"
+#include "profile.h"
+#include "replication.h"
+#include "shard.h"
+#include "statement.h"
+#include "warmup.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Exactly one of the two is set */
+struct cqlite {
+    Table*    table;
+    ShardSet* shards;
+};
+
+struct cqlite_stmt {
+    cqlite*    db;
+    Statement  statement;
+    Scan       scan;
+    bool       scan_open;
+    ShardScan* shard_scan;
+    void*      shard_row; /* current row of shard_scan, copied out of its shard */
+    bool       done;
+    uint64_t   elapsed_ns; /* of the execution in progress, prepare included for the first */
+    Profile*   profile;    /* set between steps of a select that is being profiled */
+};
+
+static const char* COLUMN_NAMES[CQLITE_COLUMN_COUNT] = {"id", "username", "email"};
+
+CqliteResult cqlite_open(const char* filename, cqlite** db) {
+    return cqlite_open_with_page_size(filename, DEFAULT_PAGE_SIZE, db);
+}
+
+CqliteResult cqlite_open_with_page_size(const char* filename, uint32_t page_size, cqlite** db) {
+    if (!page_size_valid(page_size)) {
+        return CQLITE_MISUSE;
+    }
+    if (shard_set_is_manifest(filename)) {
+        return cqlite_open_sharded(filename, 1, page_size, db);
+    }
+    cqlite* handle = calloc(1, sizeof(cqlite));
+    handle->table  = db_open(filename, page_size);
+    *db            = handle;
+
+    /* Only here: statements through a handle take the pager lock the preload installs under */
+    warmup_start(handle->table->pager, filename);
+    return CQLITE_OK;
+}
+
+CqliteResult cqlite_open_sharded(const char* filename, uint32_t num_shards, uint32_t page_size,
+                                 cqlite** db) {
+    bool exists = access(filename, F_OK) == 0;
+    if (!page_size_valid(page_size) || num_shards == 0 || num_shards > SHARD_MAX_SHARDS ||
+        strcmp(filename, DB_IN_MEMORY) == 0 || (exists && !shard_set_is_manifest(filename))) {
+        return CQLITE_MISUSE;
+    }
+    ShardSet* shards = shard_set_open(filename, num_shards, page_size);
+    if (shards == NULL) {
+        return CQLITE_MISUSE;
+    }
+    cqlite* handle = calloc(1, sizeof(cqlite));
+    handle->shards = shards;
+    *db            = handle;
+    return CQLITE_OK;
+}
+
+CqliteResult cqlite_replicate(cqlite* db, const char* transport) {
+    if (db->table == NULL) {
+        return CQLITE_MISUSE;
+    }
+    return replication_start_primary(db->table, transport) ? CQLITE_OK : CQLITE_MISUSE;
+}
+
+CqliteResult cqlite_follow(cqlite* db, const char* transport) {
+    if (db->table == NULL) {
+        return CQLITE_MISUSE;
+    }
+    return replication_start_follower(db->table, transport) ? CQLITE_OK : CQLITE_MISUSE;
+}
+
+CqliteResult cqlite_close(cqlite* db) {
+    if (db->shards != NULL) {
+        shard_set_close(db->shards);
+    } else {
+        db_close(db->table);
+    }
+    free(db);
+    return CQLITE_OK;
+}
+
+static CqliteResult prepare_result_code(PrepareResult result) {
+    switch (result) {
+        case PREPARE_SUCCESS:
+            return CQLITE_OK;
+        case PREPARE_NEGATIVE_ID:
+            return CQLITE_NEGATIVE_ID;
+        case PREPARE_STRING_TOO_LONG:
+            return CQLITE_STRING_TOO_LONG;
+        case PREPARE_SYNTAX_ERROR:
+            return CQLITE_SYNTAX_ERROR;
+        case PREPARE_UNRECOGNIZED_STATEMENT:
+            return CQLITE_UNRECOGNIZED_STATEMENT;
+    }
+    return CQLITE_MISUSE;
+}
+
+static CqliteResult execute_result_code(ExecuteResult result) {
+    switch (result) {
+        case EXECUTE_SUCCESS:
+            return CQLITE_DONE;
+        case EXECUTE_DUPLICATE_KEY:
+            return CQLITE_DUPLICATE_KEY;
+        case EXECUTE_INDEX_EXISTS:
+            return CQLITE_INDEX_EXISTS;
+        case EXECUTE_TABLE_FULL:
+            return CQLITE_TABLE_FULL;
+        case EXECUTE_LOG_FAILED:
+            return CQLITE_LOG_FAILED;
+    }
+    return CQLITE_MISUSE;
+}
+
+CqliteResult cqlite_prepare(cqlite* db, const char* sql, cqlite_stmt** stmt) {
+    /* The parser tokenizes in place, so it gets a scratch copy */
+    char* text = strdup(sql);
+
+    uint64_t     start    = monotonic_ns();
+    cqlite_stmt* prepared = calloc(1, sizeof(cqlite_stmt));
+    prepared->db          = db;
+    CqliteResult result   = prepare_result_code(prepare_statement(text, &prepared->statement));
+    prepared->elapsed_ns  = monotonic_ns() - start;
+    free(text);
+
+    if (result != CQLITE_OK) {
+        free(prepared);
+        *stmt = NULL;
+        return result;
+    }
+    *stmt = prepared;
+    return CQLITE_OK;
+}
+
+static CqliteResult bind_target(cqlite_stmt* stmt, int index, ParamTarget* target) {
+    if (index < 1 || (uint32_t) index > stmt->statement.num_params) {
+        return CQLITE_RANGE;
+    }
+    *target = stmt->statement.params[index - 1];
+    return CQLITE_OK;
+}
+
+CqliteResult cqlite_bind_int(cqlite_stmt* stmt, int index, uint32_t value) {
+    ParamTarget  target;
+    CqliteResult result = bind_target(stmt, index, &target);
+    if (result != CQLITE_OK) {
+        return result;
+    }
+    switch (target) {
+        case PARAM_INSERT_ID:
+            stmt->statement.row_to_insert.id = value;
+            return CQLITE_OK;
+        case PARAM_WHERE_VALUE:
+            if (stmt->statement.where.column != COLUMN_ID) {
+                return CQLITE_MISUSE;
+            }
+            stmt->statement.where.id = value;
+            return CQLITE_OK;
+        case PARAM_SELECT_LIMIT:
+            stmt->statement.limit = value;
+            return CQLITE_OK;
+        default:
+            return CQLITE_MISUSE;
+    }
+}
+
+CqliteResult cqlite_bind_text(cqlite_stmt* stmt, int index, const char* value) {
+    ParamTarget  target;
+    CqliteResult result = bind_target(stmt, index, &target);
+    if (result != CQLITE_OK) {
+        return result;
+    }
+
+    Row* row = &stmt->statement.row_to_insert;
+    switch (target) {
+        case PARAM_INSERT_USERNAME:
+            if (strlen(value) > COLUMN_USERNAME_SIZE) {
+                return CQLITE_STRING_TOO_LONG;
+            }
+            strcpy(row->username, value);
+            return CQLITE_OK;
+        case PARAM_INSERT_EMAIL:
+            if (strlen(value) > COLUMN_EMAIL_SIZE) {
+                return CQLITE_STRING_TOO_LONG;
+            }
+            strcpy(row->email, value);
+            return CQLITE_OK;
+        case PARAM_WHERE_VALUE:
+            if (stmt->statement.where.column == COLUMN_ID) {
+                return CQLITE_MISUSE;
+            }
+            return prepare_result_code(where_set_text(&stmt->statement.where, value));
+        default:
+            return CQLITE_MISUSE;
+    }
+}
+
+/*
+ * Each step of a select parks the scan on the next matching row without
+ * copying it out of the page.
+ */
+static CqliteResult step_select(cqlite_stmt* stmt) {
+    if (!stmt->scan_open) {
+        scan_open(&stmt->scan, &stmt->statement, stmt->db->table);
+        stmt->scan_open = true;
+    }
+    if (scan_next(&stmt->scan)) {
+        return CQLITE_ROW;
+    }
+    stmt->done = true;
+    return stmt->scan.failed ? CQLITE_NO_MEMORY : CQLITE_DONE;
+}
+
+static CqliteResult step_statement(cqlite_stmt* stmt) {
+    switch (stmt->statement.type) {
+        case STATEMENT_INSERT:
+            stmt->done = true;
+            return execute_result_code(execute_insert(&stmt->statement, stmt->db->table));
+        case STATEMENT_CREATE_INDEX:
+            stmt->done = true;
+            return execute_result_code(execute_create_index(&stmt->statement, stmt->db->table));
+        case STATEMENT_SELECT:
+            return step_select(stmt);
+    }
+    return CQLITE_MISUSE;
+}
+
+/*
+ * A sharded handle locks each shard itself as it goes; a select reads rows
+ * its shard threads already copied out.
+ */
+static CqliteResult step_sharded(cqlite_stmt* stmt) {
+    ShardSet* shards = stmt->db->shards;
+    switch (stmt->statement.type) {
+        case STATEMENT_INSERT:
+            stmt->done = true;
+            return execute_result_code(shard_set_insert(shards, &stmt->statement));
+        case STATEMENT_CREATE_INDEX:
+            stmt->done = true;
+            return execute_result_code(shard_set_create_index(shards, &stmt->statement));
+        case STATEMENT_SELECT:
+            if (stmt->shard_scan == NULL) {
+                stmt->shard_scan = shard_scan_open(shards, &stmt->statement);
+                if (stmt->shard_scan == NULL) {
+                    stmt->done = true;
+                    return CQLITE_NO_MEMORY;
+                }
+            }
+            stmt->shard_row = shard_scan_next(stmt->shard_scan);
+            if (stmt->shard_row != NULL) {
+                return CQLITE_ROW;
+            }
+            stmt->done = true;
+            return shard_scan_failed(stmt->shard_scan) ? CQLITE_NO_MEMORY : CQLITE_DONE;
+    }
+    return CQLITE_MISUSE;
+}
+
+static Histogram* latency_histogram(cqlite_stmt* stmt) {
+    if (stmt->db->table == NULL) {
+        return NULL;
+    }
+    StatementLatency* latency = &stmt->db->table->latency;
+    WhereClause*      where   = &stmt->statement.where;
+    switch (stmt->statement.type) {
+        case STATEMENT_INSERT:
+            return &latency->insert;
+        case STATEMENT_SELECT:
+            if (where->present && where->column == COLUMN_ID && where->op == COMPARE_EQUAL) {
+                return &latency->lookup;
+            }
+            return &latency->select;
+        default:
+            return NULL;
+    }
+}
+
+CqliteResult cqlite_step(cqlite_stmt* stmt) {
+    if (stmt->done) {
+        return CQLITE_DONE;
+    }
+
+    Table* table = stmt->db->table;
+    /* A follower's rows only ever come from its primary */
+    if (table != NULL && stmt->statement.type != STATEMENT_SELECT &&
+        replication_is_follower(table)) {
+        stmt->done = true;
+        return CQLITE_READ_ONLY;
+    }
+
+    Profile* profile = table != NULL ? table->profile : NULL;
+    if (profile != NULL) {
+        profile_step_begin(profile, stmt->profile == profile);
+    }
+
+    uint64_t     start = monotonic_ns();
+    CqliteResult result;
+    if (table == NULL) {
+        result = step_sharded(stmt);
+    } else {
+        pager_begin(table->pager, stmt->statement.type == STATEMENT_SELECT);
+        result = step_statement(stmt);
+        pager_end(table->pager);
+    }
+    stmt->elapsed_ns += monotonic_ns() - start;
+
+    if (profile != NULL) {
+        profile_step_end(profile, result != CQLITE_ROW);
+    }
+    stmt->profile = result == CQLITE_ROW ? profile : NULL;
+
+    /* Time between steps is the caller's, so only the steps themselves count */
+    if (result != CQLITE_ROW) {
+        Histogram* histogram = latency_histogram(stmt);
+        if (histogram != NULL) {
+            histogram_record(histogram, stmt->elapsed_ns);
+        }
+        stmt->elapsed_ns = 0;
+    }
+    return result;
+}
+
+CqliteResult cqlite_reset(cqlite_stmt* stmt) {
+    if (stmt->profile != NULL && stmt->profile == stmt->db->table->profile) {
+        profile_statement_abandon(stmt->profile);
+    }
+    stmt->profile = NULL;
+    if (stmt->scan_open) {
+        Pager* pager = stmt->db->table->pager;
+        pager_begin(pager, true);
+        scan_close(&stmt->scan);
+        pager_end(pager);
+        stmt->scan_open = false;
+    }
+    if (stmt->shard_scan != NULL) {
+        shard_scan_close(stmt->shard_scan);
+        stmt->shard_scan = NULL;
+        stmt->shard_row  = NULL;
+    }
+    stmt->done = false;
+    return CQLITE_OK;
+}
+
+CqliteResult cqlite_finalize(cqlite_stmt* stmt) {
+    if (stmt == NULL) {
+        return CQLITE_OK;
+    }
+    cqlite_reset(stmt);
+    free(stmt);
+    return CQLITE_OK;
+}
+
+int cqlite_column_count(cqlite_stmt* stmt) {
+    return stmt->statement.type == STATEMENT_SELECT ? CQLITE_COLUMN_COUNT : 0;
+}
+
+const char* cqlite_column_name(cqlite_stmt* stmt, int column) {
+    (void) stmt;
+    if (column < 0 || column >= CQLITE_COLUMN_COUNT) {
+        return NULL;
+    }
+    return COLUMN_NAMES[column];
+}
+
+/* The current row, or NULL if the statement is not parked on one */
+static void* current_row(cqlite_stmt* stmt) {
+    if (stmt->shard_scan != NULL) {
+        return stmt->shard_row;
+    }
+    return stmt->scan_open ? stmt->scan.row : NULL;
+}
+
+uint32_t cqlite_column_int(cqlite_stmt* stmt, int column) {
+    void* row = current_row(stmt);
+    if (row == NULL || column != CQLITE_COLUMN_ID) {
+        return 0;
+    }
+    uint32_t id;
+    memcpy(&id, (char*) row + ID_OFFSET, sizeof(id));
+    return id;
+}
+
+const char* cqlite_column_text(cqlite_stmt* stmt, int column) {
+    void* row = current_row(stmt);
+    if (row == NULL) {
+        return NULL;
+    }
+    switch (column) {
+        case CQLITE_COLUMN_USERNAME:
+            return (const char*) row + USERNAME_OFFSET;
+        case CQLITE_COLUMN_EMAIL:
+            return (const char*) row + EMAIL_OFFSET;
+        default:
+            return NULL;
+    }
+}
+
+CqliteResult cqlite_meta_command(cqlite* db, const char* command) {
+    MetaCommandResult result = db->shards != NULL ? shard_set_meta_command(db->shards, command)
+                                                  : execute_meta_command(command, db->table);
+    switch (result) {
+        case META_COMMAND_SUCCESS:
+            return CQLITE_OK;
+        case META_COMMAND_UNRECOGNIZED_COMMAND:
+            return CQLITE_UNRECOGNIZED_COMMAND;
+    }
+    return CQLITE_MISUSE;
+}
+
+const char* cqlite_errstr(CqliteResult result) {
+    switch (result) {
+        case CQLITE_OK:
+        case CQLITE_ROW:
+        case CQLITE_DONE:
+            return "Executed.";
+        case CQLITE_NEGATIVE_ID:
+            return "ID must be positive.";
+        case CQLITE_STRING_TOO_LONG:
+            return "String is too long.";
+        case CQLITE_SYNTAX_ERROR:
+            return "Syntax error.";
+        case CQLITE_UNRECOGNIZED_STATEMENT:
+            return "Unrecognized keyword at start of statement.";
+        case CQLITE_UNRECOGNIZED_COMMAND:
+            return "Unrecognized command.";
+        case CQLITE_DUPLICATE_KEY:
+            return "Error: Duplicate key.";
+        case CQLITE_TABLE_FULL:
+            return "Error: Table full.";
+        case CQLITE_INDEX_EXISTS:
+            return "Error: Index already exists.";
+        case CQLITE_RANGE:
+            return "Error: Parameter index out of range.";
+        case CQLITE_MISUSE:
+            return "Error: Library misuse.";
+        case CQLITE_READ_ONLY:
+            return "Error: Read-only replica.";
+        case CQLITE_LOG_FAILED:
+            return "Error: Unable to write the replication log.";
+        case CQLITE_NO_MEMORY:
+            return "Error: Not enough memory.";
+    }
+    return "Error: Unknown result.";
+}
@@ -0,0 +1,384 @@
+#define _GNU_SOURCE
+#include "defrag.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFRAG_NONE UINT32_MAX
+
+struct Defragger {
+    Table*          table;
+    pthread_t       thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t  wake;
+    pthread_cond_t  done; /* broadcast when a round leaves the tree settled */
+    bool            running;
+    uint32_t        interval_ms;
+    uint32_t        pages;
+    uint64_t        settled_at; /* table->splits when a round last found nothing to move */
+};
+
+/*
+ * The shape of the tree, kept up to date as pages swap. Swaps only trade
+ * page numbers the tree already owns, so `slots` never changes and a page's
+ * position in it, found by binary search, indexes its parent and leaf
+ * position. Everything is sized by the tree, not the file.
+ */
+typedef struct {
+    Pager*    pager;
+    uint32_t  root_page_num;
+    uint64_t* nodes;      /* page << 32 | parent while walking, then sorted by page */
+    uint32_t* leaves;     /* in key order */
+    uint32_t* slots;      /* every page of the tree but the root, ascending */
+    uint32_t* parents;    /* by slot */
+    uint32_t* leaf_index; /* by slot; DEFRAG_NONE for internal nodes */
+    uint32_t  num_leaves;
+    uint32_t  num_slots;
+    uint32_t  capacity;
+    bool      failed;
+} DefragWalk;
+
+static void defrag_walk_node(DefragWalk* walk, uint32_t page_num, uint32_t parent) {
+    if (walk->failed) {
+        return;
+    }
+    void* node = get_page(walk->pager, page_num);
+    if (page_num != walk->root_page_num) {
+        if (walk->num_slots == walk->capacity) {
+            uint32_t  capacity = walk->capacity ? walk->capacity * 2 : 64;
+            uint64_t* nodes    = realloc(walk->nodes, capacity * sizeof(uint64_t));
+            uint32_t* leaves   = realloc(walk->leaves, capacity * sizeof(uint32_t));
+            walk->nodes        = nodes != NULL ? nodes : walk->nodes;
+            walk->leaves       = leaves != NULL ? leaves : walk->leaves;
+            if (nodes == NULL || leaves == NULL) {
+                walk->failed = true;
+                return;
+            }
+            walk->capacity = capacity;
+        }
+        walk->nodes[walk->num_slots++] = (uint64_t) page_num << 32 | parent;
+    }
+    if (get_node_type(node) == NODE_LEAF) {
+        /* A root leaf has no slot, and with no other page nothing is ever moved */
+        if (page_num != walk->root_page_num) {
+            walk->leaves[walk->num_leaves] = page_num;
+        }
+        walk->num_leaves++;
+        return;
+    }
+    uint32_t num_keys = *internal_node_num_keys(node);
+    for (uint32_t i = 0; i <= num_keys; i++) {
+        uint32_t child = *internal_node_child(node, i);
+        /* An empty internal node has no right child yet */
+        if (child != DEFRAG_NONE) {
+            defrag_walk_node(walk, child, page_num);
+        }
+    }
+}
+
+static int compare_nodes(const void* a, const void* b) {
+    uint64_t left  = *(const uint64_t*) a;
+    uint64_t right = *(const uint64_t*) b;
+    return (left > right) - (left < right);
+}
+
+static uint32_t slot_of(DefragWalk* walk, uint32_t page_num) {
+    uint32_t min_index = 0;
+    uint32_t max_index = walk->num_slots;
+    while (min_index != max_index) {
+        uint32_t index = (min_index + max_index) / 2;
+        if (walk->slots[index] < page_num) {
+            min_index = index + 1;
+        } else {
+            max_index = index;
+        }
+    }
+    return min_index;
+}
+
+static bool defrag_walk(DefragWalk* walk, Table* table) {
+    Pager* pager = table->pager;
+    memset(walk, 0, sizeof(DefragWalk));
+    walk->pager         = pager;
+    walk->root_page_num = table->root_page_num;
+
+    defrag_walk_node(walk, table->root_page_num, DEFRAG_NONE);
+    if (walk->failed) {
+        return false;
+    }
+
+    if (walk->num_slots == 0) {
+        return true;
+    }
+
+    qsort(walk->nodes, walk->num_slots, sizeof(uint64_t), compare_nodes);
+    walk->slots      = malloc(walk->num_slots * sizeof(uint32_t));
+    walk->parents    = malloc(walk->num_slots * sizeof(uint32_t));
+    walk->leaf_index = malloc(walk->num_slots * sizeof(uint32_t));
+    if (walk->slots == NULL || walk->parents == NULL || walk->leaf_index == NULL) {
+        return false;
+    }
+    for (uint32_t i = 0; i < walk->num_slots; i++) {
+        walk->slots[i]      = walk->nodes[i] >> 32;
+        walk->parents[i]    = (uint32_t) walk->nodes[i];
+        walk->leaf_index[i] = DEFRAG_NONE;
+    }
+    for (uint32_t i = 0; i < walk->num_leaves; i++) {
+        walk->leaf_index[slot_of(walk, walk->leaves[i])] = i;
+    }
+    return true;
+}
+
+static void defrag_walk_free(DefragWalk* walk) {
+    free(walk->nodes);
+    free(walk->leaves);
+    free(walk->slots);
+    free(walk->parents);
+    free(walk->leaf_index);
+}
+
+static uint32_t swapped(uint32_t page_num, uint32_t a, uint32_t b) {
+    return page_num == a ? b : page_num == b ? a : page_num;
+}
+
+/* Repoints whatever in this node refers to a or b at the other one */
+static void defrag_repoint(Pager* pager, uint32_t page_num, uint32_t a, uint32_t b) {
+    void* node         = get_page_for_write(pager, page_num);
+    *node_parent(node) = swapped(*node_parent(node), a, b);
+    if (get_node_type(node) == NODE_LEAF) {
+        *leaf_node_next_leaf(node) = swapped(*leaf_node_next_leaf(node), a, b);
+        return;
+    }
+    uint32_t num_keys = *internal_node_num_keys(node);
+    for (uint32_t i = 0; i <= num_keys; i++) {
+        uint32_t* child = internal_node_child(node, i);
+        *child          = swapped(*child, a, b);
+    }
+}
+
+static uint32_t previous_leaf(DefragWalk* walk, uint32_t slot) {
+    uint32_t index = walk->leaf_index[slot];
+    return index == DEFRAG_NONE || index == 0 ? DEFRAG_NONE : walk->leaves[index - 1];
+}
+
+static bool contains(const uint32_t* pages, uint32_t count, uint32_t page_num) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (pages[i] == page_num) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Trades the places of leaf `a` and node `b`, a leaf or an internal node,
+ * neither of them the root. Everything that can point at either is repointed
+ * exactly once before the frames swap: both nodes, their parents, the leaves
+ * before them and, if b is internal, its children.
+ */
+static void defrag_swap(DefragWalk* walk, uint32_t a, uint32_t b) {
+    Pager*   pager         = walk->pager;
+    uint32_t slot_a        = slot_of(walk, a);
+    uint32_t slot_b        = slot_of(walk, b);
+    uint32_t parent_a      = walk->parents[slot_a];
+    uint32_t parent_b      = walk->parents[slot_b];
+    uint32_t candidates[6] = {a,        b, parent_a, parent_b, previous_leaf(walk, slot_a),
+                              previous_leaf(walk, slot_b)};
+    uint32_t nodes[6];
+    uint32_t num_nodes = 0;
+    for (uint32_t i = 0; i < 6; i++) {
+        if (candidates[i] != DEFRAG_NONE && !contains(nodes, num_nodes, candidates[i])) {
+            nodes[num_nodes++] = candidates[i];
+        }
+    }
+    for (uint32_t i = 0; i < num_nodes; i++) {
+        defrag_repoint(pager, nodes[i], a, b);
+    }
+
+    void* node_b = get_page(pager, b);
+    bool  b_leaf = get_node_type(node_b) == NODE_LEAF;
+    if (!b_leaf) {
+        uint32_t num_keys = *internal_node_num_keys(node_b);
+        for (uint32_t i = 0; i <= num_keys; i++) {
+            uint32_t child = *internal_node_child(node_b, i);
+            if (child != DEFRAG_NONE && !contains(nodes, num_nodes, child)) {
+                defrag_repoint(pager, child, a, b);
+            }
+        }
+    }
+
+    /* Both were just repointed, so both are cached and dirty */
+    PageTableEntry* entry_a = page_table_entry(&pager->pages, a);
+    PageTableEntry* entry_b = page_table_entry(&pager->pages, b);
+    void*           frame   = entry_a->frame;
+    entry_a->frame          = entry_b->frame;
+    entry_b->frame          = frame;
+
+    walk->parents[slot_b] = swapped(parent_a, a, b);
+    walk->parents[slot_a] = swapped(parent_b, a, b);
+    if (!b_leaf) {
+        void*    node     = get_page(pager, a);
+        uint32_t num_keys = *internal_node_num_keys(node);
+        for (uint32_t i = 0; i <= num_keys; i++) {
+            uint32_t child = *internal_node_child(node, i);
+            if (child != DEFRAG_NONE) {
+                walk->parents[slot_of(walk, child)] = a;
+            }
+        }
+    }
+
+    uint32_t index_a         = walk->leaf_index[slot_a];
+    uint32_t index_b         = walk->leaf_index[slot_b];
+    walk->leaves[index_a]    = b;
+    walk->leaf_index[slot_b] = index_a;
+    walk->leaf_index[slot_a] = index_b;
+    if (index_b != DEFRAG_NONE) {
+        walk->leaves[index_b] = a;
+    }
+}
+
+DefragResult defrag(Table* table, uint32_t max_pages) {
+    DefragWalk   walk;
+    DefragResult result = {0, 0, 0, false};
+    if (!defrag_walk(&walk, table)) {
+        defrag_walk_free(&walk);
+        result.failed = true;
+        return result;
+    }
+
+    /* A root that is itself the only leaf has nowhere to go */
+    result.leaves    = walk.num_leaves;
+    uint32_t movable = walk.num_slots > 0 ? walk.num_leaves : 0;
+    for (uint32_t i = 0; i < movable && result.moved < max_pages; i++) {
+        /* Leaves before i are in place, so slot i holds a later leaf or an internal node */
+        if (walk.leaves[i] != walk.slots[i]) {
+            defrag_swap(&walk, walk.leaves[i], walk.slots[i]);
+            result.moved++;
+        }
+    }
+
+    for (uint32_t i = 0; i < movable; i++) {
+        result.runs += i == 0 || walk.leaves[i] != walk.leaves[i - 1] + 1;
+    }
+    result.runs = movable > 0 ? result.runs : walk.num_leaves;
+    defrag_walk_free(&walk);
+    return result;
+}
+
+static void* defragger_main(void* arg) {
+    Defragger* defragger = arg;
+    Table*     table     = defragger->table;
+
+    pthread_mutex_lock(&defragger->mutex);
+    while (defragger->running) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        uint64_t nsec = deadline.tv_nsec + (uint64_t) defragger->interval_ms * 1000000;
+        deadline.tv_sec += nsec / 1000000000;
+        deadline.tv_nsec = nsec % 1000000000;
+        pthread_cond_timedwait(&defragger->wake, &defragger->mutex, &deadline);
+        if (!defragger->running) {
+            break;
+        }
+        pthread_mutex_unlock(&defragger->mutex);
+
+        /*
+         * Only splits add pages to the tree; while they hold still there is
+         * nothing new to move. Only this thread writes settled_at, so it reads
+         * it without the mutex and takes the mutex to publish a new value.
+         */
+        pager_begin(table->pager, false);
+        uint64_t splits  = table->splits;
+        bool     settled = splits == defragger->settled_at;
+        if (table->open_scans == 0 && !settled) {
+            /* Out of memory the round is just skipped, and retried on the next one */
+            DefragResult result = defrag(table, defragger->pages);
+            settled             = !result.failed && result.moved == 0;
+        }
+        pager_end(table->pager);
+
+        pthread_mutex_lock(&defragger->mutex);
+        if (settled) {
+            defragger->settled_at = splits;
+            pthread_cond_broadcast(&defragger->done);
+        }
+    }
+    pthread_mutex_unlock(&defragger->mutex);
+    return NULL;
+}
+
+void defragger_start(Table* table, uint32_t interval_ms, uint32_t pages) {
+    if (table->defragger != NULL) {
+        defragger_stop(table);
+    }
+
+    Defragger* defragger   = calloc(1, sizeof(Defragger));
+    defragger->table       = table;
+    defragger->running     = true;
+    defragger->interval_ms = interval_ms;
+    defragger->pages       = pages;
+    defragger->settled_at  = UINT64_MAX;
+    pthread_mutex_init(&defragger->mutex, NULL);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&defragger->wake, &attr);
+    pthread_cond_init(&defragger->done, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pthread_mutex_lock(&table->pager->lock);
+    table->defragger = defragger;
+    pthread_mutex_unlock(&table->pager->lock);
+
+    if (pthread_create(&defragger->thread, NULL, defragger_main, defragger) != 0) {
+        printf("Unable to start the defragmenter thread\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void defragger_stop(Table* table) {
+    Defragger* defragger = table->defragger;
+    if (defragger == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&defragger->mutex);
+    defragger->running = false;
+    pthread_cond_signal(&defragger->wake);
+    pthread_mutex_unlock(&defragger->mutex);
+    pthread_join(defragger->thread, NULL);
+
+    pthread_mutex_lock(&table->pager->lock);
+    table->defragger = NULL;
+    pthread_mutex_unlock(&table->pager->lock);
+
+    pthread_cond_destroy(&defragger->wake);
+    pthread_cond_destroy(&defragger->done);
+    pthread_mutex_destroy(&defragger->mutex);
+    free(defragger);
+}
+
+void defragger_wait(Table* table) {
+    Defragger* defragger = table->defragger;
+    if (defragger == NULL) {
+        return;
+    }
+
+    /* A round settled before the latest splits says nothing about the pages they added */
+    pthread_mutex_lock(&table->pager->lock);
+    uint64_t splits = table->splits;
+    pthread_mutex_unlock(&table->pager->lock);
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += DEFRAG_WAIT_MS / 1000;
+
+    pthread_mutex_lock(&defragger->mutex);
+    while (defragger->settled_at == UINT64_MAX || defragger->settled_at < splits) {
+        if (pthread_cond_timedwait(&defragger->done, &defragger->mutex, &deadline) != 0) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&defragger->mutex);
+}
@@ -0,0 +1,78 @@
+#define _GNU_SOURCE
+#include "frame_slab.h"
+#include "table.h"
+#include <stdio.h>
+#include <sys/mman.h>
+
+static void* frame_slab_map(size_t size, int extra_flags) {
+    return mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | extra_flags, -1,
+                0);
+}
+
+static void frame_slab_grow(FrameSlab* slab) {
+    char* memory = frame_slab_map(FRAME_SLAB_CHUNK_SIZE, MAP_HUGETLB);
+    if (memory != MAP_FAILED) {
+        slab->huge_chunks++;
+    } else {
+        /* No huge pages reserved: map twice the size and trim to an aligned chunk for THP */
+        char* raw = frame_slab_map(2 * FRAME_SLAB_CHUNK_SIZE, 0);
+        if (raw == MAP_FAILED) {
+            printf("Unable to map page frames\n");
+            exit(EXIT_FAILURE);
+        }
+        uintptr_t mask = FRAME_SLAB_CHUNK_SIZE - 1;
+        memory         = (char*) (((uintptr_t) raw + mask) & ~mask);
+        if (memory > raw) {
+            munmap(raw, memory - raw);
+        }
+        char* tail = memory + FRAME_SLAB_CHUNK_SIZE;
+        munmap(tail, raw + 2 * FRAME_SLAB_CHUNK_SIZE - tail);
+        madvise(memory, FRAME_SLAB_CHUNK_SIZE, MADV_HUGEPAGE);
+    }
+
+    FrameSlabChunk* chunk = malloc(sizeof(FrameSlabChunk));
+    chunk->memory         = memory;
+    chunk->next           = slab->chunks;
+    slab->chunks          = chunk;
+    slab->next_frame      = memory;
+    slab->end             = memory + FRAME_SLAB_CHUNK_SIZE;
+}
+
+void frame_slab_init(FrameSlab* slab, uint32_t frame_size) {
+    slab->frame_size  = frame_size;
+    slab->chunks      = NULL;
+    slab->next_frame  = NULL;
+    slab->end         = NULL;
+    slab->free_frames = NULL;
+    slab->huge_chunks = 0;
+}
+
+void* frame_slab_alloc(FrameSlab* slab) {
+    if (slab->free_frames != NULL) {
+        void* frame       = slab->free_frames;
+        slab->free_frames = *(void**) frame;
+        return frame;
+    }
+    if (slab->next_frame == slab->end) {
+        frame_slab_grow(slab);
+    }
+    void* frame = slab->next_frame;
+    slab->next_frame += slab->frame_size;
+    return frame;
+}
+
+void frame_slab_free(FrameSlab* slab, void* frame) {
+    *(void**) frame   = slab->free_frames;
+    slab->free_frames = frame;
+}
+
+void frame_slab_destroy(FrameSlab* slab) {
+    FrameSlabChunk* chunk = slab->chunks;
+    while (chunk != NULL) {
+        FrameSlabChunk* next = chunk->next;
+        munmap(chunk->memory, FRAME_SLAB_CHUNK_SIZE);
+        free(chunk);
+        chunk = next;
+    }
+    frame_slab_init(slab, slab->frame_size);
+}
@@ -0,0 +1,244 @@
+#include "hash_index.h"
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Directory Page Layout
+ *
+ *   bytes 0-3   global_depth
+ *   bytes 4-..  bucket page number for each of the (1 << global_depth) slots
+ *
+ * Bucket Page Layout
+ *
+ *   bytes 0-3   local_depth
+ *   bytes 4-7   num_entries
+ *   bytes 8-11  overflow page number (0 = none)
+ *   bytes 12-.. entries of (id, leaf page hint), 8 bytes each
+ */
+#define HASH_DIRECTORY_HEADER_SIZE sizeof(uint32_t)
+#define HASH_BUCKET_HEADER_SIZE (3 * sizeof(uint32_t))
+#define HASH_ENTRY_SIZE (2 * sizeof(uint32_t))
+
+typedef struct {
+    uint32_t id;
+    uint32_t leaf_page_num;
+} HashEntry;
+
+static uint32_t* hash_directory_global_depth(void* directory) {
+    return directory;
+}
+
+static uint32_t* hash_directory_slot(void* directory, uint32_t slot) {
+    return directory + HASH_DIRECTORY_HEADER_SIZE + slot * sizeof(uint32_t);
+}
+
+static uint32_t* hash_bucket_local_depth(void* bucket) {
+    return bucket;
+}
+
+static uint32_t* hash_bucket_num_entries(void* bucket) {
+    return bucket + sizeof(uint32_t);
+}
+
+static uint32_t* hash_bucket_overflow(void* bucket) {
+    return bucket + 2 * sizeof(uint32_t);
+}
+
+static HashEntry* hash_bucket_entry(void* bucket, uint32_t entry_num) {
+    return bucket + HASH_BUCKET_HEADER_SIZE + entry_num * HASH_ENTRY_SIZE;
+}
+
+static uint32_t hash_bucket_max_entries(Pager* pager) {
+    return (pager->layout.page_size - HASH_BUCKET_HEADER_SIZE) / HASH_ENTRY_SIZE;
+}
+
+/* Deepest directory whose slots still fit in one page */
+static uint32_t hash_max_global_depth(Pager* pager) {
+    uint32_t max_slots = (pager->layout.page_size - HASH_DIRECTORY_HEADER_SIZE) / sizeof(uint32_t);
+    uint32_t depth     = 0;
+    while ((2u << depth) <= max_slots) {
+        depth++;
+    }
+    return depth;
+}
+
+/* Ids are mostly sequential; mix them so the low bits spread across buckets */
+static uint32_t hash_id(uint32_t id) {
+    id ^= id >> 16;
+    id *= 0x85ebca6b;
+    id ^= id >> 13;
+    id *= 0xc2b2ae35;
+    id ^= id >> 16;
+    return id;
+}
+
+static void* hash_directory(Table* table) {
+    return get_page(table->pager, db_header(table)->hash_index_directory);
+}
+
+static void* hash_directory_for_write(Table* table) {
+    return get_page_for_write(table->pager, db_header(table)->hash_index_directory);
+}
+
+static uint32_t hash_bucket_page_for(void* directory, uint32_t id) {
+    uint32_t mask = (1u << *hash_directory_global_depth(directory)) - 1;
+    return *hash_directory_slot(directory, hash_id(id) & mask);
+}
+
+static uint32_t hash_bucket_create(Pager* pager, uint32_t local_depth) {
+    uint32_t page_num                = get_unused_page_num(pager);
+    void*    bucket                  = get_page_for_write(pager, page_num);
+    *hash_bucket_local_depth(bucket) = local_depth;
+    *hash_bucket_num_entries(bucket) = 0;
+    *hash_bucket_overflow(bucket)    = 0;
+    return page_num;
+}
+
+/* Walks the bucket and its overflow chain for id; `bucket_page_num` ends on the one holding it */
+static HashEntry* hash_bucket_search(Pager* pager, uint32_t* bucket_page_num, uint32_t id) {
+    while (*bucket_page_num != 0) {
+        void*    bucket      = get_page(pager, *bucket_page_num);
+        uint32_t num_entries = *hash_bucket_num_entries(bucket);
+        for (uint32_t i = 0; i < num_entries; i++) {
+            HashEntry* entry = hash_bucket_entry(bucket, i);
+            if (entry->id == id) {
+                return entry;
+            }
+        }
+        *bucket_page_num = *hash_bucket_overflow(bucket);
+    }
+    return NULL;
+}
+
+/*
+ * Splits a full bucket on its next hash bit, doubling the directory first if
+ * the bucket already uses every directory bit.
+ */
+static void hash_bucket_split(Table* table, uint32_t bucket_page_num) {
+    Pager*   pager        = table->pager;
+    void*    directory    = hash_directory_for_write(table);
+    void*    bucket       = get_page_for_write(pager, bucket_page_num);
+    uint32_t local_depth  = *hash_bucket_local_depth(bucket);
+    uint32_t global_depth = *hash_directory_global_depth(directory);
+
+    if (local_depth == global_depth) {
+        uint32_t num_slots = 1u << global_depth;
+        memcpy(hash_directory_slot(directory, num_slots), hash_directory_slot(directory, 0),
+               num_slots * sizeof(uint32_t));
+        *hash_directory_global_depth(directory) = ++global_depth;
+    }
+
+    uint32_t new_page_num            = hash_bucket_create(pager, local_depth + 1);
+    void*    new_bucket              = get_page_for_write(pager, new_page_num);
+    *hash_bucket_local_depth(bucket) = local_depth + 1;
+
+    /* Entries whose new bit is set move to the new bucket */
+    uint32_t split_bit   = 1u << local_depth;
+    uint32_t num_entries = *hash_bucket_num_entries(bucket);
+    uint32_t kept        = 0;
+    for (uint32_t i = 0; i < num_entries; i++) {
+        HashEntry entry = *hash_bucket_entry(bucket, i);
+        if (hash_id(entry.id) & split_bit) {
+            *hash_bucket_entry(new_bucket, (*hash_bucket_num_entries(new_bucket))++) = entry;
+        } else {
+            *hash_bucket_entry(bucket, kept++) = entry;
+        }
+    }
+    *hash_bucket_num_entries(bucket) = kept;
+
+    for (uint32_t slot = 0; slot < (1u << global_depth); slot++) {
+        if (*hash_directory_slot(directory, slot) == bucket_page_num && (slot & split_bit)) {
+            *hash_directory_slot(directory, slot) = new_page_num;
+        }
+    }
+}
+
+bool hash_index_exists(Table* table) {
+    return db_header(table)->hash_index_directory != 0;
+}
+
+void hash_index_insert(Table* table, uint32_t id, uint32_t leaf_page_num) {
+    Pager*   pager = table->pager;
+    uint32_t bucket_page_num;
+    void*    bucket;
+
+    while (true) {
+        bucket_page_num = hash_bucket_page_for(hash_directory(table), id);
+        bucket          = get_page(pager, bucket_page_num);
+        if (*hash_bucket_num_entries(bucket) < hash_bucket_max_entries(pager) ||
+            *hash_bucket_local_depth(bucket) == hash_max_global_depth(pager)) {
+            break;
+        }
+        hash_bucket_split(table, bucket_page_num);
+    }
+
+    /* Only a bucket the directory can no longer split grows an overflow chain */
+    while (*hash_bucket_num_entries(bucket) >= hash_bucket_max_entries(pager)) {
+        if (*hash_bucket_overflow(bucket) == 0) {
+            pager_mark_dirty(pager, bucket_page_num);
+            *hash_bucket_overflow(bucket) =
+                hash_bucket_create(pager, *hash_bucket_local_depth(bucket));
+        }
+        bucket_page_num = *hash_bucket_overflow(bucket);
+        bucket          = get_page(pager, bucket_page_num);
+    }
+
+    pager_mark_dirty(pager, bucket_page_num);
+    HashEntry* entry     = hash_bucket_entry(bucket, (*hash_bucket_num_entries(bucket))++);
+    entry->id            = id;
+    entry->leaf_page_num = leaf_page_num;
+}
+
+/*
+ * Allocates the directory with a single depth-0 bucket and fills it from a
+ * walk of the leaves, which also gives every entry an exact leaf hint.
+ */
+void hash_index_create(Table* table) {
+    uint32_t directory_page_num             = get_unused_page_num(table->pager);
+    void*    directory                      = get_page_for_write(table->pager, directory_page_num);
+    *hash_directory_global_depth(directory) = 0;
+    *hash_directory_slot(directory, 0)      = hash_bucket_create(table->pager, 0);
+
+    db_header_for_write(table)->hash_index_directory = directory_page_num;
+
+    Cursor cursor;
+    table_start(table, &cursor);
+    while (!cursor.end_of_table) {
+        void* node = get_page(table->pager, cursor.page_num);
+        hash_index_insert(table, *leaf_node_key(node, cursor.cell_num), cursor.page_num);
+        cursor_advance(&cursor);
+    }
+}
+
+bool hash_index_contains(Table* table, uint32_t id) {
+    uint32_t bucket_page_num = hash_bucket_page_for(hash_directory(table), id);
+    return hash_bucket_search(table->pager, &bucket_page_num, id) != NULL;
+}
+
+/*
+ * Points the cursor at the row with this id, or returns false if there is
+ * none. A valid hint costs one leaf binary search instead of a descent from
+ * the root.
+ */
+bool hash_index_find(Table* table, uint32_t id, Cursor* cursor) {
+    uint32_t   bucket_page_num = hash_bucket_page_for(hash_directory(table), id);
+    HashEntry* entry           = hash_bucket_search(table->pager, &bucket_page_num, id);
+    if (entry == NULL) {
+        return false;
+    }
+
+    void* hinted = get_page(table->pager, entry->leaf_page_num);
+    if (get_node_type(hinted) == NODE_LEAF) {
+        leaf_node_find(table, entry->leaf_page_num, id, cursor);
+        if (cursor->cell_num < *leaf_node_num_cells(hinted) &&
+            *leaf_node_key(hinted, cursor->cell_num) == id) {
+            return true;
+        }
+    }
+
+    /* The row moved in a split since the hint was written; selects repair it too, so say so */
+    table_find(table, id, cursor);
+    entry->leaf_page_num = cursor->page_num;
+    pager_mark_dirty(table->pager, bucket_page_num);
+    return true;
+}
@@ -0,0 +1,77 @@
+#define _GNU_SOURCE
+#include "histogram.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <time.h>
+
+uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/*
+ * Values below HISTOGRAM_SUB_BUCKETS get a bucket each. Above that, the
+ * position of the top bit picks the row and the next four bits the column.
+ */
+static uint32_t histogram_bucket(uint64_t value) {
+    if (value < HISTOGRAM_SUB_BUCKETS) {
+        return value;
+    }
+    uint32_t exponent = 63 - __builtin_clzll(value);
+    uint32_t shift    = exponent - HISTOGRAM_SUB_BUCKET_BITS;
+    uint32_t sub      = (value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1);
+    return (shift + 1) * HISTOGRAM_SUB_BUCKETS + sub;
+}
+
+/* Largest value that lands in the bucket */
+static uint64_t histogram_bucket_limit(uint32_t bucket) {
+    if (bucket < HISTOGRAM_SUB_BUCKETS) {
+        return bucket;
+    }
+    uint32_t shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+    uint64_t sub   = bucket % HISTOGRAM_SUB_BUCKETS;
+    uint64_t low   = (HISTOGRAM_SUB_BUCKETS + sub) << shift;
+    return low + ((uint64_t) 1 << shift) - 1;
+}
+
+void histogram_record(Histogram* histogram, uint64_t value) {
+    histogram->buckets[histogram_bucket(value)]++;
+    histogram->count++;
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+uint64_t histogram_percentile(Histogram* histogram, double percentile) {
+    if (histogram->count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t) (percentile / 100.0 * histogram->count + 0.999999);
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (uint32_t bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+        seen += histogram->buckets[bucket];
+        if (seen >= rank) {
+            uint64_t limit = histogram_bucket_limit(bucket);
+            return limit < histogram->max ? limit : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+void histogram_print_header() {
+    printf("%-12s %10s %10s %10s %10s %10s %10s\n", "(us)", "count", "p50", "p90", "p99", "p999",
+           "max");
+}
+
+void histogram_print(const char* name, Histogram* histogram) {
+    printf("%-12s %10" PRIu64 " %10.1f %10.1f %10.1f %10.1f %10.1f\n", name, histogram->count,
+           histogram_percentile(histogram, 50) / 1000.0,
+           histogram_percentile(histogram, 90) / 1000.0,
+           histogram_percentile(histogram, 99) / 1000.0,
+           histogram_percentile(histogram, 99.9) / 1000.0, histogram->max / 1000.0);
+}
@@ -0,0 +1,24 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "table.h"
+
+/*
+ * Incremental flushing of dirty pages, either on demand or from an optional
+ * background thread. The thread wakes every `interval_ms`, or sooner once
+ * `dirty_percent` of the cached pages are dirty, so a long session is
+ * written out as it goes and db_close only has the remainder left.
+ *
+ * Pages are copied out under the pager lock and written without it, so the
+ * foreground only waits for the copy, never for the disk. A page dirtied
+ * again after its copy was taken simply stays dirty for the next round.
+ */
+#define CHECKPOINT_DEFAULT_INTERVAL_MS 1000
+#define CHECKPOINT_DEFAULT_DIRTY_PERCENT 10
+
+uint32_t checkpoint(Pager* pager);
+void     checkpointer_start(Pager* pager, uint32_t interval_ms, uint32_t dirty_percent);
+void     checkpointer_stop(Pager* pager);
+void     checkpointer_note_dirty(Pager* pager);
+
+#endif // CHECKPOINT_H
@@ -0,0 +1,53 @@
+#ifndef COLUMNAR_H
+#define COLUMNAR_H
+
+#include "table.h"
+
+/*
+ * A self-describing columnar stream for moving whole tables in and out,
+ * shaped like an Arrow IPC stream: a schema up front, then record batches of
+ * one buffer per column, then an end marker. Integers are little-endian
+ * whatever the host, so a stream moves between machines.
+ *
+ *   header  "CQLCOL1\0", uint32 version, uint32 column count, then per column
+ *           uint8 type, uint8 name length and the name
+ *   batch   uint32 row count, then per column a uint32 byte length and the bytes:
+ *           COLUMN_TYPE_UINT32 holds row count values, COLUMN_TYPE_UTF8 holds
+ *           row count + 1 offsets followed by the concatenated strings
+ *   end     a batch with a row count of 0
+ *
+ * Export copies column bytes straight out of the leaves and import copies them
+ * straight into rows, one batch at a time, so both run in constant memory.
+ * Import then inserts those rows one by one rather than building leaves.
+ */
+#define COLUMNAR_MAGIC "CQLCOL1"
+#define COLUMNAR_VERSION 1
+#define COLUMNAR_BATCH_ROWS 4096
+
+typedef enum { COLUMN_TYPE_UINT32, COLUMN_TYPE_UTF8 } ColumnType;
+
+/* TABLE_FULL and LOG_FAILED stop an import at the row that failed; the rows before it stay */
+typedef enum {
+    COLUMNAR_OK,
+    COLUMNAR_IO_ERROR,
+    COLUMNAR_BAD_FORMAT,
+    COLUMNAR_NO_MEMORY,
+    COLUMNAR_TABLE_FULL,
+    COLUMNAR_LOG_FAILED
+} ColumnarResult;
+
+/* One batch of rows, column by column; string columns as Arrow-style offsets and bytes */
+typedef struct {
+    uint32_t num_rows;
+    uint32_t ids[COLUMNAR_BATCH_ROWS];
+    uint32_t username_offsets[COLUMNAR_BATCH_ROWS + 1];
+    char     usernames[COLUMNAR_BATCH_ROWS * COLUMN_USERNAME_SIZE];
+    uint32_t email_offsets[COLUMNAR_BATCH_ROWS + 1];
+    char     emails[COLUMNAR_BATCH_ROWS * COLUMN_EMAIL_SIZE];
+} ColumnarBatch;
+
+ColumnarResult columnar_export(Table* table, const char* path, uint32_t* num_rows);
+ColumnarResult columnar_import(Table* table, const char* path, uint32_t* num_rows,
+                               uint32_t* num_duplicates);
+
+#endif // COLUMNAR_H
@@ -0,0 +1,98 @@
+#ifndef CQLITE_H
+#define CQLITE_H
+
+#include <stdint.h>
+
+/*
+ * Embeddable API for linking the engine into another process.
+ *
+ *   cqlite*      db;
+ *   cqlite_stmt* stmt;
+ *   cqlite_open("app.db", &db);
+ *   cqlite_prepare(db, "insert ? ? ?", &stmt);
+ *   cqlite_bind_int(stmt, 1, 42);
+ *   cqlite_bind_text(stmt, 2, "alice");
+ *   cqlite_bind_text(stmt, 3, "alice@example.com");
+ *   cqlite_step(stmt);       // CQLITE_DONE
+ *   cqlite_finalize(stmt);
+ *
+ *   cqlite_prepare(db, "select", &stmt);
+ *   while (cqlite_step(stmt) == CQLITE_ROW) {
+ *       use(cqlite_column_int(stmt, 0), cqlite_column_text(stmt, 1));
+ *   }
+ *   cqlite_finalize(stmt);
+ *   cqlite_close(db);
+ *
+ * Parameters are numbered from 1 in the order their `?` appears, columns from
+ * 0 (id, username, email). Text returned by cqlite_column_text points straight
+ * into the cached page and stays valid until the next step, reset or finalize
+ * on that statement, or the next write through the same handle.
+ */
+
+typedef struct cqlite      cqlite;
+typedef struct cqlite_stmt cqlite_stmt;
+
+typedef enum {
+    CQLITE_OK,
+    CQLITE_ROW,
+    CQLITE_DONE,
+    CQLITE_NEGATIVE_ID,
+    CQLITE_STRING_TOO_LONG,
+    CQLITE_SYNTAX_ERROR,
+    CQLITE_UNRECOGNIZED_STATEMENT,
+    CQLITE_UNRECOGNIZED_COMMAND,
+    CQLITE_DUPLICATE_KEY,
+    CQLITE_TABLE_FULL,
+    CQLITE_INDEX_EXISTS,
+    CQLITE_RANGE,
+    CQLITE_MISUSE,
+    CQLITE_READ_ONLY,
+    CQLITE_LOG_FAILED,
+    CQLITE_NO_MEMORY
+} CqliteResult;
+
+typedef enum { CQLITE_COLUMN_ID, CQLITE_COLUMN_USERNAME, CQLITE_COLUMN_EMAIL } CqliteColumn;
+
+#define CQLITE_COLUMN_COUNT 3
+
+/* ":memory:" opens a database with no file behind it; its rows go away on close */
+CqliteResult cqlite_open(const char* filename, cqlite** db);
+/* Pages of 4096 to 65536 bytes, a power of two, for a new file; an existing one keeps its own */
+CqliteResult cqlite_open_with_page_size(const char* filename, uint32_t page_size, cqlite** db);
+/*
+ * Spreads the ids over `num_shards` files, `<filename>-<n>`, by key range, with
+ * `filename` a manifest naming them; see shard.h. An existing manifest keeps
+ * its own shards, and cqlite_open recognises one too.
+ */
+CqliteResult cqlite_open_sharded(const char* filename, uint32_t num_shards, uint32_t page_size,
+                                 cqlite** db);
+CqliteResult cqlite_close(cqlite* db);
+
+/*
+ * Read replicas: a primary logs every write for followers, which replay it
+ * and refuse writes of their own. The transport is "dir:<path>" for a shared
+ * directory or "unix:<path>" for a socket; see replication.h. CQLITE_MISUSE
+ * if it cannot be opened or the handle already replicates.
+ */
+CqliteResult cqlite_replicate(cqlite* db, const char* transport);
+CqliteResult cqlite_follow(cqlite* db, const char* transport);
+
+CqliteResult cqlite_prepare(cqlite* db, const char* sql, cqlite_stmt** stmt);
+CqliteResult cqlite_bind_int(cqlite_stmt* stmt, int index, uint32_t value);
+CqliteResult cqlite_bind_text(cqlite_stmt* stmt, int index, const char* value);
+CqliteResult cqlite_step(cqlite_stmt* stmt);
+CqliteResult cqlite_reset(cqlite_stmt* stmt);
+CqliteResult cqlite_finalize(cqlite_stmt* stmt);
+
+int         cqlite_column_count(cqlite_stmt* stmt);
+const char* cqlite_column_name(cqlite_stmt* stmt, int column);
+uint32_t    cqlite_column_int(cqlite_stmt* stmt, int column);
+const char* cqlite_column_text(cqlite_stmt* stmt, int column);
+
+/* Runs a REPL dot-command such as ".btree"; ".exit" is left to the caller */
+CqliteResult cqlite_meta_command(cqlite* db, const char* command);
+
+/* Message the REPL prints for a failed prepare or step */
+const char* cqlite_errstr(CqliteResult result);
+
+#endif // CQLITE_H
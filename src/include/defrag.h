@@ -0,0 +1,45 @@
+#ifndef DEFRAG_H
+#define DEFRAG_H
+
+#include "table.h"
+
+/*
+ * Leaf re-clustering. New pages always go on the end of the file, so after
+ * random inserts the leaf chain hops back and forth across it and a full
+ * scan reads the file in random order. Defragmenting gives the leaves, in
+ * key order, the lowest of the page numbers the table tree already owns and
+ * moves its internal nodes above them, so with nothing else interleaved the
+ * leaves end up on consecutive pages and a cold scan reads straight through.
+ *
+ * Pages move by swapping two at a time: the parent, the previous leaf and
+ * any children of each are repointed, then the two cached frames trade
+ * places, so only those pages are dirtied. The root never moves. Hash index
+ * hints to a moved leaf go stale and are corrected by the next lookup.
+ *
+ * `.defrag` does a whole pass at once. `.defrag on` moves up to `pages`
+ * pages every `interval_ms` from a background thread instead, skipping any
+ * round where a select is parked between steps on a cursor into the tree,
+ * and any after one that found nothing to move until the tree splits again.
+ * A sharded handle only takes the one-off passes, which run on each shard;
+ * shards created by later splits would be left without a background thread.
+ */
+#define DEFRAG_DEFAULT_INTERVAL_MS 1000
+#define DEFRAG_DEFAULT_PAGES 64
+#define DEFRAG_ALL_PAGES UINT32_MAX
+#define DEFRAG_WAIT_MS 10000 /* longest `.defrag wait` blocks */
+
+typedef struct {
+    uint32_t moved;
+    uint32_t leaves;
+    uint32_t runs;   /* stretches of leaves on consecutive pages in key order; 1 once clustered */
+    bool     failed; /* no memory for the walk, which is sized by the tree; nothing moved */
+} DefragResult;
+
+/* Called inside a pager section; with `max_pages` 0 it only measures */
+DefragResult defrag(Table* table, uint32_t max_pages);
+void         defragger_start(Table* table, uint32_t interval_ms, uint32_t pages);
+void         defragger_stop(Table* table);
+/* Until a round after the latest split finds nothing to move, or the wait runs out */
+void defragger_wait(Table* table);
+
+#endif // DEFRAG_H
@@ -0,0 +1,36 @@
+#ifndef FRAME_SLAB_H
+#define FRAME_SLAB_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Page frames for the pager, carved out of 2 MiB page-aligned chunks instead
+ * of one malloc per page. A chunk is backed by a reserved huge page when the
+ * system has one, and is otherwise aligned and offered to transparent huge
+ * pages, so a large cache costs a few TLB entries rather than thousands.
+ * Frames handed back are kept on a free list for reuse; chunks are only
+ * returned to the system when the slab is destroyed.
+ */
+#define FRAME_SLAB_CHUNK_SIZE (2 * 1024 * 1024)
+
+typedef struct FrameSlabChunk {
+    struct FrameSlabChunk* next;
+    void*                  memory;
+} FrameSlabChunk;
+
+typedef struct {
+    FrameSlabChunk* chunks;
+    char*           next_frame;
+    char*           end;
+    uint32_t        frame_size;  /* the pager's page size */
+    void*           free_frames; /* linked through the first word of each frame */
+    uint32_t        huge_chunks; /* chunks that got MAP_HUGETLB */
+} FrameSlab;
+
+void  frame_slab_init(FrameSlab* slab, uint32_t frame_size);
+void* frame_slab_alloc(FrameSlab* slab);
+void  frame_slab_free(FrameSlab* slab, void* frame);
+void  frame_slab_destroy(FrameSlab* slab);
+
+#endif // FRAME_SLAB_H
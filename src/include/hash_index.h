@@ -0,0 +1,26 @@
+#ifndef HASH_INDEX_H
+#define HASH_INDEX_H
+
+#include "table.h"
+
+/*
+ * Optional extendible hash over row ids, stored in pages of the same file.
+ *
+ * A directory page maps the low `global_depth` bits of hash(id) to bucket
+ * pages; a full bucket splits on its next bit and the directory doubles when
+ * needed. Once the directory fills its page, full buckets chain overflow pages
+ * instead.
+ *
+ * Each entry remembers the leaf the row was last seen in. Leaf splits move
+ * rows without telling the hash, so that page is only a hint: lookups verify
+ * it and fall back to a tree descent, repairing the hint when it was stale.
+ * The table tree stays the source of truth.
+ */
+
+bool    hash_index_exists(Table* table);
+void    hash_index_create(Table* table);
+bool    hash_index_contains(Table* table, uint32_t id);
+void    hash_index_insert(Table* table, uint32_t id, uint32_t leaf_page_num);
+bool    hash_index_find(Table* table, uint32_t id, Cursor* cursor);
+
+#endif // HASH_INDEX_H
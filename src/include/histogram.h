@@ -0,0 +1,29 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+/*
+ * Log-bucketed latency histogram in the style of HdrHistogram. Every power of
+ * two is split into HISTOGRAM_SUB_BUCKETS linear buckets, so a recorded value
+ * is reported to within 1/16 of itself anywhere in the uint64_t range, and
+ * recording is a count increment in a fixed-size array.
+ */
+#define HISTOGRAM_SUB_BUCKET_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+typedef struct {
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+} Histogram;
+
+uint64_t monotonic_ns();
+
+void     histogram_record(Histogram* histogram, uint64_t value);
+uint64_t histogram_percentile(Histogram* histogram, double percentile);
+void     histogram_print_header();
+void     histogram_print(const char* name, Histogram* histogram);
+
+#endif // HISTOGRAM_H
@@ -0,0 +1,37 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include "table.h"
+
+/*
+ * Secondary indexes on username and email. Each one is a B+tree in the same
+ * file as the table, keyed by the leading bytes of the column with the row id
+ * as tiebreaker, so every entry is unique and points back at its row. Values
+ * longer than the prefix share entries with their neighbours and are checked
+ * against the row itself.
+ */
+#define INDEX_KEY_PREFIX_SIZE 16
+
+typedef struct {
+    char     prefix[INDEX_KEY_PREFIX_SIZE];
+    uint32_t id;
+} IndexKey;
+
+typedef struct {
+    Table*   table;
+    uint32_t page_num;
+    uint32_t cell_num;
+    bool     end_of_index;
+} IndexCursor;
+
+uint32_t* index_root_page(Table* table, Column column);
+bool      index_exists(Table* table, Column column);
+void      index_create(Table* table, Column column);
+void      index_insert_row(Table* table, Row* row);
+
+void      index_key_init(IndexKey* key, const char* value, uint32_t id);
+void      index_seek(Table* table, Column column, IndexKey* key, IndexCursor* cursor);
+IndexKey* index_cursor_key(IndexCursor* cursor);
+void      index_cursor_advance(IndexCursor* cursor);
+
+#endif // INDEX_H
@@ -0,0 +1,80 @@
+#ifndef MEMTABLE_H
+#define MEMTABLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * In-memory write buffer for inserts. Rows are appended serialized in arrival
+ * order and found by id through an open-addressed hash, so an insert costs no
+ * shifting at all. The (id, slot) order is sorted lazily, the first time a
+ * reader or a merge needs it after a write, and table_merge_memtable then
+ * feeds the rows into the tree in key order, a leaf at a time.
+ *
+ * A blocked Bloom filter over every id in the table lets an insert skip the
+ * duplicate-check descent unless the id may already be there. Each id sets
+ * MEMTABLE_FILTER_PROBES bits inside one 64-byte block, so a check costs one
+ * cache line. It is sized for twice the ids it was built from and rebuilt
+ * from the tree once it holds more than that.
+ *
+ * A buffer holds at most MEMTABLE_MAX_CAPACITY rows, some 5 GB of rows
+ * with their keys, order and hash buckets.
+ */
+#define MEMTABLE_DEFAULT_CAPACITY 16384
+#define MEMTABLE_MAX_CAPACITY (1u << 24)
+#define MEMTABLE_FILTER_BITS_PER_KEY 10
+#define MEMTABLE_FILTER_PROBES 6
+#define MEMTABLE_FILTER_MIN_KEYS 65536
+
+typedef struct {
+    uint32_t  capacity; /* rows buffered before a merge; 0 while buffering is off */
+    uint32_t  row_size;
+    uint32_t  num_rows;
+    char*     rows;  /* serialized rows by slot */
+    uint32_t* keys;  /* id by slot */
+    uint64_t* order; /* id << 32 | slot, by id once `sorted` */
+    uint64_t* sort_buffer;
+    bool      sorted;
+    uint32_t* buckets; /* slot + 1 per id, 0 when empty */
+    uint32_t  bucket_mask;
+
+    uint64_t* filter; /* NULL until the first buffered insert builds it */
+    uint32_t  filter_blocks;
+    uint64_t  filter_keys;
+    uint64_t  filter_limit;
+} Memtable;
+
+void memtable_init(Memtable* memtable, uint32_t row_size);
+void memtable_destroy(Memtable* memtable);
+
+/*
+ * Only while empty; a capacity of 0 turns buffering off. False, with the old
+ * buffer left as it was, past MEMTABLE_MAX_CAPACITY or when memory runs out.
+ */
+bool memtable_resize(Memtable* memtable, uint32_t capacity);
+
+/* Serialized row with this id, or NULL */
+void* memtable_find(Memtable* memtable, uint32_t key);
+
+/* Space for a new row's bytes; the caller checks for room and duplicates first */
+void* memtable_add(Memtable* memtable, uint32_t key);
+bool  memtable_full(Memtable* memtable);
+void  memtable_clear(Memtable* memtable);
+
+/*
+ * Sized for `num_keys` ids now and as many again before it needs rebuilding.
+ * False without memory for it: the old filter, if any, stays in use until
+ * that same limit.
+ */
+bool memtable_filter_reset(Memtable* memtable, uint64_t num_keys);
+bool memtable_filter_full(Memtable* memtable);
+void memtable_filter_add(Memtable* memtable, uint32_t key);
+bool memtable_filter_may_contain(Memtable* memtable, uint32_t key);
+
+/* Access in id order: sort first, then index from 0 to num_rows */
+void     memtable_sort(Memtable* memtable);
+uint32_t memtable_seek(Memtable* memtable, uint32_t key); /* first index with an id >= key */
+uint32_t memtable_key(Memtable* memtable, uint32_t index);
+void*    memtable_row(Memtable* memtable, uint32_t index);
+
+#endif // MEMTABLE_H
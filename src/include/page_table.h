@@ -0,0 +1,36 @@
+#ifndef PAGE_TABLE_H
+#define PAGE_TABLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Sparse two-level map from page number to cached frame. The high bits of
+ * the page number pick a leaf from a directory that grows on demand, the low
+ * bits an entry in that leaf, so an empty table costs nothing to open and
+ * memory follows the pages actually cached rather than the file size.
+ */
+#define PAGE_TABLE_LEAF_BITS 10
+#define PAGE_TABLE_LEAF_SIZE (1u << PAGE_TABLE_LEAF_BITS)
+
+typedef struct {
+    void* frame; /* NULL while the page is not cached */
+    bool  dirty;
+} PageTableEntry;
+
+typedef struct {
+    PageTableEntry entries[PAGE_TABLE_LEAF_SIZE];
+} PageTableLeaf;
+
+typedef struct {
+    PageTableLeaf** leaves;
+    uint32_t        num_leaves; /* slots in `leaves`, allocated or not */
+} PageTable;
+
+void            page_table_init(PageTable* table);
+PageTableEntry* page_table_lookup(PageTable* table, uint32_t page_num);
+PageTableEntry* page_table_entry(PageTable* table, uint32_t page_num);
+PageTableEntry* page_table_next(PageTable* table, uint32_t* page_num);
+void            page_table_destroy(PageTable* table);
+
+#endif // PAGE_TABLE_H
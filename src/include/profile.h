@@ -0,0 +1,74 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Per-statement counter profiling, `.profile on`. Counters are read when a
+ * step starts and ends and whenever it enters or leaves a phase, and each
+ * interval is charged to the phase it ran in, innermost first: a get_page
+ * miss inside a table_find counts as page I/O, not descent. Time spent by
+ * the caller between two steps of a select, printing the row it was handed,
+ * is output.
+ *
+ * The counters come from perf_event_open when the kernel allows it: cycles,
+ * instructions, L1D read misses, LLC misses and branch misses, user space
+ * only. Without a PMU or the permission for one they fall back to software
+ * events, CPU time, page faults, major faults and context switches, and when
+ * even those are refused to the same four from clock_gettime and getrusage.
+ *
+ * Counters follow the thread that turned profiling on, so statements must be
+ * stepped from it. Each phase boundary is a counter read, a system call for
+ * the perf sources, so profiling slows the statements it measures.
+ */
+#define PROFILE_MAX_COUNTERS 5
+#define PROFILE_MAX_DEPTH 8
+
+typedef enum {
+    PROFILE_OTHER, /* inside a step but in no phase below */
+    PROFILE_DESCENT,
+    PROFILE_PAGE_IO,
+    PROFILE_DESERIALIZE,
+    PROFILE_OUTPUT,
+    PROFILE_PHASES
+} ProfilePhase;
+
+typedef enum { PROFILE_HARDWARE, PROFILE_SOFTWARE, PROFILE_RUSAGE } ProfileSource;
+
+typedef struct Profile Profile;
+
+/* The profile of the step running on this thread, NULL outside one */
+extern _Thread_local Profile* profile_active;
+
+/* Opens the best source the kernel allows; never fails */
+Profile*      profile_open();
+void          profile_close(Profile* profile);
+ProfileSource profile_source(Profile* profile);
+void          profile_print(Profile* profile);
+void          profile_reset(Profile* profile);
+
+/* `resumed` when the step continues a select, so the time since the last one was output */
+void profile_step_begin(Profile* profile, bool resumed);
+void profile_step_end(Profile* profile, bool finished);
+/* A select dropped before its last row; the time since its last step was output */
+void profile_statement_abandon(Profile* profile);
+
+void profile_phase_enter(ProfilePhase phase);
+void profile_phase_exit();
+
+/* The hooks compiled into the engine; a thread-local load when profiling is off */
+static inline void profile_enter(ProfilePhase phase) {
+    if (profile_active != NULL) {
+        profile_phase_enter(phase);
+    }
+}
+
+static inline void profile_exit() {
+    if (profile_active != NULL) {
+        profile_phase_exit();
+    }
+}
+
+#endif // PROFILE_H
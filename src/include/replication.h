@@ -0,0 +1,93 @@
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include "statement.h"
+
+/*
+ * Read replicas by log shipping. A primary logs every insert and create index
+ * as a fixed-size record before it applies it, once nothing but the log can
+ * make it fail, so a statement whose record cannot be written changes
+ * nothing. Records are numbered by a log sequence number (LSN) from 1 with no
+ * gaps, and stamped with the wall clock time they were logged. Followers
+ * fetch the records after the last LSN they applied and replay them through
+ * execute_insert and execute_create_index on their own file, from a
+ * background thread that takes the pager lock per record. A follower only
+ * serves reads; statements that write are refused. A select reads rows in
+ * place across steps, so records wait while one is open and a select sees
+ * the follower as it was when it began.
+ *
+ * Records are logical rather than page images, so a follower may use its own
+ * page size, and replaying one it already has is harmless: the insert comes
+ * back as a duplicate key, the index as already existing. A follower can thus
+ * be seeded from a copy of the primary's file and then follow its log from
+ * the start. The last LSN applied is kept in the follower's header.
+ *
+ * How records travel is up to the transport:
+ *
+ *   dir:<path>   the primary appends to <path>/cqlite.rlog, followers read it;
+ *                any directory both sides can see, a shared mount included
+ *   unix:<path>  the primary keeps the log at <path>.rlog and streams it over a
+ *                Unix socket at <path> to each follower that connects, from
+ *                the LSN the follower asks for
+ *
+ * Records are written in host byte order, so both ends share an architecture.
+ * Like the database file the log is written but never synced: a record
+ * outlives the process that logged it, not necessarily the machine.
+ */
+#define REPLICATION_LOG_NAME "cqlite.rlog"
+#define REPLICATION_LOG_SUFFIX ".rlog"
+#define REPLICATION_POLL_MS 10   /* how long a fetch waits for a record that is not there yet */
+#define REPLICATION_WAIT_MS 10000 /* longest `.replication wait` blocks */
+#define REPLICATION_MAX_FOLLOWERS 16
+
+typedef enum { REPLICATION_INSERT = 1, REPLICATION_CREATE_INDEX = 2 } ReplicationRecordType;
+
+typedef struct {
+    uint64_t lsn;
+    uint64_t commit_ns; /* CLOCK_REALTIME on the primary when it was logged */
+    uint32_t type;      /* ReplicationRecordType */
+    uint32_t index_column;
+    uint32_t index_type;
+    uint32_t checksum; /* FNV-1a of the record with this field zero; catches torn reads */
+    Row      row;
+} ReplicationRecord;
+
+/*
+ * A transport is opened for one side. Each implementation embeds this as its
+ * first member; the follower side is only ever used from the applier thread.
+ */
+typedef struct ReplicationTransport ReplicationTransport;
+struct ReplicationTransport {
+    /* Primary: appends a record to the log for followers; false, log unchanged, on failure */
+    bool (*publish)(ReplicationTransport* transport, const ReplicationRecord* record);
+    /* Follower: the record after `lsn`, waiting up to REPLICATION_POLL_MS; false if none yet */
+    bool (*fetch)(ReplicationTransport* transport, uint64_t lsn, ReplicationRecord* record);
+    /* The primary's last LSN as far as this side knows; false until it knows */
+    bool (*last_lsn)(ReplicationTransport* transport, uint64_t* lsn);
+    void (*close)(ReplicationTransport* transport);
+};
+
+/* "dir:<path>" or "unix:<path>"; NULL when the spec is malformed or cannot be opened */
+ReplicationTransport* replication_transport_open(const char* spec, bool primary);
+uint32_t              replication_checksum(const ReplicationRecord* record);
+
+/* Both return false, changing nothing, if the transport cannot be opened */
+bool replication_start_primary(Table* table, const char* spec);
+bool replication_start_follower(Table* table, const char* spec);
+void replication_stop(Table* table);
+
+bool replication_is_follower(Table* table);
+bool replication_is_primary(Table* table);
+
+/*
+ * Called inside the statement's pager section before it changes anything;
+ * only a primary logs. False if the record could not be written, in which
+ * case the statement must not be applied.
+ */
+bool replication_log(Table* table, Statement* statement);
+
+void replication_print_status(Table* table);
+/* Until the follower has applied `lsn`, or the primary's last LSN if 0, or the wait runs out */
+void replication_wait(Table* table, uint64_t lsn);
+
+#endif // REPLICATION_H
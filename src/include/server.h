@@ -0,0 +1,32 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "cqlite.h"
+
+/*
+ * Wire protocol
+ *
+ * Every message in either direction is a frame: a 4-byte length in network
+ * byte order followed by that many payload bytes.
+ *
+ *   request payload:  statement text, e.g. "insert 1 alice a@x.com" (no newline)
+ *   response payload: 1 status byte (ResponseStatus) followed by the text the
+ *                     REPL would have printed for that statement
+ *
+ * A client may write any number of request frames before reading; responses
+ * come back in the same order, one per request, so statements can be
+ * pipelined many to a round trip.
+ */
+#define SERVER_FRAME_HEADER_SIZE 4
+#define SERVER_MAX_FRAME_SIZE (1 << 20)
+
+typedef enum { RESPONSE_OK, RESPONSE_ERROR } ResponseStatus;
+
+/*
+ * Listen on a Unix socket at socket_path and serve every client from one epoll
+ * loop against the shared database. Returns when SIGINT or SIGTERM is received;
+ * the caller still owns the handle and must cqlite_close() it.
+ */
+int run_server(cqlite* db, const char* socket_path);
+
+#endif // SERVER_H
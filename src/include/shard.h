@@ -0,0 +1,75 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include "statement.h"
+
+/*
+ * Key-range sharding across files. A sharded database is a manifest naming
+ * its shards, each a complete database file, `<manifest>-<n>`, with its own
+ * pager, lock and tree. Shard i holds the ids from its lower bound up to the
+ * next shard's, so an insert goes to exactly one shard and only takes that
+ * shard's lock.
+ *
+ * A select runs on every shard its id predicate can touch. With more than one,
+ * each shard is scanned by its own thread, which copies matching rows out in
+ * batches of SHARD_BATCH_ROWS and queues up to SHARD_QUEUE_BATCHES of them
+ * ahead of the reader. The reader takes rows in key order, which for ranges
+ * is shard after shard, and for order by a merge of the shards' sorted rows.
+ *
+ * Once a shard's file grows past `max_pages` it is split at its median id:
+ * both halves are copied into new files, the manifest is replaced by rename,
+ * and only then is the old file removed. Splits wait while a select is open.
+ *
+ * The manifest holds "CQLSHRD\0", then uint32 version, page size, max pages,
+ * shard count and next file number, then each shard's lower bound and file
+ * number, in id order.
+ */
+#define SHARD_MAGIC "CQLSHRD"
+#define SHARD_VERSION 1
+#define SHARD_MAX_SHARDS 64
+#define SHARD_DEFAULT_MAX_PAGES 65536
+#define SHARD_BATCH_ROWS 256
+#define SHARD_QUEUE_BATCHES 16
+
+typedef struct {
+    uint32_t lower_bound;
+    uint32_t file_number;
+    Table*   table;
+} Shard;
+
+typedef struct {
+    char*    path; /* the manifest */
+    uint32_t page_size;
+    uint32_t max_pages;
+    uint32_t num_shards;
+    uint32_t next_file_number;
+    uint32_t open_scans;
+    Shard    shards[SHARD_MAX_SHARDS];
+} ShardSet;
+
+/* Whether `filename` is an existing manifest rather than a plain database */
+bool shard_set_is_manifest(const char* filename);
+
+/* Opens the manifest, or creates it with `num_shards` evenly spaced ranges; NULL on failure */
+ShardSet* shard_set_open(const char* filename, uint32_t num_shards, uint32_t page_size);
+void      shard_set_close(ShardSet* set);
+
+/* Each takes the pager lock of every shard it touches itself */
+ExecuteResult     shard_set_insert(ShardSet* set, Statement* statement);
+ExecuteResult     shard_set_create_index(ShardSet* set, Statement* statement);
+MetaCommandResult shard_set_meta_command(ShardSet* set, const char* command);
+
+typedef struct ShardScan ShardScan;
+
+/* NULL if there is not enough memory for the scan's batches */
+ShardScan* shard_scan_open(ShardSet* set, Statement* statement);
+/*
+ * Next row in order, or NULL once done or once shard_scan_failed says a
+ * shard's sort ran out of memory; the serialized row stays valid until the
+ * next call.
+ */
+void* shard_scan_next(ShardScan* scan);
+bool  shard_scan_failed(ShardScan* scan);
+void  shard_scan_close(ShardScan* scan);
+
+#endif // SHARD_H
@@ -0,0 +1,85 @@
+#ifndef SORTER_H
+#define SORTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Orders (key, row id) tuples for ORDER BY on a text column.
+ *
+ * Tuples are packed back to back in an arena and sorted through an array of
+ * pointers. The arena grows a chunk at a time, each as big as all before it,
+ * up to `budget` bytes, so a small sort never reserves a large budget. When
+ * the arena is full, the batch is sorted and written to a temp file as a run,
+ * and the runs are k-way merged at the end, SORTER_MAX_FAN_IN at a time. With
+ * a limit whose K tuples fit the budget the sorter keeps only a bounded heap
+ * of the best K instead. Equal keys come out in id order either way.
+ *
+ * Running out of memory is not fatal: sorter_create returns NULL, and
+ * sorter_add and sorter_finish return false and leave the sorter `failed`.
+ */
+#define SORTER_DEFAULT_BUDGET (8 * 1024 * 1024)
+#define SORTER_MIN_BUDGET (4 * 1024)
+#define SORTER_MAX_BUDGET ((size_t) 16 * 1024 * 1024 * 1024)
+#define SORTER_MAX_FAN_IN 64
+#define SORTER_CHUNK_SIZE (64 * 1024) /* the arena's first chunk */
+#define SORTER_NO_LIMIT UINT32_MAX
+
+typedef struct {
+    uint32_t id;
+    uint16_t length;
+    char     key[];
+} SortEntry;
+
+/* Arena chunks stay put once allocated, so entries can point into them */
+typedef struct SortChunk SortChunk;
+struct SortChunk {
+    SortChunk* next;
+    size_t     size;
+    _Alignas(SortEntry) char data[];
+};
+
+/* One spilled run being read back, with its current tuple */
+typedef struct {
+    FILE*      file;
+    SortEntry* head;
+} SortRun;
+
+typedef struct {
+    uint32_t key_size; /* column size; keys end at the first NUL within it */
+    bool     descending;
+    uint32_t limit;
+    size_t   budget;
+    bool     top_k;
+
+    SortChunk*  chunks;
+    SortChunk*  chunk;      /* the one being filled; chunks after it are free */
+    size_t      chunk_used;
+    size_t      arena_size; /* every chunk together; without top-K never more than `budget` */
+    SortEntry*  scratch;    /* top-K candidate, swapped into the heap when it wins */
+    SortEntry** entries;
+    uint32_t    num_entries;
+    uint32_t    entries_capacity;
+
+    FILE**   runs; /* spilled and not yet merged */
+    uint32_t num_runs;
+    uint32_t total_runs;
+
+    /* Output: either `entries` in order, or a heap over the heads of `merge` */
+    bool     finished;
+    uint32_t next_entry;
+    SortRun* merge;
+    uint32_t merge_size;
+    uint32_t emitted;
+    bool     failed;
+} Sorter;
+
+Sorter* sorter_create(uint32_t key_size, bool descending, uint32_t limit, size_t budget);
+bool    sorter_add(Sorter* sorter, const char* key, uint32_t id);
+bool    sorter_finish(Sorter* sorter);
+bool    sorter_next(Sorter* sorter, uint32_t* id);
+void    sorter_destroy(Sorter* sorter);
+
+#endif // SORTER_H
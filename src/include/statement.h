@@ -2,7 +2,9 @@
 #define STATEMENT_H
 
 #include "table.h"
-#include "input.h"
+#include "index.h"
+#include "hash_index.h"
+#include "sorter.h"
 
 typedef enum { META_COMMAND_SUCCESS, META_COMMAND_UNRECOGNIZED_COMMAND } MetaCommandResult;
 
@@ -14,17 +16,106 @@ typedef enum {
     PREPARE_SYNTAX_ERROR
 } PrepareResult;
 
-typedef enum { STATEMENT_INSERT, STATEMENT_SELECT } StatementType;
+typedef enum { STATEMENT_INSERT, STATEMENT_SELECT, STATEMENT_CREATE_INDEX } StatementType;
 
-typedef enum { EXECUTE_TABLE_FULL, EXECUTE_DUPLICATE_KEY, EXECUTE_SUCCESS } ExecuteResult;
+typedef enum {
+    EXECUTE_TABLE_FULL,
+    EXECUTE_DUPLICATE_KEY,
+    EXECUTE_INDEX_EXISTS,
+    EXECUTE_LOG_FAILED,
+    EXECUTE_SUCCESS
+} ExecuteResult;
+
+typedef enum { INDEX_BTREE, INDEX_HASH } IndexType;
+
+/* Where the value bound to a `?` placeholder ends up */
+typedef enum {
+    PARAM_INSERT_ID,
+    PARAM_INSERT_USERNAME,
+    PARAM_INSERT_EMAIL,
+    PARAM_WHERE_VALUE,
+    PARAM_SELECT_LIMIT
+} ParamTarget;
+
+#define STATEMENT_MAX_PARAMS 3
+
+typedef enum {
+    COMPARE_EQUAL,
+    COMPARE_LESS,
+    COMPARE_LESS_EQUAL,
+    COMPARE_GREATER,
+    COMPARE_GREATER_EQUAL,
+    COMPARE_PREFIX,
+    COMPARE_CONTAINS
+} CompareOp;
+
+/* A single `where <column> <op> <value>` predicate */
+typedef struct {
+    bool      present;
+    Column    column;
+    CompareOp op;
+    bool      like; /* op comes from the % in each value set for `like` */
+    uint32_t  id;
+    char      text[COLUMN_EMAIL_SIZE + 1];
+    uint32_t  text_length;
+} WhereClause;
+
+/* `order by <column> [asc|desc]` on username or email */
+typedef struct {
+    bool   present;
+    Column column;
+    bool   descending;
+} OrderBy;
 
 typedef struct {
     StatementType type;
     Row           row_to_insert;
+    WhereClause   where;
+    OrderBy       order_by;
+    uint32_t      limit; /* SORTER_NO_LIMIT without a limit clause */
+    Column        index_column;
+    IndexType     index_type;
+    uint32_t      num_params;
+    ParamTarget   params[STATEMENT_MAX_PARAMS];
 } Statement;
 
-MetaCommandResult execute_meta_command(InputBuffer* input_buffer, Table* table);
-PrepareResult     prepare_statement(InputBuffer* input_buffer, Statement* statement);
-ExecuteResult     execute_statement(Statement* statement, Table* table);
+/*
+ * How a select reaches its rows: every leaf in order, a key range of the
+ * table tree, or the entries of a secondary index. Full and id range scans
+ * merge in rows still buffered in the memtable by id; an index only exists
+ * while the memtable is empty. With order by, the plan's rows feed a sorter
+ * up front and come back out of the table by id.
+ */
+typedef enum { SCAN_FULL, SCAN_ID_RANGE, SCAN_INDEX } ScanPlan;
+
+typedef struct {
+    Table*      table;
+    Statement*  statement;
+    ScanPlan    plan;
+    Cursor      cursor;
+    IndexCursor index_cursor;
+    IndexKey    index_key;
+    Sorter*     sorter;
+    uint32_t    memtable_next; /* next buffered row, in id order */
+    void*       tree_row;      /* the tree's next row, held back while smaller buffered ids go */
+    bool        tree_done;
+    void*       row; /* serialized row inside the cached page or memtable, NULL once done */
+    uint32_t    returned;
+    bool        started;
+    bool        done;
+    bool        counted; /* in table->open_scans until scan_close */
+    bool        failed;  /* the sort ran out of memory, so scan_next gave up early */
+} Scan;
+
+MetaCommandResult execute_meta_command(const char* command, Table* table);
+PrepareResult     prepare_statement(char* sql, Statement* statement);
+PrepareResult     where_set_text(WhereClause* where, const char* value);
+ExecuteResult     execute_insert(Statement* statement, Table* table);
+ExecuteResult     execute_create_index(Statement* statement, Table* table);
+bool              parse_count(const char* text, unsigned long max, unsigned long* value);
+
+void scan_open(Scan* scan, Statement* statement, Table* table);
+bool scan_next(Scan* scan);
+void scan_close(Scan* scan);
 
 #endif // STATEMENT_H
@@ -0,0 +1,27 @@
+#ifndef STRING_MATCH_H
+#define STRING_MATCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Byte-compare kernels for string predicates, run straight on the fixed-size
+ * column bytes of a serialized row. On x86-64 they compare 32 bytes per step
+ * with AVX2 when the CPU has it and 16 with SSE2 otherwise; elsewhere they
+ * fall back to memcmp.
+ *
+ * Both operands must have at least STRING_MATCH_MIN_SPAN readable bytes: a
+ * short compare loads a whole vector and masks off the bytes past its length.
+ * Every column and the where clause's text buffer are at least that long.
+ */
+#define STRING_MATCH_MIN_SPAN 32
+
+/* `field_size` is the column's size including its NUL, so no compare reads past it */
+bool string_match_equal(const char* field, uint32_t field_size, const char* text,
+                        uint32_t length);
+bool string_match_prefix(const char* field, uint32_t field_size, const char* prefix,
+                         uint32_t length);
+bool string_match_contains(const char* field, uint32_t field_size, const char* needle,
+                           uint32_t length);
+
+#endif // STRING_MATCH_H
@@ -4,9 +4,22 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include "frame_slab.h"
+#include "histogram.h"
+#include "memtable.h"
+#include "page_table.h"
 #define COLUMN_USERNAME_SIZE 32
 #define COLUMN_EMAIL_SIZE 255
-#define TABLE_MAX_PAGES 50000
+#define TABLE_MAX_PAGES (UINT32_MAX - 1) /* UINT32_MAX is kept as the invalid page number */
+
+/* Chosen when a file is created and recorded in its header; a power of two in this range */
+#define DEFAULT_PAGE_SIZE 4096
+#define MIN_PAGE_SIZE 4096
+#define MAX_PAGE_SIZE 65536
+
+/* Opening this name gives a database with no file behind it, gone on close */
+#define DB_IN_MEMORY ":memory:"
 
 typedef struct {
     uint32_t id;
@@ -14,16 +27,127 @@ typedef struct {
     char     email[COLUMN_EMAIL_SIZE + 1];
 } Row;
 
+typedef enum { COLUMN_ID, COLUMN_USERNAME, COLUMN_EMAIL } Column;
+
+/*
+ * Page 0 of every database file. It records the page size and format the file
+ * was written with, and where each tree starts so the table and its secondary
+ * indexes can share one file. Files from before the page size was recorded
+ * have zeros there and are read as 4 KiB, version 0.
+ */
+#define DB_HEADER_MAGIC "CQLite1"
+#define DB_HEADER_MAGIC_SIZE 8
+#define DB_FORMAT_VERSION 1
+
+typedef struct {
+    char     magic[DB_HEADER_MAGIC_SIZE];
+    uint32_t root_page_num;
+    uint32_t username_index_root; /* 0 when there is no index */
+    uint32_t email_index_root;
+    uint32_t hash_index_directory; /* 0 when there is no hash index on id */
+    uint32_t page_size;
+    uint32_t format_version;
+    uint32_t free_list_head; /* first free page, 0 when none; nothing frees pages yet */
+    uint64_t applied_lsn;    /* last record replayed from a primary; see replication.h */
+} DatabaseHeader;
+
+#define DB_HEADER_PAGE_NUM 0
+
+/* Always-on counters, cheap enough to bump on every call; reset with `.stats reset` */
+typedef struct {
+    uint64_t page_hits;
+    uint64_t page_misses;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t flushes;
+    uint64_t pages_warmed; /* installed by the warmup thread; see warmup.h */
+} PagerStats;
+
 typedef struct {
-    int      file_descriptor;
-    uint32_t file_length;
-    void*    pages[TABLE_MAX_PAGES];
-    uint32_t num_pages;
+    uint64_t descents; /* root-to-leaf searches of the table tree */
+    uint64_t leaf_splits;
+    uint64_t internal_splits;
+    uint64_t root_splits;
+    uint64_t cells_shifted; /* cells moved right to make room in leaf_node_insert */
+    uint64_t sort_runs;     /* sorted runs order by spilled to temp files */
+    uint64_t memtable_merges;
+} TableStats;
+
+/* Time spent waiting on the file in get_page misses and pager_flush, in ns */
+typedef struct {
+    Histogram read;
+    Histogram flush;
+} PagerLatency;
+
+/* Prepare plus every step of one execution, in ns; a lookup is `where id = N` */
+typedef struct {
+    Histogram insert;
+    Histogram select;
+    Histogram lookup;
+} StatementLatency;
+
+/* Node capacities for one page size, worked out when the pager opens the file */
+typedef struct {
+    uint32_t page_size;
+    uint32_t leaf_node_max_cells;
+    uint32_t leaf_node_left_split_count;
+    uint32_t leaf_node_right_split_count;
+    uint32_t internal_node_max_keys;
+} PageLayout;
+
+typedef struct Checkpointer Checkpointer;
+typedef struct Warmup       Warmup;
+typedef struct Replication  Replication;
+typedef struct Profile      Profile;
+typedef struct Defragger    Defragger;
+
+/*
+ * Code that changes a page fetches it with get_page_for_write, which marks it
+ * dirty; get_page only reads, and only dirty pages are flushed. Statements run
+ * between pager_begin and pager_end, which hold `lock` so the checkpointer
+ * never copies a page halfway through a change; get_page_for_write refuses to
+ * run in a read-only section. An in-memory pager has no file: its frames are
+ * the only copy, so nothing is ever dirty or flushed.
+ *
+ * Nothing is ever evicted. Every page fetched stays cached until db_close, so
+ * the pool grows without bound up to the size of the file; flushing a page
+ * only makes it clean, it does not give its frame back. Dropping clean frames
+ * would first need: file_length kept up to date as pages are written, since
+ * get_page only reads below it; the checkpointer to stop marking pages clean
+ * before its copies reach the file; warmup to stop installing pages read
+ * outside the lock; and a count of open scans the pager can see, because
+ * scans keep row pointers into frames between steps.
+ */
+typedef struct {
+    int             file_descriptor; /* -1 when in_memory */
+    bool            in_memory;
+    uint64_t        file_length;
+    PageLayout      layout;
+    PageTable       pages;
+    FrameSlab       frames;
+    uint32_t        num_pages;
+    uint32_t        num_dirty;
+    bool            read_only;
+    pthread_mutex_t lock;
+    pthread_mutex_t checkpoint_lock;
+    Checkpointer*   checkpointer; /* NULL unless the background flusher runs */
+    Warmup*         warmup;       /* NULL unless opened through cqlite_open with a file */
+    PagerStats      stats;
+    PagerLatency    latency;
 } Pager;
 
 typedef struct {
-    Pager*   pager;
-    uint32_t root_page_num;
+    Pager*           pager;
+    uint32_t         root_page_num;
+    TableStats       stats;
+    StatementLatency latency;
+    size_t           sort_budget; /* bytes an order by sorts in memory before spilling runs */
+    Memtable         memtable;    /* buffered inserts not yet in the tree; see memtable.h */
+    Replication*     replication; /* NULL unless shipping a log or following one */
+    Profile*         profile;     /* NULL unless `.profile on`; see profile.h */
+    Defragger*       defragger;   /* NULL unless `.defrag on`; see defrag.h */
+    uint32_t         open_scans;  /* scans between scan_open and scan_close; pages stay put */
+    uint64_t         splits;      /* every split since db_open; unlike stats, never reset */
 } Table;
 
 typedef struct {
@@ -40,47 +164,78 @@ typedef struct {
     uint32_t max_depth;
 } BTreeStats;
 
-Cursor* table_start(Table* table);
-Cursor* table_find(Table* table, uint32_t key);
-
-Table* db_open(const char* filename);
-Pager* pager_open(const char* filename);
+/* Cursors are plain values: callers keep them on the stack or inside their own state */
+void table_start(Table* table, Cursor* cursor);
+void table_find(Table* table, uint32_t key, Cursor* cursor);
+
+/* `page_size` only applies when the file is created; an existing file keeps its own */
+Table*          db_open(const char* filename, uint32_t page_size);
+DatabaseHeader* db_header(Table* table);
+DatabaseHeader* db_header_for_write(Table* table);
+void            table_merge_memtable(Table* table);
+bool            table_buffer_ready(Table* table); /* false without memory for an id filter */
+bool            table_buffer_row(Table* table, Row* row);
+bool            page_size_valid(uint32_t page_size);
 void   db_close(Table* table);
 void   serialize_row(Row* source, void* destination);
 void   deserialize_row(void* source, Row* destination);
 void*  cursor_value(Cursor* cursor);
 void   cursor_advance(Cursor* cursor);
-void   print_row(Row* row);
 
 extern const uint32_t TABLE_MAX_ROWS;
-extern const uint32_t LEAF_NODE_MAX_CELLS;
+extern const uint32_t ROW_SIZE;
+extern const uint32_t ID_OFFSET;
+extern const uint32_t USERNAME_OFFSET;
+extern const uint32_t EMAIL_OFFSET;
 void*                 get_page(Pager* pager, uint32_t page_num);
+void*                 get_page_for_write(Pager* pager, uint32_t page_num);
 
-Pager* pager_open(const char* filename);
+Pager* pager_open(const char* filename, uint32_t page_size);
 
 void pager_flush(Pager* pager, uint32_t page_num);
+void pager_mark_dirty(Pager* pager, uint32_t page_num);
+bool pager_install(Pager* pager, uint32_t page_num, const void* data);
+void pager_begin(Pager* pager, bool read_only);
+void pager_end(Pager* pager);
 
 typedef enum { NODE_INTERNAL, NODE_LEAF } NodeType;
 
 uint32_t* leaf_node_num_cells(void* node);
 void*     leaf_node_cell(void* node, uint32_t cell_num);
 uint32_t* leaf_node_key(void* node, uint32_t cell_num);
-Cursor*   leaf_node_find(Table* table, uint32_t page_num, uint32_t key);
+void      leaf_node_find(Table* table, uint32_t page_num, uint32_t key, Cursor* cursor);
 
 void* leaf_node_value(void* node, uint32_t cell_num);
 void  initialize_leaf_node(void* node);
 void  leaf_node_insert(Cursor* cursor, uint32_t key, Row* value);
 
-void print_constants();
+void print_constants(Pager* pager);
 void print_tree(Pager* pager, uint32_t page_num, uint32_t indentation_level);
 
 void     set_node_type(void* node, NodeType type);
 NodeType get_node_type(void* node);
 
 extern const uint32_t NODE_TYPE_OFFSET;
+extern const uint32_t LEAF_NODE_HEADER_SIZE;
+extern const uint32_t INTERNAL_NODE_HEADER_SIZE;
+
+uint32_t* leaf_node_next_leaf(void* node);
+uint32_t* internal_node_num_keys(void* node);
+uint32_t* internal_node_child(void* node, uint32_t child_num);
+uint32_t* node_parent(void* node);
+uint32_t* internal_node_right_child(void* node);
+uint32_t  internal_node_find_child(void* node, uint32_t key);
+void      initialize_internal_node(void* node);
+void      set_node_root(void* node, bool is_root);
+bool      is_node_root(void* node);
+uint32_t  get_unused_page_num(Pager* pager);
 
 void internal_node_split_and_insert(Table* table, uint32_t parent_page_num,
                                     uint32_t child_page_num);
 
 void print_btree_stats(Pager* pager, uint32_t root_page_num);
+void print_stats(Table* table, bool json);
+void reset_stats(Table* table);
+void print_latency(Table* table);
+void reset_latency(Table* table);
 #endif // TABLE_H
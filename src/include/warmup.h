@@ -0,0 +1,28 @@
+#ifndef WARMUP_H
+#define WARMUP_H
+
+#include "table.h"
+
+/*
+ * Buffer pool warmup across restarts. Closing a database records which pages
+ * were cached in a sidecar next to the file, `<file>-warm`, and the next open
+ * reads those pages back from a background thread so the cache is warm before
+ * the first statements miss on it. Pages go in file order, each run of
+ * adjacent pages in one read, and are read without the pager lock. They are
+ * installed under it, skipping any a statement loaded in the meantime.
+ *
+ * The sidecar is only a hint: it holds "CQLWARM\0", the uint32 page size, a
+ * uint32 count and that many ascending uint32 page numbers. One that does not
+ * match the file is ignored.
+ */
+#define WARMUP_SUFFIX "-warm"
+#define WARMUP_MAGIC "CQLWARM"
+#define WARMUP_BATCH_PAGES 64
+
+/* Starts preloading from the sidecar, if there is one, and records it again on warmup_finish */
+void     warmup_start(Pager* pager, const char* filename);
+uint32_t warmup_wait(Pager* pager); /* blocks until the preload is done; pages it installed */
+void     warmup_stop(Pager* pager);   /* abandons a preload still running */
+void     warmup_finish(Pager* pager); /* stops it and records what is cached for the next open */
+
+#endif // WARMUP_H
@@ -0,0 +1,328 @@
+#include "index.h"
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Index trees reuse the table's node headers; only the cells differ.
+ *
+ *   leaf cell:      IndexKey (prefix, id)
+ *   internal cell:  child page | IndexKey   (key = max key under that child)
+ *
+ * Unlike the table tree they keep no parent pointers. Inserts recurse from the
+ * root and hand any split back up the call stack, and the root never changes
+ * page so the header only has to record it once.
+ */
+#define INDEX_LEAF_CELL_SIZE sizeof(IndexKey)
+#define INDEX_INTERNAL_CELL_SIZE (sizeof(uint32_t) + sizeof(IndexKey))
+
+static uint32_t index_leaf_max_cells(Pager* pager) {
+    return (pager->layout.page_size - LEAF_NODE_HEADER_SIZE) / INDEX_LEAF_CELL_SIZE;
+}
+
+static uint32_t index_internal_max_keys(Pager* pager) {
+    return (pager->layout.page_size - INTERNAL_NODE_HEADER_SIZE) / INDEX_INTERNAL_CELL_SIZE;
+}
+
+static IndexKey* index_leaf_key(void* node, uint32_t cell_num) {
+    return node + LEAF_NODE_HEADER_SIZE + cell_num * INDEX_LEAF_CELL_SIZE;
+}
+
+static uint32_t* index_internal_cell(void* node, uint32_t cell_num) {
+    return node + INTERNAL_NODE_HEADER_SIZE + cell_num * INDEX_INTERNAL_CELL_SIZE;
+}
+
+static IndexKey* index_internal_key(void* node, uint32_t key_num) {
+    return (void*) index_internal_cell(node, key_num) + sizeof(uint32_t);
+}
+
+static uint32_t* index_internal_child(void* node, uint32_t child_num) {
+    if (child_num == *internal_node_num_keys(node)) {
+        return internal_node_right_child(node);
+    }
+    return index_internal_cell(node, child_num);
+}
+
+static int index_key_compare(const IndexKey* a, const IndexKey* b) {
+    int result = memcmp(a->prefix, b->prefix, INDEX_KEY_PREFIX_SIZE);
+    if (result != 0) {
+        return result;
+    }
+    if (a->id == b->id) {
+        return 0;
+    }
+    return a->id < b->id ? -1 : 1;
+}
+
+void index_key_init(IndexKey* key, const char* value, uint32_t id) {
+    /* The prefix is not NUL terminated when the value fills it */
+    size_t length = strlen(value);
+    memset(key->prefix, 0, INDEX_KEY_PREFIX_SIZE);
+    memcpy(key->prefix, value, length < INDEX_KEY_PREFIX_SIZE ? length : INDEX_KEY_PREFIX_SIZE);
+    key->id = id;
+}
+
+/* Index of the first cell >= key, or num_cells if there is none */
+static uint32_t index_leaf_find(void* node, IndexKey* key) {
+    uint32_t min_index          = 0;
+    uint32_t one_past_max_index = *leaf_node_num_cells(node);
+
+    while (min_index != one_past_max_index) {
+        uint32_t index = (min_index + one_past_max_index) / 2;
+        if (index_key_compare(index_leaf_key(node, index), key) >= 0) {
+            one_past_max_index = index;
+        } else {
+            min_index = index + 1;
+        }
+    }
+    return min_index;
+}
+
+/* Same contract as internal_node_find_child: first child whose max key >= key */
+static uint32_t index_internal_find_child(void* node, IndexKey* key) {
+    uint32_t min_index = 0;
+    uint32_t max_index = *internal_node_num_keys(node);
+
+    while (min_index != max_index) {
+        uint32_t index = (min_index + max_index) / 2;
+        if (index_key_compare(index_internal_key(node, index), key) >= 0) {
+            max_index = index;
+        } else {
+            min_index = index + 1;
+        }
+    }
+    return min_index;
+}
+
+static void index_leaf_place(void* node, uint32_t cell_num, IndexKey* key) {
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    memmove(index_leaf_key(node, cell_num + 1), index_leaf_key(node, cell_num),
+            (num_cells - cell_num) * INDEX_LEAF_CELL_SIZE);
+    *index_leaf_key(node, cell_num) = *key;
+    *leaf_node_num_cells(node)      = num_cells + 1;
+}
+
+/*
+ * Child `child_num` has split: it keeps its page with max key `split_key` and
+ * its upper half moved to `new_child_page_num`, which takes over its old slot.
+ */
+static void index_internal_place(void* node, uint32_t child_num, IndexKey* split_key,
+                                 uint32_t new_child_page_num) {
+    uint32_t num_keys   = *internal_node_num_keys(node);
+    uint32_t child_page = *index_internal_child(node, child_num);
+
+    memmove(index_internal_cell(node, child_num + 1), index_internal_cell(node, child_num),
+            (num_keys - child_num) * INDEX_INTERNAL_CELL_SIZE);
+    *index_internal_cell(node, child_num)      = child_page;
+    *index_internal_key(node, child_num)       = *split_key;
+    *internal_node_num_keys(node)              = num_keys + 1;
+    *index_internal_child(node, child_num + 1) = new_child_page_num;
+}
+
+/*
+ * Inserts key under page_num. Returns true if the node split, in which case
+ * page_num keeps the lower half, *split_page_num holds the upper half and
+ * *split_key is page_num's new max key for the parent to use as separator.
+ */
+static bool index_node_insert(Pager* pager, uint32_t page_num, IndexKey* key, IndexKey* split_key,
+                              uint32_t* split_page_num) {
+    void* node = get_page(pager, page_num);
+
+    if (get_node_type(node) == NODE_LEAF) {
+        pager_mark_dirty(pager, page_num);
+        uint32_t cell_num = index_leaf_find(node, key);
+        if (*leaf_node_num_cells(node) < index_leaf_max_cells(pager)) {
+            index_leaf_place(node, cell_num, key);
+            return false;
+        }
+
+        /* Build the overfull node in scratch space, then deal it out to two pages */
+        void* scratch = malloc(pager->layout.page_size + INDEX_LEAF_CELL_SIZE);
+        memcpy(scratch, node, pager->layout.page_size);
+        index_leaf_place(scratch, cell_num, key);
+
+        uint32_t total      = *leaf_node_num_cells(scratch);
+        uint32_t left_count = (total + 1) / 2;
+        uint32_t new_page   = get_unused_page_num(pager);
+        void*    new_node   = get_page_for_write(pager, new_page);
+        initialize_leaf_node(new_node);
+
+        memcpy(index_leaf_key(node, 0), index_leaf_key(scratch, 0),
+               left_count * INDEX_LEAF_CELL_SIZE);
+        memcpy(index_leaf_key(new_node, 0), index_leaf_key(scratch, left_count),
+               (total - left_count) * INDEX_LEAF_CELL_SIZE);
+        *leaf_node_num_cells(node)     = left_count;
+        *leaf_node_num_cells(new_node) = total - left_count;
+        *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(node);
+        *leaf_node_next_leaf(node)     = new_page;
+
+        *split_key      = *index_leaf_key(node, left_count - 1);
+        *split_page_num = new_page;
+        free(scratch);
+        return true;
+    }
+
+    uint32_t child_num  = index_internal_find_child(node, key);
+    uint32_t child_page = *index_internal_child(node, child_num);
+    IndexKey child_split_key;
+    uint32_t child_split_page;
+    if (!index_node_insert(pager, child_page, key, &child_split_key, &child_split_page)) {
+        return false;
+    }
+    pager_mark_dirty(pager, page_num);
+
+    if (*internal_node_num_keys(node) < index_internal_max_keys(pager)) {
+        index_internal_place(node, child_num, &child_split_key, child_split_page);
+        return false;
+    }
+
+    void* scratch = malloc(pager->layout.page_size + INDEX_INTERNAL_CELL_SIZE);
+    memcpy(scratch, node, pager->layout.page_size);
+    index_internal_place(scratch, child_num, &child_split_key, child_split_page);
+
+    /* The middle key moves up; its child becomes the left node's right child */
+    uint32_t total      = *internal_node_num_keys(scratch);
+    uint32_t left_count = total / 2;
+    uint32_t new_page   = get_unused_page_num(pager);
+    void*    new_node   = get_page_for_write(pager, new_page);
+    initialize_internal_node(new_node);
+
+    memcpy(index_internal_cell(node, 0), index_internal_cell(scratch, 0),
+           left_count * INDEX_INTERNAL_CELL_SIZE);
+    *internal_node_num_keys(node)    = left_count;
+    *internal_node_right_child(node) = *index_internal_cell(scratch, left_count);
+    *split_key                       = *index_internal_key(scratch, left_count);
+
+    memcpy(index_internal_cell(new_node, 0), index_internal_cell(scratch, left_count + 1),
+           (total - left_count - 1) * INDEX_INTERNAL_CELL_SIZE);
+    *internal_node_num_keys(new_node)    = total - left_count - 1;
+    *internal_node_right_child(new_node) = *internal_node_right_child(scratch);
+
+    *split_page_num = new_page;
+    free(scratch);
+    return true;
+}
+
+static void index_insert(Table* table, Column column, IndexKey* key) {
+    Pager*   pager         = table->pager;
+    uint32_t root_page_num = *index_root_page(table, column);
+    IndexKey split_key;
+    uint32_t split_page_num;
+
+    if (!index_node_insert(pager, root_page_num, key, &split_key, &split_page_num)) {
+        return;
+    }
+
+    /* The root keeps its page: its lower half moves out to a fresh left child */
+    uint32_t left_page_num = get_unused_page_num(pager);
+    void*    left          = get_page_for_write(pager, left_page_num);
+    void*    root          = get_page_for_write(pager, root_page_num);
+    memcpy(left, root, pager->layout.page_size);
+    set_node_root(left, false);
+
+    initialize_internal_node(root);
+    set_node_root(root, true);
+    *internal_node_num_keys(root)    = 1;
+    *index_internal_cell(root, 0)    = left_page_num;
+    *index_internal_key(root, 0)     = split_key;
+    *internal_node_right_child(root) = split_page_num;
+}
+
+uint32_t* index_root_page(Table* table, Column column) {
+    DatabaseHeader* header = db_header(table);
+    switch (column) {
+        case COLUMN_USERNAME:
+            return &header->username_index_root;
+        case COLUMN_EMAIL:
+            return &header->email_index_root;
+        default:
+            printf("Column %d cannot have a secondary index\n", column);
+            exit(EXIT_FAILURE);
+    }
+}
+
+bool index_exists(Table* table, Column column) {
+    return *index_root_page(table, column) != 0;
+}
+
+static const char* row_column_text(Row* row, Column column) {
+    return column == COLUMN_USERNAME ? row->username : row->email;
+}
+
+/*
+ * Allocates the index root and backfills it from a full scan of the table
+ */
+void index_create(Table* table, Column column) {
+    uint32_t root_page_num = get_unused_page_num(table->pager);
+    void*    root          = get_page_for_write(table->pager, root_page_num);
+    initialize_leaf_node(root);
+    set_node_root(root, true);
+    pager_mark_dirty(table->pager, DB_HEADER_PAGE_NUM);
+    *index_root_page(table, column) = root_page_num;
+
+    Row      row;
+    IndexKey key;
+    Cursor   cursor;
+    table_start(table, &cursor);
+    while (!cursor.end_of_table) {
+        deserialize_row(cursor_value(&cursor), &row);
+        index_key_init(&key, row_column_text(&row, column), row.id);
+        index_insert(table, column, &key);
+        cursor_advance(&cursor);
+    }
+}
+
+void index_insert_row(Table* table, Row* row) {
+    IndexKey key;
+    if (index_exists(table, COLUMN_USERNAME)) {
+        index_key_init(&key, row->username, row->id);
+        index_insert(table, COLUMN_USERNAME, &key);
+    }
+    if (index_exists(table, COLUMN_EMAIL)) {
+        index_key_init(&key, row->email, row->id);
+        index_insert(table, COLUMN_EMAIL, &key);
+    }
+}
+
+/* Step past the end of an exhausted leaf, following sibling links */
+static void index_cursor_settle(IndexCursor* cursor) {
+    void* node = get_page(cursor->table->pager, cursor->page_num);
+    while (cursor->cell_num >= *leaf_node_num_cells(node)) {
+        uint32_t next_page_num = *leaf_node_next_leaf(node);
+        if (next_page_num == 0) {
+            cursor->end_of_index = true;
+            return;
+        }
+        cursor->page_num = next_page_num;
+        cursor->cell_num = 0;
+        node             = get_page(cursor->table->pager, next_page_num);
+    }
+}
+
+/*
+ * Positions the cursor on the first entry >= key
+ */
+void index_seek(Table* table, Column column, IndexKey* key, IndexCursor* cursor) {
+    uint32_t page_num = *index_root_page(table, column);
+    void*    node     = get_page(table->pager, page_num);
+
+    while (get_node_type(node) == NODE_INTERNAL) {
+        page_num = *index_internal_child(node, index_internal_find_child(node, key));
+        node     = get_page(table->pager, page_num);
+    }
+
+    cursor->table        = table;
+    cursor->page_num     = page_num;
+    cursor->cell_num     = index_leaf_find(node, key);
+    cursor->end_of_index = false;
+    index_cursor_settle(cursor);
+}
+
+IndexKey* index_cursor_key(IndexCursor* cursor) {
+    void* node = get_page(cursor->table->pager, cursor->page_num);
+    return index_leaf_key(node, cursor->cell_num);
+}
+
+void index_cursor_advance(IndexCursor* cursor) {
+    cursor->cell_num += 1;
+    index_cursor_settle(cursor);
+}
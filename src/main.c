@@ -1,8 +1,15 @@
+#define _GNU_SOURCE
 #include "input.h"
-#include "table.h"
+#include "cqlite.h"
+#include "server.h"
+#include "shard.h"
 #include "statement.h"
+#include "table.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <time.h>
 
 static void print_prompt() {
     printf("cqlite > ");
@@ -12,58 +19,126 @@ static void display_banner() {
     printf("CQlite.....\nThis is just a database built to learn....\n");
 }
 
+static double elapsed_ms(struct timespec* start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1e3 + (end.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static void usage(const char* program) {
+    printf("Usage: %s <file|:memory:> [--page-size N] [--shards N] [--serve PATH]\n"
+           "       [--replicate dir:PATH|unix:PATH] [--follow dir:PATH|unix:PATH]\n",
+           program);
+    exit(EXIT_FAILURE);
+}
+
+static void print_result_row(cqlite_stmt* stmt) {
+    printf("(%u %s %s)\n", cqlite_column_int(stmt, CQLITE_COLUMN_ID),
+           cqlite_column_text(stmt, CQLITE_COLUMN_USERNAME),
+           cqlite_column_text(stmt, CQLITE_COLUMN_EMAIL));
+}
+
 int main(int argc, char* argv[]) {
     display_banner();
     InputBuffer* input_buffer = new_input_buffer();
     if (argc < 2) {
-        printf("Must supply a database filename.\n");
+        printf("Must supply a database filename or :memory:.\n");
+        usage(argv[0]);
+    }
+    char*       filename    = argv[1];
+    const char* socket_path = NULL;
+    const char* replicate   = NULL;
+    const char* follow      = NULL;
+    uint32_t    page_size   = DEFAULT_PAGE_SIZE;
+    uint32_t    num_shards  = 0;
+    /* Every option takes a value; page sizes that are not a power of two fail at open */
+    for (int i = 2; i < argc; i += 2) {
+        unsigned long number;
+        if (i + 1 == argc) {
+            usage(argv[0]);
+        } else if (strcmp(argv[i], "--serve") == 0) {
+            socket_path = argv[i + 1];
+        } else if (strcmp(argv[i], "--replicate") == 0) {
+            replicate = argv[i + 1];
+        } else if (strcmp(argv[i], "--follow") == 0) {
+            follow = argv[i + 1];
+        } else if (strcmp(argv[i], "--shards") == 0 &&
+                   parse_count(argv[i + 1], SHARD_MAX_SHARDS, &number) && number > 0) {
+            num_shards = number;
+        } else if (strcmp(argv[i], "--page-size") == 0 &&
+                   parse_count(argv[i + 1], UINT32_MAX, &number)) {
+            page_size = number;
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    cqlite* db;
+    if (num_shards > 0) {
+        if (cqlite_open_sharded(filename, num_shards, page_size, &db) != CQLITE_OK) {
+            printf("Unable to open %s as a sharded database of %u shards.\n", filename,
+                   num_shards);
+            exit(EXIT_FAILURE);
+        }
+    } else if (cqlite_open_with_page_size(filename, page_size, &db) != CQLITE_OK) {
+        printf("Page size must be a power of two from 4096 to 65536.\n");
         exit(EXIT_FAILURE);
     }
-    char*  filename = argv[1];
-    Table* table    = db_open(filename);
+    if ((replicate != NULL && cqlite_replicate(db, replicate) != CQLITE_OK) ||
+        (follow != NULL && cqlite_follow(db, follow) != CQLITE_OK)) {
+        printf("Unable to replicate over %s.\n", replicate != NULL ? replicate : follow);
+        exit(EXIT_FAILURE);
+    }
+
+    if (socket_path != NULL) {
+        int result = run_server(db, socket_path);
+        close_input_buffer(input_buffer);
+        cqlite_close(db);
+        exit(result == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
 
+    bool timer = false;
     while (true) {
         print_prompt();
         read_input(input_buffer);
 
         if (input_buffer->buffer[0] == '.') {
-            switch (execute_meta_command(input_buffer, table)) {
-                case META_COMMAND_SUCCESS:
-                    continue;
-                case META_COMMAND_UNRECOGNIZED_COMMAND:
-                    printf("Unrecognized command '%s'\n", input_buffer->buffer);
-                    continue;
+            if (strcmp(input_buffer->buffer, ".exit") == 0) {
+                close_input_buffer(input_buffer);
+                cqlite_close(db);
+                exit(EXIT_SUCCESS);
+            }
+            if (strcmp(input_buffer->buffer, ".timer on") == 0 ||
+                strcmp(input_buffer->buffer, ".timer off") == 0) {
+                timer = strcmp(input_buffer->buffer, ".timer on") == 0;
+                continue;
+            }
+            if (cqlite_meta_command(db, input_buffer->buffer) == CQLITE_UNRECOGNIZED_COMMAND) {
+                printf("Unrecognized command '%s'\n", input_buffer->buffer);
             }
+            continue;
         }
 
-        Statement statement;
-        switch (prepare_statement(input_buffer, &statement)) {
-            case PREPARE_SUCCESS:
-                break;
-            case PREPARE_NEGATIVE_ID:
-                printf("ID must be positive.\n");
-                continue;
-            case PREPARE_STRING_TOO_LONG:
-                printf("String is too long.\n");
-                continue;
-            case PREPARE_SYNTAX_ERROR:
-                printf("Syntax error.\n");
-                continue;
-            case PREPARE_UNRECOGNIZED_STATEMENT:
-                printf("Unrecognized keyword at start of '%s'.\n", input_buffer->buffer);
-                continue;
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        cqlite_stmt* stmt;
+        CqliteResult result = cqlite_prepare(db, input_buffer->buffer, &stmt);
+        if (result == CQLITE_UNRECOGNIZED_STATEMENT) {
+            printf("Unrecognized keyword at start of '%s'.\n", input_buffer->buffer);
+            continue;
+        } else if (result != CQLITE_OK) {
+            printf("%s\n", cqlite_errstr(result));
+            continue;
         }
 
-        switch (execute_statement(&statement, table)) {
-            case EXECUTE_SUCCESS:
-                printf("Executed.\n");
-                break;
-            case (EXECUTE_DUPLICATE_KEY):
-                printf("Error: Duplicate key.\n");
-                break;
-            case EXECUTE_TABLE_FULL:
-                printf("Error: Table full.\n");
-                break;
+        while ((result = cqlite_step(stmt)) == CQLITE_ROW) {
+            print_result_row(stmt);
+        }
+        printf("%s\n", cqlite_errstr(result));
+        cqlite_finalize(stmt);
+        if (timer) {
+            printf("Run Time: %.3f ms\n", elapsed_ms(&start));
         }
     }
 
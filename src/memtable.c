@@ -0,0 +1,222 @@
+#include "memtable.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MEMTABLE_EMPTY_BUCKET 0
+
+static uint32_t memtable_bucket(Memtable* memtable, uint32_t key) {
+    /* Fibonacci hashing spreads both sequential and random ids over the low bits */
+    return (key * 2654435761u) & memtable->bucket_mask;
+}
+
+void memtable_init(Memtable* memtable, uint32_t row_size) {
+    memset(memtable, 0, sizeof(Memtable));
+    memtable->row_size = row_size;
+    memtable->sorted   = true;
+}
+
+void memtable_destroy(Memtable* memtable) {
+    free(memtable->filter);
+    free(memtable->rows);
+    free(memtable->keys);
+    free(memtable->order);
+    free(memtable->sort_buffer);
+    free(memtable->buckets);
+    memtable_init(memtable, memtable->row_size);
+}
+
+bool memtable_resize(Memtable* memtable, uint32_t capacity) {
+    if (capacity > MEMTABLE_MAX_CAPACITY) {
+        return false;
+    }
+    if (capacity == 0) {
+        memtable_destroy(memtable);
+        return true;
+    }
+
+    /* At most half the buckets are ever in use, so probes stay short */
+    uint64_t num_buckets = 1;
+    while (num_buckets < 2 * (uint64_t) capacity) {
+        num_buckets *= 2;
+    }
+    char*     rows        = malloc((size_t) capacity * memtable->row_size);
+    uint32_t* keys        = malloc((size_t) capacity * sizeof(uint32_t));
+    uint64_t* order       = malloc((size_t) capacity * sizeof(uint64_t));
+    uint64_t* sort_buffer = malloc((size_t) capacity * sizeof(uint64_t));
+    uint32_t* buckets     = calloc(num_buckets, sizeof(uint32_t));
+    if (rows == NULL || keys == NULL || order == NULL || sort_buffer == NULL || buckets == NULL) {
+        free(rows);
+        free(keys);
+        free(order);
+        free(sort_buffer);
+        free(buckets);
+        return false;
+    }
+
+    memtable_destroy(memtable);
+    memtable->capacity    = capacity;
+    memtable->rows        = rows;
+    memtable->keys        = keys;
+    memtable->order       = order;
+    memtable->sort_buffer = sort_buffer;
+    memtable->buckets     = buckets;
+    memtable->bucket_mask = num_buckets - 1;
+    return true;
+}
+
+void* memtable_find(Memtable* memtable, uint32_t key) {
+    if (memtable->num_rows == 0) {
+        return NULL;
+    }
+    uint32_t bucket = memtable_bucket(memtable, key);
+    while (memtable->buckets[bucket] != MEMTABLE_EMPTY_BUCKET) {
+        uint32_t slot = memtable->buckets[bucket] - 1;
+        if (memtable->keys[slot] == key) {
+            return memtable->rows + (size_t) slot * memtable->row_size;
+        }
+        bucket = (bucket + 1) & memtable->bucket_mask;
+    }
+    return NULL;
+}
+
+void* memtable_add(Memtable* memtable, uint32_t key) {
+    uint32_t slot   = memtable->num_rows++;
+    uint32_t bucket = memtable_bucket(memtable, key);
+    while (memtable->buckets[bucket] != MEMTABLE_EMPTY_BUCKET) {
+        bucket = (bucket + 1) & memtable->bucket_mask;
+    }
+    memtable->buckets[bucket] = slot + 1;
+    memtable->keys[slot]      = key;
+    memtable->order[slot]     = (uint64_t) key << 32 | slot;
+
+    /* Still sorted only while ids keep arriving in ascending order */
+    memtable->sorted = memtable->sorted && (slot == 0 || memtable->keys[slot - 1] < key);
+    return memtable->rows + (size_t) slot * memtable->row_size;
+}
+
+bool memtable_full(Memtable* memtable) {
+    return memtable->num_rows >= memtable->capacity;
+}
+
+void memtable_clear(Memtable* memtable) {
+    if (memtable->capacity > 0) {
+        memset(memtable->buckets, 0, (memtable->bucket_mask + 1) * sizeof(uint32_t));
+    }
+    memtable->num_rows = 0;
+    memtable->sorted   = true;
+}
+
+#define FILTER_BLOCK_WORDS 8 /* 512 bits, one cache line */
+
+static uint64_t filter_hash(uint32_t key) {
+    uint64_t hash = key + 0x9E3779B97F4A7C15ull;
+    hash          = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ull;
+    hash          = (hash ^ (hash >> 27)) * 0x94D049BB133111EBull;
+    return hash ^ (hash >> 31);
+}
+
+/* The high half picks the block; a remix supplies a 9-bit position per probe */
+static uint64_t* filter_block(Memtable* memtable, uint64_t hash) {
+    uint64_t block = ((hash >> 32) * memtable->filter_blocks) >> 32;
+    return memtable->filter + block * FILTER_BLOCK_WORDS;
+}
+
+bool memtable_filter_reset(Memtable* memtable, uint64_t num_keys) {
+    uint64_t limit = 2 * num_keys;
+    if (limit < MEMTABLE_FILTER_MIN_KEYS) {
+        limit = MEMTABLE_FILTER_MIN_KEYS;
+    }
+    uint64_t  blocks = (limit * MEMTABLE_FILTER_BITS_PER_KEY + 511) / 512;
+    uint64_t* filter = blocks <= UINT32_MAX ? aligned_alloc(64, (size_t) blocks * 64) : NULL;
+    if (filter == NULL) {
+        /* An overfull filter still never misses an id, it only lets more through */
+        memtable->filter_limit = limit;
+        return false;
+    }
+    memset(filter, 0, (size_t) blocks * 64);
+
+    free(memtable->filter);
+    memtable->filter        = filter;
+    memtable->filter_blocks = blocks;
+    memtable->filter_keys   = 0;
+    memtable->filter_limit  = limit;
+    return true;
+}
+
+bool memtable_filter_full(Memtable* memtable) {
+    return memtable->filter == NULL || memtable->filter_keys >= memtable->filter_limit;
+}
+
+void memtable_filter_add(Memtable* memtable, uint32_t key) {
+    uint64_t  hash  = filter_hash(key);
+    uint64_t* block = filter_block(memtable, hash);
+    uint64_t  bits  = hash * 0xFF51AFD7ED558CCDull;
+    for (uint32_t i = 0; i < MEMTABLE_FILTER_PROBES; i++, bits >>= 9) {
+        block[(bits & 511) / 64] |= 1ull << (bits & 63);
+    }
+    memtable->filter_keys++;
+}
+
+bool memtable_filter_may_contain(Memtable* memtable, uint32_t key) {
+    uint64_t  hash  = filter_hash(key);
+    uint64_t* block = filter_block(memtable, hash);
+    uint64_t  bits  = hash * 0xFF51AFD7ED558CCDull;
+    for (uint32_t i = 0; i < MEMTABLE_FILTER_PROBES; i++, bits >>= 9) {
+        if ((block[(bits & 511) / 64] & (1ull << (bits & 63))) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* LSD radix sort on the id, a byte per pass; ids are unique so stability is free */
+void memtable_sort(Memtable* memtable) {
+    if (memtable->sorted) {
+        return;
+    }
+    uint64_t* from = memtable->order;
+    uint64_t* to   = memtable->sort_buffer;
+    for (uint32_t shift = 32; shift < 64; shift += 8) {
+        uint32_t counts[256] = {0};
+        for (uint32_t i = 0; i < memtable->num_rows; i++) {
+            counts[(from[i] >> shift) & 0xFF]++;
+        }
+        uint32_t offset = 0;
+        for (uint32_t digit = 0; digit < 256; digit++) {
+            uint32_t count = counts[digit];
+            counts[digit]  = offset;
+            offset += count;
+        }
+        for (uint32_t i = 0; i < memtable->num_rows; i++) {
+            to[counts[(from[i] >> shift) & 0xFF]++] = from[i];
+        }
+        uint64_t* swap = from;
+        from           = to;
+        to             = swap;
+    }
+    /* An even number of passes leaves the result back in `order` */
+    memtable->sorted = true;
+}
+
+uint32_t memtable_seek(Memtable* memtable, uint32_t key) {
+    uint32_t min_index = 0;
+    uint32_t max_index = memtable->num_rows;
+    while (min_index != max_index) {
+        uint32_t index = (min_index + max_index) / 2;
+        if (memtable_key(memtable, index) < key) {
+            min_index = index + 1;
+        } else {
+            max_index = index;
+        }
+    }
+    return min_index;
+}
+
+uint32_t memtable_key(Memtable* memtable, uint32_t index) {
+    return (uint32_t) (memtable->order[index] >> 32);
+}
+
+void* memtable_row(Memtable* memtable, uint32_t index) {
+    uint32_t slot = (uint32_t) memtable->order[index];
+    return memtable->rows + (size_t) slot * memtable->row_size;
+}
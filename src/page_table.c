@@ -0,0 +1,69 @@
+#include "page_table.h"
+#include <stdlib.h>
+#include <string.h>
+
+void page_table_init(PageTable* table) {
+    table->leaves     = NULL;
+    table->num_leaves = 0;
+}
+
+/* The entry for page_num, or NULL if no page in its leaf was ever cached */
+PageTableEntry* page_table_lookup(PageTable* table, uint32_t page_num) {
+    uint32_t leaf_num = page_num >> PAGE_TABLE_LEAF_BITS;
+    if (leaf_num >= table->num_leaves || table->leaves[leaf_num] == NULL) {
+        return NULL;
+    }
+    return &table->leaves[leaf_num]->entries[page_num & (PAGE_TABLE_LEAF_SIZE - 1)];
+}
+
+/* Like page_table_lookup, but allocates the leaf and grows the directory as needed */
+PageTableEntry* page_table_entry(PageTable* table, uint32_t page_num) {
+    uint32_t leaf_num = page_num >> PAGE_TABLE_LEAF_BITS;
+
+    if (leaf_num >= table->num_leaves) {
+        uint32_t num_leaves = table->num_leaves ? table->num_leaves : 1;
+        while (num_leaves <= leaf_num) {
+            num_leaves *= 2;
+        }
+        table->leaves = realloc(table->leaves, num_leaves * sizeof(PageTableLeaf*));
+        memset(table->leaves + table->num_leaves, 0,
+               (num_leaves - table->num_leaves) * sizeof(PageTableLeaf*));
+        table->num_leaves = num_leaves;
+    }
+    if (table->leaves[leaf_num] == NULL) {
+        table->leaves[leaf_num] = calloc(1, sizeof(PageTableLeaf));
+    }
+    return &table->leaves[leaf_num]->entries[page_num & (PAGE_TABLE_LEAF_SIZE - 1)];
+}
+
+/*
+ * The first cached entry at or after *page_num, which is moved up to it, or
+ * NULL past the last one. Leaves never allocated are skipped whole, so a walk
+ * costs what is cached rather than the size of the file.
+ */
+PageTableEntry* page_table_next(PageTable* table, uint32_t* page_num) {
+    uint64_t next = *page_num;
+    while ((next >> PAGE_TABLE_LEAF_BITS) < table->num_leaves) {
+        PageTableLeaf* leaf = table->leaves[next >> PAGE_TABLE_LEAF_BITS];
+        if (leaf == NULL) {
+            next = ((next >> PAGE_TABLE_LEAF_BITS) + 1) << PAGE_TABLE_LEAF_BITS;
+            continue;
+        }
+        PageTableEntry* entry = &leaf->entries[next & (PAGE_TABLE_LEAF_SIZE - 1)];
+        if (entry->frame != NULL) {
+            *page_num = next;
+            return entry;
+        }
+        next++;
+    }
+    return NULL;
+}
+
+/* Frees the directory and leaves; the frames belong to whoever allocated them */
+void page_table_destroy(PageTable* table) {
+    for (uint32_t i = 0; i < table->num_leaves; i++) {
+        free(table->leaves[i]);
+    }
+    free(table->leaves);
+    page_table_init(table);
+}
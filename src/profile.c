@@ -0,0 +1,284 @@
+#define _GNU_SOURCE
+#include "profile.h"
+#include "histogram.h"
+#include <inttypes.h>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+_Thread_local Profile* profile_active = NULL;
+
+typedef struct {
+    uint64_t wall_ns;
+    uint64_t values[PROFILE_MAX_COUNTERS];
+} ProfileSample;
+
+typedef struct {
+    uint64_t calls;
+    uint64_t wall_ns;
+    uint64_t values[PROFILE_MAX_COUNTERS];
+} ProfileTotals;
+
+typedef struct {
+    uint32_t    type;
+    uint64_t    config;
+    const char* name;
+} ProfileCounter;
+
+#define HW_CACHE_READ_MISS(cache)                                                                  \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const ProfileCounter HARDWARE_COUNTERS[PROFILE_MAX_COUNTERS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions"},
+    {PERF_TYPE_HW_CACHE, HW_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D), "l1d_misses"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "llc_misses"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch_misses"},
+};
+
+/* Also the columns of the getrusage fallback, in the same order */
+#define SOFTWARE_COUNTERS_USED 4
+static const ProfileCounter SOFTWARE_COUNTERS[SOFTWARE_COUNTERS_USED] = {
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "cpu_ns"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "faults"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MAJ, "major_faults"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "ctx_switches"},
+};
+
+static const char* PHASE_NAMES[PROFILE_PHASES] = {"other", "descent", "page_io", "deserialize",
+                                                  "output"};
+
+/*
+ * The counters that opened are read as one group, so `slots[i]` is where
+ * counter i sits in a group read, or -1 if the kernel would not count it.
+ */
+struct Profile {
+    ProfileSource         source;
+    const ProfileCounter* counters;
+    uint32_t              num_counters;
+    int                   group_fd; /* -1 for PROFILE_RUSAGE */
+    int                   fds[PROFILE_MAX_COUNTERS];
+    int                   slots[PROFILE_MAX_COUNTERS];
+    uint32_t              num_open;
+    ProfileSample         last; /* when the interval now running started */
+    ProfilePhase          stack[PROFILE_MAX_DEPTH];
+    uint32_t              depth;
+    uint64_t              statements;
+    ProfileTotals         phases[PROFILE_PHASES];
+};
+
+static int perf_open(const ProfileCounter* counter, int group_fd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size           = sizeof(attr);
+    attr.type           = counter->type;
+    attr.config         = counter->config;
+    attr.read_format    = PERF_FORMAT_GROUP;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+static void perf_close(Profile* profile) {
+    for (uint32_t i = 0; i < profile->num_counters; i++) {
+        if (profile->fds[i] != -1) {
+            close(profile->fds[i]);
+        }
+    }
+}
+
+/* The group is led by the first counter, without which nothing from this source is used */
+static bool perf_open_group(Profile* profile, const ProfileCounter* counters,
+                            uint32_t num_counters) {
+    profile->counters     = counters;
+    profile->num_counters = num_counters;
+    profile->group_fd     = -1;
+    profile->num_open     = 0;
+    for (uint32_t i = 0; i < num_counters; i++) {
+        profile->fds[i]   = perf_open(&counters[i], profile->group_fd);
+        profile->slots[i] = -1;
+        if (profile->fds[i] == -1) {
+            if (i == 0) {
+                return false;
+            }
+            continue;
+        }
+        if (i == 0) {
+            profile->group_fd = profile->fds[0];
+        }
+        profile->slots[i] = profile->num_open++;
+    }
+    return true;
+}
+
+static void profile_sample(Profile* profile, ProfileSample* sample) {
+    sample->wall_ns = monotonic_ns();
+    memset(sample->values, 0, sizeof(sample->values));
+
+    if (profile->source == PROFILE_RUSAGE) {
+        struct timespec cpu;
+        struct rusage   usage;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+        getrusage(RUSAGE_THREAD, &usage);
+        sample->values[0] = (uint64_t) cpu.tv_sec * 1000000000 + cpu.tv_nsec;
+        sample->values[1] = usage.ru_minflt + usage.ru_majflt;
+        sample->values[2] = usage.ru_majflt;
+        sample->values[3] = usage.ru_nvcsw + usage.ru_nivcsw;
+        return;
+    }
+
+    /* PERF_FORMAT_GROUP: the number of counters, then each value in the order they opened */
+    uint64_t group[1 + PROFILE_MAX_COUNTERS];
+    if (read(profile->group_fd, group, sizeof(group)) <= 0) {
+        return;
+    }
+    for (uint32_t i = 0; i < profile->num_counters; i++) {
+        if (profile->slots[i] != -1) {
+            sample->values[i] = group[1 + profile->slots[i]];
+        }
+    }
+}
+
+/* Charges everything since the last sample to `phase` and starts the next interval */
+static void profile_charge(Profile* profile, ProfilePhase phase) {
+    ProfileSample now;
+    profile_sample(profile, &now);
+
+    ProfileTotals* totals = &profile->phases[phase];
+    totals->wall_ns += now.wall_ns - profile->last.wall_ns;
+    for (uint32_t i = 0; i < profile->num_counters; i++) {
+        totals->values[i] += now.values[i] - profile->last.values[i];
+    }
+    profile->last = now;
+}
+
+static ProfilePhase profile_current_phase(Profile* profile) {
+    if (profile->depth == 0) {
+        return PROFILE_OTHER;
+    }
+    uint32_t top = profile->depth < PROFILE_MAX_DEPTH ? profile->depth : PROFILE_MAX_DEPTH;
+    return profile->stack[top - 1];
+}
+
+Profile* profile_open() {
+    Profile* profile = calloc(1, sizeof(Profile));
+    if (perf_open_group(profile, HARDWARE_COUNTERS, PROFILE_MAX_COUNTERS)) {
+        profile->source = PROFILE_HARDWARE;
+    } else if (perf_open_group(profile, SOFTWARE_COUNTERS, SOFTWARE_COUNTERS_USED)) {
+        profile->source = PROFILE_SOFTWARE;
+    } else {
+        profile->source       = PROFILE_RUSAGE;
+        profile->counters     = SOFTWARE_COUNTERS;
+        profile->num_counters = SOFTWARE_COUNTERS_USED;
+        for (uint32_t i = 0; i < SOFTWARE_COUNTERS_USED; i++) {
+            profile->fds[i]   = -1;
+            profile->slots[i] = i;
+        }
+    }
+    return profile;
+}
+
+void profile_close(Profile* profile) {
+    if (profile == NULL) {
+        return;
+    }
+    perf_close(profile);
+    free(profile);
+}
+
+ProfileSource profile_source(Profile* profile) {
+    return profile->source;
+}
+
+void profile_reset(Profile* profile) {
+    profile->statements = 0;
+    memset(profile->phases, 0, sizeof(profile->phases));
+}
+
+void profile_step_begin(Profile* profile, bool resumed) {
+    if (resumed) {
+        profile_charge(profile, PROFILE_OUTPUT);
+        profile->phases[PROFILE_OUTPUT].calls++;
+    } else {
+        profile_sample(profile, &profile->last);
+    }
+    profile->phases[PROFILE_OTHER].calls++;
+    profile->depth = 0;
+    profile_active = profile;
+}
+
+void profile_step_end(Profile* profile, bool finished) {
+    profile_charge(profile, PROFILE_OTHER);
+    profile_active = NULL;
+    if (finished) {
+        profile->statements++;
+    }
+}
+
+void profile_statement_abandon(Profile* profile) {
+    profile_charge(profile, PROFILE_OUTPUT);
+    profile->phases[PROFILE_OUTPUT].calls++;
+    profile->statements++;
+}
+
+void profile_phase_enter(ProfilePhase phase) {
+    Profile* profile = profile_active;
+    profile_charge(profile, profile_current_phase(profile));
+    profile->phases[phase].calls++;
+    /* Deeper than the stack goes the phase carries on as its parent */
+    if (profile->depth < PROFILE_MAX_DEPTH) {
+        profile->stack[profile->depth] = phase;
+    }
+    profile->depth++;
+}
+
+void profile_phase_exit() {
+    Profile* profile = profile_active;
+    profile_charge(profile, profile_current_phase(profile));
+    profile->depth--;
+}
+
+static void print_row(Profile* profile, const char* name, ProfileTotals* totals) {
+    printf("%-12s %10" PRIu64 " %12.1f", name, totals->calls, totals->wall_ns / 1000.0);
+    for (uint32_t i = 0; i < profile->num_counters; i++) {
+        if (profile->slots[i] == -1) {
+            printf(" %14s", "-");
+        } else {
+            printf(" %14" PRIu64, totals->values[i]);
+        }
+    }
+    printf("\n");
+}
+
+/* `-` marks a counter the kernel would not open; the total row's calls are statements */
+void profile_print(Profile* profile) {
+    const char* source = profile->source == PROFILE_HARDWARE ? "hardware counters"
+                         : profile->source == PROFILE_SOFTWARE
+                             ? "software counters, hardware counters unavailable"
+                             : "getrusage, perf events unavailable";
+    printf("Profile: %s, %" PRIu64 " statements.\n", source, profile->statements);
+
+    printf("%-12s %10s %12s", "phase", "calls", "wall_us");
+    for (uint32_t i = 0; i < profile->num_counters; i++) {
+        printf(" %14s", profile->counters[i].name);
+    }
+    printf("\n");
+
+    ProfileTotals total;
+    memset(&total, 0, sizeof(total));
+    total.calls = profile->statements;
+    for (uint32_t phase = 0; phase < PROFILE_PHASES; phase++) {
+        ProfileTotals* totals = &profile->phases[phase];
+        print_row(profile, PHASE_NAMES[phase], totals);
+        total.wall_ns += totals->wall_ns;
+        for (uint32_t i = 0; i < profile->num_counters; i++) {
+            total.values[i] += totals->values[i];
+        }
+    }
+    print_row(profile, "total", &total);
+}
@@ -0,0 +1,272 @@
+#define _GNU_SOURCE
+#include "replication.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+struct Replication {
+    Table*                table;
+    ReplicationTransport* transport;
+    bool                  primary;
+    pthread_t             thread; /* the follower's applier */
+    pthread_mutex_t       mutex;  /* guards everything below */
+    pthread_cond_t        progress;
+    bool                  running;
+    uint64_t              lsn;       /* primary: last logged; follower: last applied */
+    uint64_t              commit_ns; /* follower: when the last applied record was logged */
+    bool                  primary_known;
+    uint64_t              primary_lsn; /* follower: the primary's last LSN as last seen */
+};
+
+static uint64_t realtime_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void sleep_ms(uint32_t ms) {
+    struct timespec delay = {.tv_sec = ms / 1000, .tv_nsec = (long) (ms % 1000) * 1000000};
+    nanosleep(&delay, NULL);
+}
+
+static Replication* replication_new(Table* table, const char* spec, bool primary) {
+    if (table->replication != NULL) {
+        return NULL;
+    }
+    ReplicationTransport* transport = replication_transport_open(spec, primary);
+    if (transport == NULL) {
+        return NULL;
+    }
+    Replication* replication = calloc(1, sizeof(Replication));
+    replication->table       = table;
+    replication->transport   = transport;
+    replication->primary     = primary;
+    replication->running     = true;
+    pthread_mutex_init(&replication->mutex, NULL);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&replication->progress, &attr);
+    pthread_condattr_destroy(&attr);
+    return replication;
+}
+
+bool replication_start_primary(Table* table, const char* spec) {
+    Replication* replication = replication_new(table, spec, true);
+    if (replication == NULL) {
+        return false;
+    }
+    /* The log carries on numbering from where an earlier session left it */
+    replication->transport->last_lsn(replication->transport, &replication->lsn);
+
+    pager_begin(table->pager, false);
+    table->replication = replication;
+    pager_end(table->pager);
+    return true;
+}
+
+/* Replays one record; one the follower already has changes nothing */
+static void replication_apply(Table* table, ReplicationRecord* record) {
+    Statement statement;
+    memset(&statement, 0, sizeof(statement));
+    if (record->type == REPLICATION_INSERT) {
+        statement.type          = STATEMENT_INSERT;
+        statement.row_to_insert = record->row;
+        execute_insert(&statement, table);
+    } else if (record->type == REPLICATION_CREATE_INDEX) {
+        statement.type         = STATEMENT_CREATE_INDEX;
+        statement.index_column = (Column) record->index_column;
+        statement.index_type   = (IndexType) record->index_type;
+        execute_create_index(&statement, table);
+    }
+}
+
+static void* replication_apply_main(void* arg) {
+    Replication*          replication = arg;
+    Table*                table       = replication->table;
+    ReplicationTransport* transport   = replication->transport;
+    uint64_t              applied     = replication->lsn;
+    ReplicationRecord     record;
+    bool                  pending     = false; /* fetched, held back by an open select */
+
+    while (true) {
+        pthread_mutex_lock(&replication->mutex);
+        bool running = replication->running;
+        pthread_mutex_unlock(&replication->mutex);
+        if (!running) {
+            break;
+        }
+
+        if (!pending) {
+            pending = transport->fetch(transport, applied, &record);
+        }
+        bool advanced = false;
+        if (pending) {
+            /* Open scans point into pages an insert may split or shift */
+            pager_begin(table->pager, false);
+            if (table->open_scans == 0) {
+                replication_apply(table, &record);
+                db_header_for_write(table)->applied_lsn = record.lsn;
+                applied                                 = record.lsn;
+                advanced                                = true;
+                pending                                 = false;
+            }
+            pager_end(table->pager);
+            if (pending) {
+                sleep_ms(REPLICATION_POLL_MS);
+            }
+        }
+        uint64_t primary_lsn = 0;
+        bool     known       = transport->last_lsn(transport, &primary_lsn);
+
+        pthread_mutex_lock(&replication->mutex);
+        if (advanced) {
+            replication->lsn       = applied;
+            replication->commit_ns = record.commit_ns;
+        }
+        replication->primary_known = known;
+        replication->primary_lsn   = primary_lsn;
+        pthread_cond_broadcast(&replication->progress);
+        pthread_mutex_unlock(&replication->mutex);
+    }
+    return NULL;
+}
+
+bool replication_start_follower(Table* table, const char* spec) {
+    Replication* replication = replication_new(table, spec, false);
+    if (replication == NULL) {
+        return false;
+    }
+    pager_begin(table->pager, true);
+    replication->lsn   = db_header(table)->applied_lsn;
+    table->replication = replication;
+    pager_end(table->pager);
+
+    if (pthread_create(&replication->thread, NULL, replication_apply_main, replication) != 0) {
+        printf("Unable to start the replication thread\n");
+        exit(EXIT_FAILURE);
+    }
+    return true;
+}
+
+void replication_stop(Table* table) {
+    Replication* replication = table->replication;
+    if (replication == NULL) {
+        return;
+    }
+    if (!replication->primary) {
+        pthread_mutex_lock(&replication->mutex);
+        replication->running = false;
+        pthread_mutex_unlock(&replication->mutex);
+        pthread_join(replication->thread, NULL);
+    }
+    table->replication = NULL;
+    replication->transport->close(replication->transport);
+    pthread_cond_destroy(&replication->progress);
+    pthread_mutex_destroy(&replication->mutex);
+    free(replication);
+}
+
+bool replication_is_follower(Table* table) {
+    return table->replication != NULL && !table->replication->primary;
+}
+
+bool replication_is_primary(Table* table) {
+    return table->replication != NULL && table->replication->primary;
+}
+
+bool replication_log(Table* table, Statement* statement) {
+    Replication* replication = table->replication;
+    if (replication == NULL || !replication->primary) {
+        return true;
+    }
+
+    /* Zeroed first so the text fields carry nothing past their NUL into the log */
+    ReplicationRecord record;
+    memset(&record, 0, sizeof(record));
+    record.commit_ns = realtime_ns();
+    if (statement->type == STATEMENT_INSERT) {
+        Row* row      = &statement->row_to_insert;
+        record.type   = REPLICATION_INSERT;
+        record.row.id = row->id;
+        strncpy(record.row.username, row->username, sizeof(record.row.username));
+        strncpy(record.row.email, row->email, sizeof(record.row.email));
+    } else {
+        record.type         = REPLICATION_CREATE_INDEX;
+        record.index_column = statement->index_column;
+        record.index_type   = statement->index_type;
+    }
+
+    /* Statements hold the pager lock, so LSNs are handed out and published in order */
+    pthread_mutex_lock(&replication->mutex);
+    record.lsn = replication->lsn + 1;
+    pthread_mutex_unlock(&replication->mutex);
+    record.checksum = replication_checksum(&record);
+    if (!replication->transport->publish(replication->transport, &record)) {
+        return false;
+    }
+
+    pthread_mutex_lock(&replication->mutex);
+    replication->lsn = record.lsn;
+    pthread_mutex_unlock(&replication->mutex);
+    return true;
+}
+
+/*
+ * Lag is the primary's last LSN less the one applied, and in seconds the age
+ * of the last record applied while the follower is behind, 0 once caught up.
+ */
+void replication_print_status(Table* table) {
+    Replication* replication = table->replication;
+    if (replication == NULL) {
+        printf("Replication: off.\n");
+        return;
+    }
+
+    pthread_mutex_lock(&replication->mutex);
+    uint64_t lsn         = replication->lsn;
+    uint64_t commit_ns   = replication->commit_ns;
+    bool     known       = replication->primary_known;
+    uint64_t primary_lsn = replication->primary_lsn;
+    pthread_mutex_unlock(&replication->mutex);
+
+    if (replication->primary) {
+        printf("Replication: primary at LSN %" PRIu64 ".\n", lsn);
+    } else if (!known) {
+        printf("Replication: follower at LSN %" PRIu64 ", primary not reached.\n", lsn);
+    } else {
+        uint64_t lag_lsn = primary_lsn > lsn ? primary_lsn - lsn : 0;
+        uint64_t now     = realtime_ns();
+        double   lag_s   = lag_lsn > 0 && commit_ns > 0 && now > commit_ns ? (now - commit_ns) / 1e9
+                                                                           : 0;
+        printf("Replication: follower at LSN %" PRIu64 " of %" PRIu64 ", lag %" PRIu64
+               " LSN, %.3f s.\n",
+               lsn, primary_lsn, lag_lsn, lag_s);
+    }
+}
+
+void replication_wait(Table* table, uint64_t lsn) {
+    Replication* replication = table->replication;
+    if (replication == NULL || replication->primary) {
+        return;
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += REPLICATION_WAIT_MS / 1000;
+
+    pthread_mutex_lock(&replication->mutex);
+    while (true) {
+        uint64_t target = lsn;
+        if (target == 0) {
+            target = replication->primary_known ? replication->primary_lsn : UINT64_MAX;
+        }
+        if (replication->lsn >= target ||
+            pthread_cond_timedwait(&replication->progress, &replication->mutex, &deadline) != 0) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&replication->mutex);
+}
@@ -0,0 +1,468 @@
+#define _GNU_SOURCE
+#include "replication.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RECORD_SIZE sizeof(ReplicationRecord)
+
+uint32_t replication_checksum(const ReplicationRecord* record) {
+    ReplicationRecord copy = *record;
+    copy.checksum          = 0;
+
+    const uint8_t* bytes = (const uint8_t*) &copy;
+    uint32_t       hash  = 2166136261u;
+    for (size_t i = 0; i < RECORD_SIZE; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * The log file both transports keep: record N lives at byte (N - 1) * size,
+ * so a follower finds any LSN with one pread and the file length gives the
+ * last one.
+ */
+typedef struct {
+    int      fd; /* -1 until a follower finds the file */
+    char*    path;
+    uint64_t last_lsn;
+} ReplicationLog;
+
+/* The primary's side: locked so two primaries never append to one log */
+static bool log_open_primary(ReplicationLog* log, const char* path) {
+    log->path = strdup(path);
+    log->fd   = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, S_IWUSR | S_IRUSR);
+    if (log->fd == -1 || flock(log->fd, LOCK_EX | LOCK_NB) == -1) {
+        return false;
+    }
+    /* A record cut short by a crash never reached a follower in full */
+    struct stat st;
+    if (fstat(log->fd, &st) == -1 || ftruncate(log->fd, st.st_size - st.st_size % RECORD_SIZE)) {
+        return false;
+    }
+    log->last_lsn = st.st_size / RECORD_SIZE;
+    return true;
+}
+
+/* A short write is cut back off, so the log never ends in part of a record */
+static bool log_append(ReplicationLog* log, const ReplicationRecord* record) {
+    ssize_t written = write(log->fd, record, RECORD_SIZE);
+    if (written == (ssize_t) RECORD_SIZE) {
+        log->last_lsn = record->lsn;
+        return true;
+    }
+    if (written > 0 && ftruncate(log->fd, (off_t) log->last_lsn * RECORD_SIZE) == -1) {
+        printf("Error truncating the replication log: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    return false;
+}
+
+/* False while the record is not all there yet */
+static bool log_read(ReplicationLog* log, uint64_t lsn, ReplicationRecord* record) {
+    if (log->fd == -1) {
+        log->fd = open(log->path, O_RDONLY | O_CLOEXEC);
+        if (log->fd == -1) {
+            return false;
+        }
+    }
+    ssize_t bytes = pread(log->fd, record, RECORD_SIZE, (off_t) (lsn - 1) * RECORD_SIZE);
+    return bytes == (ssize_t) RECORD_SIZE && record->lsn == lsn &&
+           record->checksum == replication_checksum(record);
+}
+
+static void log_close(ReplicationLog* log) {
+    if (log->fd != -1) {
+        close(log->fd);
+    }
+    free(log->path);
+}
+
+static void sleep_ms(uint32_t ms) {
+    struct timespec delay = {.tv_sec = ms / 1000, .tv_nsec = (long) (ms % 1000) * 1000000};
+    nanosleep(&delay, NULL);
+}
+
+/* ---- dir: the log itself is what is shared ---- */
+
+typedef struct {
+    ReplicationTransport base;
+    ReplicationLog       log;
+} DirTransport;
+
+static bool dir_publish(ReplicationTransport* transport, const ReplicationRecord* record) {
+    return log_append(&((DirTransport*) transport)->log, record);
+}
+
+static bool dir_fetch(ReplicationTransport* transport, uint64_t lsn, ReplicationRecord* record) {
+    if (log_read(&((DirTransport*) transport)->log, lsn + 1, record)) {
+        return true;
+    }
+    sleep_ms(REPLICATION_POLL_MS);
+    return false;
+}
+
+static bool dir_last_lsn(ReplicationTransport* transport, uint64_t* lsn) {
+    ReplicationLog* log = &((DirTransport*) transport)->log;
+    struct stat     st;
+    if (log->fd == -1 || fstat(log->fd, &st) == -1) {
+        return false;
+    }
+    *lsn = st.st_size / RECORD_SIZE;
+    return true;
+}
+
+static void dir_close(ReplicationTransport* transport) {
+    log_close(&((DirTransport*) transport)->log);
+    free(transport);
+}
+
+static ReplicationTransport* dir_open(const char* path, bool primary) {
+    DirTransport* dir  = calloc(1, sizeof(DirTransport));
+    dir->base.publish  = dir_publish;
+    dir->base.fetch    = dir_fetch;
+    dir->base.last_lsn = dir_last_lsn;
+    dir->base.close    = dir_close;
+    dir->log.fd        = -1;
+    char* log_path     = malloc(strlen(path) + sizeof(REPLICATION_LOG_NAME) + 1);
+    sprintf(log_path, "%s/%s", path, REPLICATION_LOG_NAME);
+
+    bool ok = true;
+    if (primary) {
+        ok = (mkdir(path, 0755) == 0 || errno == EEXIST) && log_open_primary(&dir->log, log_path);
+    } else {
+        dir->log.path = strdup(log_path);
+    }
+    free(log_path);
+    if (!ok) {
+        dir_close(&dir->base);
+        return NULL;
+    }
+    return &dir->base;
+}
+
+/* ---- unix: the primary streams its log to followers over a socket ---- */
+
+/*
+ * A follower connects and sends the uint64 LSN it has applied; from then on
+ * the primary sends it frames, each the primary's last LSN followed by a
+ * record. A frame whose record has LSN 0 is a heartbeat, sent when there is
+ * nothing new so the follower still learns where the primary is.
+ */
+typedef struct {
+    uint64_t          last_lsn;
+    ReplicationRecord record;
+} UnixFrame;
+
+typedef struct UnixTransport UnixTransport;
+
+typedef struct {
+    UnixTransport* stream;
+    pthread_t      thread;
+    int            fd;
+    bool           active;
+} UnixSender;
+
+struct UnixTransport {
+    ReplicationTransport base;
+    char*                socket_path;
+    /* Primary */
+    ReplicationLog  log;
+    int             listen_fd;
+    pthread_t       accept_thread;
+    pthread_mutex_t mutex; /* guards log.last_lsn, stopping and senders */
+    pthread_cond_t  appended;
+    bool            stopping;
+    UnixSender      senders[REPLICATION_MAX_FOLLOWERS];
+    /* Follower */
+    int      fd; /* -1 while disconnected */
+    bool     known;
+    uint64_t primary_lsn;
+};
+
+static bool send_all(int fd, const void* data, size_t size) {
+    while (size > 0) {
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            return false;
+        }
+        data = (const char*) data + sent;
+        size -= sent;
+    }
+    return true;
+}
+
+static bool recv_all(int fd, void* data, size_t size) {
+    return recv(fd, data, size, MSG_WAITALL) == (ssize_t) size;
+}
+
+static void deadline_after_ms(struct timespec* deadline, uint32_t ms) {
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    uint64_t nsec = deadline->tv_nsec + (uint64_t) ms * 1000000;
+    deadline->tv_sec += nsec / 1000000000;
+    deadline->tv_nsec = nsec % 1000000000;
+}
+
+/* Streams the log to one follower until it goes away or the primary stops */
+static void* unix_sender_main(void* arg) {
+    UnixSender*    sender = arg;
+    UnixTransport* stream = sender->stream;
+    uint64_t       next;
+    if (!recv_all(sender->fd, &next, sizeof(next))) {
+        return NULL;
+    }
+    next++;
+
+    UnixFrame frame;
+    while (true) {
+        pthread_mutex_lock(&stream->mutex);
+        if (!stream->stopping && next > stream->log.last_lsn) {
+            struct timespec deadline;
+            deadline_after_ms(&deadline, 100);
+            pthread_cond_timedwait(&stream->appended, &stream->mutex, &deadline);
+        }
+        bool stopping  = stream->stopping;
+        frame.last_lsn = stream->log.last_lsn;
+        pthread_mutex_unlock(&stream->mutex);
+        if (stopping) {
+            break;
+        }
+
+        /* Records up to last_lsn are whole in the file, so they are read without the lock */
+        bool have = next <= frame.last_lsn && log_read(&stream->log, next, &frame.record);
+        if (!have) {
+            memset(&frame.record, 0, sizeof(frame.record));
+        }
+        if (!send_all(sender->fd, &frame, sizeof(frame))) {
+            break;
+        }
+        next += have;
+    }
+    return NULL;
+}
+
+static void unix_reap_senders(UnixTransport* stream, bool all) {
+    for (uint32_t i = 0; i < REPLICATION_MAX_FOLLOWERS; i++) {
+        UnixSender* sender = &stream->senders[i];
+        if (sender->active && (all || pthread_tryjoin_np(sender->thread, NULL) == 0)) {
+            if (all) {
+                shutdown(sender->fd, SHUT_RDWR);
+                pthread_join(sender->thread, NULL);
+            }
+            close(sender->fd);
+            sender->active = false;
+        }
+    }
+}
+
+static void* unix_accept_main(void* arg) {
+    UnixTransport* stream   = arg;
+    struct pollfd  listener = {.fd = stream->listen_fd, .events = POLLIN};
+    while (true) {
+        pthread_mutex_lock(&stream->mutex);
+        bool stopping = stream->stopping;
+        pthread_mutex_unlock(&stream->mutex);
+        if (stopping) {
+            break;
+        }
+        if (poll(&listener, 1, 100) <= 0) {
+            continue;
+        }
+        int fd = accept4(stream->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd == -1) {
+            continue;
+        }
+
+        /* A follower that stops reading is dropped rather than stalling its sender */
+        struct timeval timeout = {.tv_sec = 5};
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        pthread_mutex_lock(&stream->mutex);
+        unix_reap_senders(stream, false);
+        UnixSender* sender = NULL;
+        for (uint32_t i = 0; i < REPLICATION_MAX_FOLLOWERS && sender == NULL; i++) {
+            sender = stream->senders[i].active ? NULL : &stream->senders[i];
+        }
+        if (sender != NULL) {
+            sender->stream = stream;
+            sender->fd     = fd;
+            sender->active = pthread_create(&sender->thread, NULL, unix_sender_main, sender) == 0;
+        }
+        if (sender == NULL || !sender->active) {
+            close(fd);
+        }
+        pthread_mutex_unlock(&stream->mutex);
+    }
+    return NULL;
+}
+
+static bool unix_publish(ReplicationTransport* transport, const ReplicationRecord* record) {
+    UnixTransport* stream = (UnixTransport*) transport;
+    pthread_mutex_lock(&stream->mutex);
+    bool appended = log_append(&stream->log, record);
+    if (appended) {
+        pthread_cond_broadcast(&stream->appended);
+    }
+    pthread_mutex_unlock(&stream->mutex);
+    return appended;
+}
+
+static bool unix_connect(UnixTransport* stream, uint64_t lsn) {
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    strncpy(address.sun_path, stream->socket_path, sizeof(address.sun_path) - 1);
+    stream->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (stream->fd != -1 &&
+        connect(stream->fd, (struct sockaddr*) &address, sizeof(address)) == 0 &&
+        send_all(stream->fd, &lsn, sizeof(lsn))) {
+        return true;
+    }
+    if (stream->fd != -1) {
+        close(stream->fd);
+        stream->fd = -1;
+    }
+    return false;
+}
+
+static void unix_disconnect(UnixTransport* stream) {
+    close(stream->fd);
+    stream->fd    = -1;
+    stream->known = false;
+}
+
+/* Reconnects whenever the stream breaks, asking again from the caller's LSN */
+static bool unix_fetch(ReplicationTransport* transport, uint64_t lsn, ReplicationRecord* record) {
+    UnixTransport* stream = (UnixTransport*) transport;
+    if (stream->fd == -1 && !unix_connect(stream, lsn)) {
+        sleep_ms(REPLICATION_POLL_MS);
+        return false;
+    }
+
+    struct pollfd ready = {.fd = stream->fd, .events = POLLIN};
+    if (poll(&ready, 1, REPLICATION_POLL_MS) <= 0) {
+        return false;
+    }
+    UnixFrame frame;
+    if (!recv_all(stream->fd, &frame, sizeof(frame))) {
+        unix_disconnect(stream);
+        return false;
+    }
+    stream->known       = true;
+    stream->primary_lsn = frame.last_lsn;
+    if (frame.record.lsn == 0) {
+        return false;
+    }
+    if (frame.record.lsn != lsn + 1 ||
+        frame.record.checksum != replication_checksum(&frame.record)) {
+        unix_disconnect(stream);
+        return false;
+    }
+    *record = frame.record;
+    return true;
+}
+
+static bool unix_last_lsn(ReplicationTransport* transport, uint64_t* lsn) {
+    UnixTransport* stream = (UnixTransport*) transport;
+    if (stream->listen_fd != -1) {
+        pthread_mutex_lock(&stream->mutex);
+        *lsn = stream->log.last_lsn;
+        pthread_mutex_unlock(&stream->mutex);
+        return true;
+    }
+    *lsn = stream->primary_lsn;
+    return stream->known;
+}
+
+static void unix_close(ReplicationTransport* transport) {
+    UnixTransport* stream = (UnixTransport*) transport;
+    if (stream->listen_fd != -1) {
+        pthread_mutex_lock(&stream->mutex);
+        stream->stopping = true;
+        pthread_cond_broadcast(&stream->appended);
+        pthread_mutex_unlock(&stream->mutex);
+        pthread_join(stream->accept_thread, NULL);
+        unix_reap_senders(stream, true);
+        close(stream->listen_fd);
+        unlink(stream->socket_path);
+    }
+    if (stream->fd != -1) {
+        close(stream->fd);
+    }
+    log_close(&stream->log);
+    pthread_cond_destroy(&stream->appended);
+    pthread_mutex_destroy(&stream->mutex);
+    free(stream->socket_path);
+    free(stream);
+}
+
+static bool unix_listen(UnixTransport* stream) {
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(stream->socket_path) >= sizeof(address.sun_path)) {
+        return false;
+    }
+    strcpy(address.sun_path, stream->socket_path);
+
+    char* log_path = malloc(strlen(stream->socket_path) + sizeof(REPLICATION_LOG_SUFFIX));
+    sprintf(log_path, "%s%s", stream->socket_path, REPLICATION_LOG_SUFFIX);
+    bool ok = log_open_primary(&stream->log, log_path);
+    free(log_path);
+    if (!ok) {
+        return false;
+    }
+
+    stream->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(stream->socket_path); /* stale socket left by a previous run */
+    if (stream->listen_fd == -1 ||
+        bind(stream->listen_fd, (struct sockaddr*) &address, sizeof(address)) == -1 ||
+        listen(stream->listen_fd, REPLICATION_MAX_FOLLOWERS) == -1) {
+        return false;
+    }
+    return pthread_create(&stream->accept_thread, NULL, unix_accept_main, stream) == 0;
+}
+
+static ReplicationTransport* unix_open(const char* path, bool primary) {
+    UnixTransport* stream = calloc(1, sizeof(UnixTransport));
+    stream->base.publish  = unix_publish;
+    stream->base.fetch    = unix_fetch;
+    stream->base.last_lsn = unix_last_lsn;
+    stream->base.close    = unix_close;
+    stream->socket_path   = strdup(path);
+    stream->log.fd        = -1;
+    stream->listen_fd     = -1;
+    stream->fd            = -1;
+    pthread_mutex_init(&stream->mutex, NULL);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&stream->appended, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (primary && !unix_listen(stream)) {
+        if (stream->listen_fd != -1) {
+            close(stream->listen_fd);
+            stream->listen_fd = -1;
+        }
+        unix_close(&stream->base);
+        return NULL;
+    }
+    return &stream->base;
+}
+
+ReplicationTransport* replication_transport_open(const char* spec, bool primary) {
+    if (strncmp(spec, "dir:", 4) == 0 && spec[4] != '\0') {
+        return dir_open(spec + 4, primary);
+    }
+    if (strncmp(spec, "unix:", 5) == 0 && spec[5] != '\0') {
+        return unix_open(spec + 5, primary);
+    }
+    return NULL;
+}
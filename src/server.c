@@ -0,0 +1,430 @@
+#define _GNU_SOURCE
+#include "server.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define SERVER_MAX_EVENTS 64
+#define SERVER_LISTEN_BACKLOG 128
+#define SERVER_READ_CHUNK 65536
+#define SERVER_INPUT_LIMIT (SERVER_MAX_FRAME_SIZE + SERVER_FRAME_HEADER_SIZE)
+#define SERVER_OUTPUT_HIGH_WATER (4 << 20) /* unsent response bytes before a client is paused */
+
+typedef struct {
+    char*  data;
+    size_t length;
+    size_t capacity;
+} ByteBuffer;
+
+/*
+ * Per-client state. Input accumulates until it holds whole frames; responses
+ * are queued in `out` and drained whenever the socket is writable. A client
+ * that leaves more than SERVER_OUTPUT_HIGH_WATER unread is paused: nothing
+ * more is read from it or executed for it until its responses drain.
+ */
+typedef struct Connection {
+    int                fd;
+    ByteBuffer         in;
+    ByteBuffer         out;
+    size_t             out_sent;
+    ByteBuffer         statement; /* NUL-terminated copy of the frame being executed */
+    uint32_t           interest;  /* events registered with epoll */
+    bool               peer_closed;
+    struct Connection* prev;
+    struct Connection* next;
+} Connection;
+
+static volatile sig_atomic_t server_stopping = 0;
+
+static void handle_stop_signal(int signum) {
+    (void) signum;
+    server_stopping = 1;
+}
+
+/* Out of memory the buffer is left as it was; the caller drops the connection */
+static bool buffer_reserve(ByteBuffer* buffer, size_t extra) {
+    if (buffer->length + extra <= buffer->capacity) {
+        return true;
+    }
+    size_t capacity = buffer->capacity ? buffer->capacity : 256;
+    while (capacity < buffer->length + extra) {
+        capacity *= 2;
+    }
+    char* data = realloc(buffer->data, capacity);
+    if (data == NULL) {
+        return false;
+    }
+    buffer->data     = data;
+    buffer->capacity = capacity;
+    return true;
+}
+
+static bool buffer_append(ByteBuffer* buffer, const void* data, size_t length) {
+    if (!buffer_reserve(buffer, length)) {
+        return false;
+    }
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+    return true;
+}
+
+static bool connection_backed_up(Connection* conn) {
+    return conn->out.length - conn->out_sent > SERVER_OUTPUT_HIGH_WATER;
+}
+
+/*
+ * Runs one statement exactly as the REPL would and writes the REPL's output
+ * for it to `out`. Meta commands act on the whole process (.exit, .btree
+ * dumps to stdout) so they are not accepted over the socket.
+ */
+static ResponseStatus execute_request(cqlite* db, const char* sql, FILE* out) {
+    if (sql[0] == '.') {
+        fprintf(out, "Unrecognized command '%s'\n", sql);
+        return RESPONSE_ERROR;
+    }
+
+    cqlite_stmt* stmt;
+    CqliteResult result = cqlite_prepare(db, sql, &stmt);
+    if (result == CQLITE_UNRECOGNIZED_STATEMENT) {
+        fprintf(out, "Unrecognized keyword at start of '%s'.\n", sql);
+        return RESPONSE_ERROR;
+    } else if (result != CQLITE_OK) {
+        fprintf(out, "%s\n", cqlite_errstr(result));
+        return RESPONSE_ERROR;
+    }
+
+    while ((result = cqlite_step(stmt)) == CQLITE_ROW) {
+        fprintf(out, "(%u %s %s)\n", cqlite_column_int(stmt, CQLITE_COLUMN_ID),
+                cqlite_column_text(stmt, CQLITE_COLUMN_USERNAME),
+                cqlite_column_text(stmt, CQLITE_COLUMN_EMAIL));
+    }
+    cqlite_finalize(stmt);
+
+    fprintf(out, "%s\n", cqlite_errstr(result));
+    return result == CQLITE_DONE ? RESPONSE_OK : RESPONSE_ERROR;
+}
+
+/*
+ * Returns false if there was no memory for the response; the statement may
+ * have run, but the client can no longer tell, so its connection is closed.
+ */
+static bool handle_request(Connection* conn, cqlite* db, const char* payload, uint32_t length) {
+    conn->statement.length = 0;
+    if (!buffer_append(&conn->statement, payload, length) ||
+        !buffer_append(&conn->statement, "", 1)) {
+        return false;
+    }
+
+    char*  text      = NULL;
+    size_t text_size = 0;
+    FILE*  out       = open_memstream(&text, &text_size);
+    if (out == NULL) {
+        return false;
+    }
+    uint8_t status = execute_request(db, conn->statement.data, out);
+    bool    ok     = !ferror(out);
+    ok             = fclose(out) == 0 && ok;
+
+    uint32_t frame_length = htonl((uint32_t) (text_size + 1));
+    ok = ok && buffer_reserve(&conn->out, SERVER_FRAME_HEADER_SIZE + 1 + text_size);
+    if (ok) {
+        buffer_append(&conn->out, &frame_length, SERVER_FRAME_HEADER_SIZE);
+        buffer_append(&conn->out, &status, 1);
+        buffer_append(&conn->out, text, text_size);
+    }
+    free(text);
+    return ok;
+}
+
+/*
+ * Executes complete frames from the input buffer, in order, until it runs out
+ * or the client is backed up. Returns false if the client sent a frame we
+ * refuse to buffer or its response could not be queued.
+ */
+static bool connection_process(Connection* conn, cqlite* db) {
+    size_t offset = 0;
+
+    while (conn->in.length - offset >= SERVER_FRAME_HEADER_SIZE && !connection_backed_up(conn)) {
+        uint32_t length;
+        memcpy(&length, conn->in.data + offset, SERVER_FRAME_HEADER_SIZE);
+        length = ntohl(length);
+        if (length > SERVER_MAX_FRAME_SIZE) {
+            return false;
+        }
+        if (conn->in.length - offset - SERVER_FRAME_HEADER_SIZE < length) {
+            break;
+        }
+        if (!handle_request(conn, db, conn->in.data + offset + SERVER_FRAME_HEADER_SIZE, length)) {
+            return false;
+        }
+        offset += SERVER_FRAME_HEADER_SIZE + length;
+    }
+
+    memmove(conn->in.data, conn->in.data + offset, conn->in.length - offset);
+    conn->in.length -= offset;
+    return true;
+}
+
+/*
+ * Reads the socket into the input buffer until it is drained or the buffer
+ * holds the largest frame, so a complete frame is always waiting once it
+ * stops. Returns false if the socket failed or there was no memory; a clean
+ * hang-up only sets peer_closed so queued responses still go out.
+ */
+static bool connection_read(Connection* conn) {
+    while (conn->in.length < SERVER_INPUT_LIMIT) {
+        if (!buffer_reserve(&conn->in, SERVER_READ_CHUNK)) {
+            return false;
+        }
+        ssize_t bytes_read = read(conn->fd, conn->in.data + conn->in.length, SERVER_READ_CHUNK);
+        if (bytes_read > 0) {
+            conn->in.length += bytes_read;
+            continue;
+        }
+        if (bytes_read == 0) {
+            conn->peer_closed = true;
+            return true;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    return true;
+}
+
+static bool connection_write(Connection* conn) {
+    while (conn->out_sent < conn->out.length) {
+        ssize_t bytes_written = send(conn->fd, conn->out.data + conn->out_sent,
+                                     conn->out.length - conn->out_sent, MSG_NOSIGNAL);
+        if (bytes_written >= 0) {
+            conn->out_sent += bytes_written;
+            continue;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    conn->out.length = 0;
+    conn->out_sent   = 0;
+    return true;
+}
+
+/*
+ * Answers whatever has arrived, even if the peer already half-closed. A
+ * backed-up client is only picked up again here, once its responses drain,
+ * so send first and keep going while they drain and frames are left.
+ */
+static bool connection_serve(Connection* conn, cqlite* db) {
+    if (!connection_write(conn)) {
+        return false;
+    }
+    do {
+        size_t pending = conn->in.length;
+        if (!connection_process(conn, db) || !connection_write(conn)) {
+            return false;
+        }
+        if (conn->in.length == pending) {
+            break;
+        }
+    } while (conn->out.length == 0);
+    return true;
+}
+
+/*
+ * Only ask for EPOLLOUT while there are queued responses, and stop asking for
+ * EPOLLIN while the client is backed up, or once the peer has hung up or
+ * level-triggered epoll would spin on EOF.
+ */
+static void connection_update_interest(int epoll_fd, Connection* conn) {
+    bool     want_read  = !conn->peer_closed && !connection_backed_up(conn);
+    bool     want_write = conn->out_sent < conn->out.length;
+    uint32_t interest   = (want_read ? EPOLLIN : 0) | (want_write ? EPOLLOUT : 0);
+    if (interest == conn->interest) {
+        return;
+    }
+
+    struct epoll_event event;
+    event.events   = interest;
+    event.data.ptr = conn;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+    conn->interest = interest;
+}
+
+static void connection_close(int epoll_fd, Connection** connections, Connection* conn) {
+    if (conn->prev) {
+        conn->prev->next = conn->next;
+    } else {
+        *connections = conn->next;
+    }
+    if (conn->next) {
+        conn->next->prev = conn->prev;
+    }
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    free(conn->in.data);
+    free(conn->out.data);
+    free(conn->statement.data);
+    free(conn);
+}
+
+static void accept_connections(int epoll_fd, int listen_fd, Connection** connections) {
+    while (true) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return; /* EAGAIN: backlog drained, anything else: try again next wakeup */
+        }
+
+        Connection* conn = calloc(1, sizeof(Connection));
+        if (conn == NULL) {
+            close(fd);
+            continue;
+        }
+        conn->fd       = fd;
+        conn->interest = EPOLLIN;
+
+        struct epoll_event event;
+        event.events   = conn->interest;
+        event.data.ptr = conn;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+            close(fd);
+            free(conn);
+            continue;
+        }
+
+        conn->next = *connections;
+        if (*connections) {
+            (*connections)->prev = conn;
+        }
+        *connections = conn;
+    }
+}
+
+static int open_listener(const char* socket_path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        printf("Socket path is too long.\n");
+        return -1;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        printf("Unable to create socket: %d\n", errno);
+        return -1;
+    }
+
+    unlink(socket_path); /* stale socket left by a previous run */
+    if (bind(fd, (struct sockaddr*) &address, sizeof(address)) == -1 ||
+        listen(fd, SERVER_LISTEN_BACKLOG) == -1) {
+        printf("Unable to listen on %s: %d\n", socket_path, errno);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int run_server(cqlite* db, const char* socket_path) {
+    int listen_fd = open_listener(socket_path);
+    if (listen_fd == -1) {
+        return -1;
+    }
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        printf("Unable to create epoll instance: %d\n", errno);
+        close(listen_fd);
+        return -1;
+    }
+
+    /* The listener is the only registration without a Connection attached */
+    struct epoll_event event;
+    event.events   = EPOLLIN;
+    event.data.ptr = NULL;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+
+    /*
+     * Keep the stop signals blocked except while waiting in epoll_pwait, so a
+     * signal can never slip in between the flag check and the wait.
+     */
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_stop_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    sigset_t stop_signals, wait_mask;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &stop_signals, &wait_mask);
+    sigdelset(&wait_mask, SIGINT);
+    sigdelset(&wait_mask, SIGTERM);
+
+    printf("Listening on %s\n", socket_path);
+    fflush(stdout);
+
+    Connection*        connections = NULL;
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    while (!server_stopping) {
+        int ready = epoll_pwait(epoll_fd, events, SERVER_MAX_EVENTS, -1, &wait_mask);
+        if (ready == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("epoll_wait failed: %d\n", errno);
+            break;
+        }
+
+        for (int i = 0; i < ready; i++) {
+            Connection* conn = events[i].data.ptr;
+            if (conn == NULL) {
+                accept_connections(epoll_fd, listen_fd, &connections);
+                continue;
+            }
+
+            bool alive = true;
+            if (!conn->peer_closed && !connection_backed_up(conn) &&
+                (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                alive = connection_read(conn);
+            }
+            if (!connection_serve(conn, db)) {
+                alive = false;
+            }
+
+            if (alive && conn->peer_closed && conn->out.length == 0) {
+                alive = false;
+            }
+            if (alive) {
+                connection_update_interest(epoll_fd, conn);
+            } else {
+                connection_close(epoll_fd, &connections, conn);
+            }
+        }
+    }
+
+    /* Drop whoever is still connected; the caller flushes the table */
+    while (connections) {
+        connection_close(epoll_fd, &connections, connections);
+    }
+    close(listen_fd);
+    unlink(socket_path);
+    close(epoll_fd);
+    sigprocmask(SIG_UNBLOCK, &stop_signals, NULL);
+    return 0;
+}
@@ -0,0 +1,630 @@
+#define _GNU_SOURCE
+#include "shard.h"
+#include "checkpoint.h"
+#include "warmup.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/* ---- the manifest ---- */
+
+static char* shard_path(ShardSet* set, uint32_t file_number) {
+    char* path = malloc(strlen(set->path) + 12);
+    sprintf(path, "%s-%u", set->path, file_number);
+    return path;
+}
+
+static uint32_t shard_upper_bound(ShardSet* set, uint32_t index) {
+    return index + 1 < set->num_shards ? set->shards[index + 1].lower_bound - 1 : UINT32_MAX;
+}
+
+bool shard_set_is_manifest(const char* filename) {
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) {
+        return false;
+    }
+    char magic[sizeof(SHARD_MAGIC)];
+    bool manifest = fread(magic, sizeof(magic), 1, file) == 1 &&
+                    memcmp(magic, SHARD_MAGIC, sizeof(magic)) == 0;
+    fclose(file);
+    return manifest;
+}
+
+/* Written aside and renamed, so the manifest on disk is always a whole one */
+static void shard_set_save(ShardSet* set) {
+    char* tmp_path = malloc(strlen(set->path) + sizeof(".tmp"));
+    sprintf(tmp_path, "%s.tmp", set->path);
+
+    uint32_t header[] = {SHARD_VERSION, set->page_size, set->max_pages, set->num_shards,
+                         set->next_file_number};
+
+    FILE* file = fopen(tmp_path, "wb");
+    bool  ok   = file != NULL && fwrite(SHARD_MAGIC, sizeof(SHARD_MAGIC), 1, file) == 1 &&
+              fwrite(header, sizeof(header), 1, file) == 1;
+    for (uint32_t i = 0; ok && i < set->num_shards; i++) {
+        uint32_t entry[] = {set->shards[i].lower_bound, set->shards[i].file_number};
+        ok               = fwrite(entry, sizeof(entry), 1, file) == 1;
+    }
+    if (file == NULL || fclose(file) != 0 || !ok || rename(tmp_path, set->path) != 0) {
+        printf("Unable to write the shard manifest %s\n", set->path);
+        exit(EXIT_FAILURE);
+    }
+    free(tmp_path);
+}
+
+static bool shard_set_load(ShardSet* set) {
+    FILE* file = fopen(set->path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+    char     magic[sizeof(SHARD_MAGIC)];
+    uint32_t header[5];
+    bool     ok = fread(magic, sizeof(magic), 1, file) == 1 &&
+                  fread(header, sizeof(header), 1, file) == 1 &&
+                  memcmp(magic, SHARD_MAGIC, sizeof(magic)) == 0 && header[0] == SHARD_VERSION &&
+                  page_size_valid(header[1]) && header[2] > 0 && header[3] > 0 &&
+                  header[3] <= SHARD_MAX_SHARDS;
+    if (ok) {
+        set->page_size        = header[1];
+        set->max_pages        = header[2];
+        set->num_shards       = header[3];
+        set->next_file_number = header[4];
+    }
+    for (uint32_t i = 0; ok && i < set->num_shards; i++) {
+        uint32_t entry[2];
+        ok = fread(entry, sizeof(entry), 1, file) == 1 && entry[1] < set->next_file_number &&
+             (i == 0 ? entry[0] == 0 : entry[0] > set->shards[i - 1].lower_bound);
+        set->shards[i].lower_bound = entry[0];
+        set->shards[i].file_number = entry[1];
+    }
+    fclose(file);
+    return ok;
+}
+
+/* ---- opening and closing ---- */
+
+static void shard_remove_files(ShardSet* set, uint32_t file_number) {
+    char* path      = shard_path(set, file_number);
+    char* warm_path = malloc(strlen(path) + sizeof(WARMUP_SUFFIX));
+    sprintf(warm_path, "%s%s", path, WARMUP_SUFFIX);
+    unlink(path);
+    unlink(warm_path);
+    free(warm_path);
+    free(path);
+}
+
+/* A new shard starts from nothing, whatever an interrupted split left under its name */
+static Table* shard_table_open(ShardSet* set, uint32_t file_number, bool fresh) {
+    if (fresh) {
+        shard_remove_files(set, file_number);
+    }
+    char*  path  = shard_path(set, file_number);
+    Table* table = db_open(path, set->page_size);
+    warmup_start(table->pager, path);
+    free(path);
+    return table;
+}
+
+ShardSet* shard_set_open(const char* filename, uint32_t num_shards, uint32_t page_size) {
+    ShardSet* set = calloc(1, sizeof(ShardSet));
+    set->path     = strdup(filename);
+
+    bool created = access(filename, F_OK) != 0;
+    if (!created) {
+        if (!shard_set_load(set)) {
+            free(set->path);
+            free(set);
+            return NULL;
+        }
+    } else {
+        /* Even ranges to start with; splits follow wherever the ids actually land */
+        uint64_t width        = ((uint64_t) UINT32_MAX + 1) / num_shards;
+        set->page_size        = page_size;
+        set->max_pages        = SHARD_DEFAULT_MAX_PAGES;
+        set->num_shards       = num_shards;
+        set->next_file_number = num_shards;
+        for (uint32_t i = 0; i < num_shards; i++) {
+            set->shards[i].lower_bound = (uint32_t) (i * width);
+            set->shards[i].file_number = i;
+        }
+        shard_set_save(set);
+    }
+
+    for (uint32_t i = 0; i < set->num_shards; i++) {
+        set->shards[i].table = shard_table_open(set, set->shards[i].file_number, created);
+    }
+    return set;
+}
+
+void shard_set_close(ShardSet* set) {
+    for (uint32_t i = 0; i < set->num_shards; i++) {
+        db_close(set->shards[i].table);
+    }
+    free(set->path);
+    free(set);
+}
+
+/* ---- writes ---- */
+
+static uint32_t shard_for_key(ShardSet* set, uint32_t key) {
+    uint32_t min_index = 0;
+    uint32_t max_index = set->num_shards - 1;
+    while (min_index != max_index) {
+        uint32_t index = (min_index + max_index + 1) / 2;
+        if (set->shards[index].lower_bound <= key) {
+            min_index = index;
+        } else {
+            max_index = index - 1;
+        }
+    }
+    return min_index;
+}
+
+static void copy_indexes(Table* from, Table* to) {
+    DatabaseHeader* header = db_header(from);
+    Statement       statement;
+    memset(&statement, 0, sizeof(statement));
+    statement.type = STATEMENT_CREATE_INDEX;
+    if (header->username_index_root != 0) {
+        statement.index_column = COLUMN_USERNAME;
+        execute_create_index(&statement, to);
+    }
+    if (header->email_index_root != 0) {
+        statement.index_column = COLUMN_EMAIL;
+        execute_create_index(&statement, to);
+    }
+    if (header->hash_index_directory != 0) {
+        statement.index_type = INDEX_HASH;
+        execute_create_index(&statement, to);
+    }
+}
+
+/* Id of the row halfway through the shard, or 0 when it has too few rows to split */
+static uint32_t shard_median(Table* table) {
+    uint64_t rows = 0;
+    Cursor   cursor;
+    table_start(table, &cursor);
+    for (uint32_t page_num = cursor.end_of_table ? 0 : cursor.page_num; page_num != 0;) {
+        void* node = get_page(table->pager, page_num);
+        rows += *leaf_node_num_cells(node);
+        page_num = *leaf_node_next_leaf(node);
+    }
+    if (rows < 2) {
+        return 0;
+    }
+    uint64_t skip = rows / 2;
+    for (uint32_t page_num = cursor.page_num;;) {
+        void*    node      = get_page(table->pager, page_num);
+        uint32_t num_cells = *leaf_node_num_cells(node);
+        if (skip < num_cells) {
+            return *leaf_node_key(node, skip);
+        }
+        skip -= num_cells;
+        page_num = *leaf_node_next_leaf(node);
+    }
+}
+
+/*
+ * Rows go into two new files in key order, so each lands at the right edge
+ * of its tree. The halves are written out before the manifest names them.
+ */
+static bool shard_split(ShardSet* set, uint32_t index) {
+    if (set->num_shards == SHARD_MAX_SHARDS || set->open_scans > 0) {
+        return false;
+    }
+    Shard* shard = &set->shards[index];
+    Table* table = shard->table;
+    pager_begin(table->pager, false);
+    table_merge_memtable(table);
+    pager_end(table->pager);
+
+    /* Read-only from here: nothing in the file about to go changes, so nothing is flushed */
+    pager_begin(table->pager, true);
+    uint32_t median = shard_median(table);
+    if (median == 0) {
+        pager_end(table->pager);
+        return false;
+    }
+
+    Table* halves[2] = {shard_table_open(set, set->next_file_number, true),
+                        shard_table_open(set, set->next_file_number + 1, true)};
+    pager_begin(halves[0]->pager, false);
+    pager_begin(halves[1]->pager, false);
+
+    Statement statement;
+    memset(&statement, 0, sizeof(statement));
+    statement.type = STATEMENT_INSERT;
+    Cursor cursor;
+    for (table_start(table, &cursor); !cursor.end_of_table; cursor_advance(&cursor)) {
+        deserialize_row(cursor_value(&cursor), &statement.row_to_insert);
+        execute_insert(&statement, halves[statement.row_to_insert.id >= median]);
+    }
+    for (uint32_t i = 0; i < 2; i++) {
+        copy_indexes(table, halves[i]);
+        table_merge_memtable(halves[i]);
+        pager_end(halves[i]->pager);
+        checkpoint(halves[i]->pager);
+    }
+    pager_end(table->pager);
+
+    memmove(&set->shards[index + 2], &set->shards[index + 1],
+            (set->num_shards - index - 1) * sizeof(Shard));
+    uint32_t old_file_number = shard->file_number;
+    set->shards[index + 1]   = (Shard) {median, set->next_file_number + 1, halves[1]};
+    set->shards[index]       = (Shard) {shard->lower_bound, set->next_file_number, halves[0]};
+    set->num_shards++;
+    set->next_file_number += 2;
+    shard_set_save(set);
+
+    db_close(table);
+    shard_remove_files(set, old_file_number);
+    return true;
+}
+
+ExecuteResult shard_set_insert(ShardSet* set, Statement* statement) {
+    uint32_t index = shard_for_key(set, statement->row_to_insert.id);
+    Pager*   pager = set->shards[index].table->pager;
+    pager_begin(pager, false);
+    ExecuteResult result = execute_insert(statement, set->shards[index].table);
+    bool          full   = pager->num_pages > set->max_pages;
+    pager_end(pager);
+
+    if (full) {
+        shard_split(set, index);
+    }
+    return result;
+}
+
+/* Every shard gets the index; they only ever differ if one was added by hand */
+ExecuteResult shard_set_create_index(ShardSet* set, Statement* statement) {
+    ExecuteResult result = EXECUTE_SUCCESS;
+    for (uint32_t i = 0; i < set->num_shards; i++) {
+        Table* table = set->shards[i].table;
+        pager_begin(table->pager, false);
+        ExecuteResult shard_result = execute_create_index(statement, table);
+        pager_end(table->pager);
+        if (i == 0) {
+            result = shard_result;
+        }
+    }
+    return result;
+}
+
+/* ---- meta commands ---- */
+
+static void shard_set_print(ShardSet* set) {
+    printf("Shards: %u, split past %u pages.\n", set->num_shards, set->max_pages);
+    for (uint32_t i = 0; i < set->num_shards; i++) {
+        Pager* pager = set->shards[i].table->pager;
+        pager_begin(pager, true);
+        uint32_t num_pages = pager->num_pages;
+        pager_end(pager);
+        printf("Shard %u: ids %u to %u, %u pages, file %s-%u\n", i, set->shards[i].lower_bound,
+               shard_upper_bound(set, i), num_pages, set->path, set->shards[i].file_number);
+    }
+}
+
+/*
+ * .shards lists the ranges; .shards max_pages <n> sets the split threshold
+ * and .shards split <i> splits one now. Any other command runs on each shard
+ * in turn, except those that move rows in or out of a single file,
+ * .replication and .profile, which follow statements through one table, and
+ * .defrag on|off|wait, whose threads would miss the shards splits create.
+ */
+MetaCommandResult shard_set_meta_command(ShardSet* set, const char* command) {
+    if (strcmp(command, ".shards") == 0) {
+        shard_set_print(set);
+        return META_COMMAND_SUCCESS;
+    }
+    unsigned long number;
+    if (strncmp(command, ".shards max_pages ", 18) == 0) {
+        if (!parse_count(command + 18, UINT32_MAX, &number) || number == 0) {
+            return META_COMMAND_UNRECOGNIZED_COMMAND;
+        }
+        set->max_pages = number;
+        shard_set_save(set);
+        return META_COMMAND_SUCCESS;
+    }
+    if (strncmp(command, ".shards split ", 14) == 0) {
+        if (!parse_count(command + 14, set->num_shards - 1, &number)) {
+            return META_COMMAND_UNRECOGNIZED_COMMAND;
+        }
+        uint32_t index = number;
+        if (shard_split(set, index)) {
+            printf("Split shard %u at id %u.\n", index, set->shards[index + 1].lower_bound);
+        } else {
+            printf("Shard %u cannot be split.\n", index);
+        }
+        return META_COMMAND_SUCCESS;
+    }
+    if (strncmp(command, ".export ", 8) == 0 || strncmp(command, ".import ", 8) == 0 ||
+        strncmp(command, ".replication", 12) == 0 || strncmp(command, ".profile", 8) == 0 ||
+        strncmp(command, ".defrag o", 9) == 0 || strcmp(command, ".defrag wait") == 0) {
+        return META_COMMAND_UNRECOGNIZED_COMMAND;
+    }
+
+    for (uint32_t i = 0; i < set->num_shards; i++) {
+        printf("Shard %u:\n", i);
+        if (execute_meta_command(command, set->shards[i].table) != META_COMMAND_SUCCESS) {
+            return META_COMMAND_UNRECOGNIZED_COMMAND;
+        }
+    }
+    return META_COMMAND_SUCCESS;
+}
+
+/* ---- fanned-out selects ---- */
+
+/*
+ * One shard's part of a select. Batches form a ring of SHARD_QUEUE_BATCHES:
+ * `count` filled ones from `head`, the reader working through the head one.
+ */
+typedef struct {
+    ShardScan* owner;
+    Table*     table;
+    Statement  statement;
+    Scan       scan;
+    bool       opened;
+    bool       threaded;
+    pthread_t  thread;
+    char*      batches;
+    uint32_t   batch_rows[SHARD_QUEUE_BATCHES];
+    uint32_t   head;
+    uint32_t   count;
+    uint32_t   position; /* the reader's row within the head batch */
+    bool       finished; /* no batches are coming after the `count` queued */
+    bool       failed;   /* set with finished when the scan ran out of memory */
+} ShardStream;
+
+struct ShardScan {
+    ShardSet*       set;
+    OrderBy         order_by;
+    uint32_t        limit;
+    ShardStream*    streams;
+    uint32_t        num_streams;
+    uint32_t        next_stream; /* without order by, shards are read one after another */
+    uint32_t        returned;
+    pthread_mutex_t mutex; /* guards every stream's head, count and finished, and stopping */
+    pthread_cond_t  changed;
+    bool            stopping;
+    bool            failed; /* a stream failed, so the rows cannot all come out */
+    char*           row;
+};
+
+/* Scans the next batch into `slot`; false once the shard has nothing more */
+static bool shard_stream_fill(ShardStream* stream, uint32_t slot) {
+    char*    batch = stream->batches + (size_t) slot * SHARD_BATCH_ROWS * ROW_SIZE;
+    uint32_t rows  = 0;
+    pager_begin(stream->table->pager, true);
+    if (!stream->opened) {
+        scan_open(&stream->scan, &stream->statement, stream->table);
+        stream->opened = true;
+    }
+    while (rows < SHARD_BATCH_ROWS && scan_next(&stream->scan)) {
+        memcpy(batch + (size_t) rows++ * ROW_SIZE, stream->scan.row, ROW_SIZE);
+    }
+    stream->failed = stream->scan.failed;
+    pager_end(stream->table->pager);
+    stream->batch_rows[slot] = rows;
+    return rows == SHARD_BATCH_ROWS;
+}
+
+static void* shard_stream_main(void* arg) {
+    ShardStream* stream = arg;
+    ShardScan*   scan   = stream->owner;
+    pthread_mutex_lock(&scan->mutex);
+    while (!stream->finished) {
+        while (stream->count == SHARD_QUEUE_BATCHES && !scan->stopping) {
+            pthread_cond_wait(&scan->changed, &scan->mutex);
+        }
+        if (scan->stopping) {
+            break;
+        }
+        uint32_t slot = (stream->head + stream->count) % SHARD_QUEUE_BATCHES;
+        pthread_mutex_unlock(&scan->mutex);
+        bool more = shard_stream_fill(stream, slot);
+        pthread_mutex_lock(&scan->mutex);
+        stream->count++;
+        stream->finished = !more;
+        pthread_cond_broadcast(&scan->changed);
+    }
+    pthread_mutex_unlock(&scan->mutex);
+    return NULL;
+}
+
+/* The stream's next row without taking it, or NULL once it is exhausted */
+static void* shard_stream_peek(ShardScan* scan, ShardStream* stream) {
+    void* row = NULL;
+    pthread_mutex_lock(&scan->mutex);
+    while (true) {
+        if (stream->count > 0 && stream->position < stream->batch_rows[stream->head]) {
+            row = stream->batches +
+                  ((size_t) stream->head * SHARD_BATCH_ROWS + stream->position) * ROW_SIZE;
+            break;
+        }
+        if (stream->count > 0) {
+            stream->head     = (stream->head + 1) % SHARD_QUEUE_BATCHES;
+            stream->position = 0;
+            stream->count--;
+            pthread_cond_broadcast(&scan->changed);
+        } else if (stream->finished) {
+            scan->failed = scan->failed || stream->failed;
+            break;
+        } else if (!stream->threaded) {
+            /* A lone shard is read on the caller's thread, a batch at a time */
+            pthread_mutex_unlock(&scan->mutex);
+            bool more = shard_stream_fill(stream, stream->head);
+            pthread_mutex_lock(&scan->mutex);
+            stream->count    = 1;
+            stream->finished = !more;
+        } else {
+            pthread_cond_wait(&scan->changed, &scan->mutex);
+        }
+    }
+    pthread_mutex_unlock(&scan->mutex);
+    return row;
+}
+
+/* The id predicate's bounds; false when it can match nothing */
+static bool id_range(WhereClause* where, uint32_t* low, uint32_t* high) {
+    *low  = 0;
+    *high = UINT32_MAX;
+    if (!where->present || where->column != COLUMN_ID) {
+        return true;
+    }
+    switch (where->op) {
+        case COMPARE_EQUAL:
+            *low  = where->id;
+            *high = where->id;
+            return true;
+        case COMPARE_LESS:
+            *high = where->id - 1;
+            return where->id > 0;
+        case COMPARE_LESS_EQUAL:
+            *high = where->id;
+            return true;
+        case COMPARE_GREATER:
+            *low = where->id + 1;
+            return where->id < UINT32_MAX;
+        case COMPARE_GREATER_EQUAL:
+            *low = where->id;
+            return true;
+        default:
+            return true;
+    }
+}
+
+static void shard_scan_free(ShardScan* scan) {
+    for (uint32_t i = 0; i < scan->num_streams; i++) {
+        free(scan->streams[i].batches);
+    }
+    free(scan->streams);
+    free(scan->row);
+    free(scan);
+}
+
+/* Every buffer is allocated before any thread starts, so a failure has nothing to stop */
+ShardScan* shard_scan_open(ShardSet* set, Statement* statement) {
+    ShardScan* scan = calloc(1, sizeof(ShardScan));
+    if (scan == NULL) {
+        return NULL;
+    }
+    scan->set      = set;
+    scan->order_by = statement->order_by;
+    scan->limit    = statement->limit;
+    scan->streams  = calloc(set->num_shards, sizeof(ShardStream));
+    scan->row      = malloc(ROW_SIZE);
+    if (scan->streams == NULL || scan->row == NULL) {
+        shard_scan_free(scan);
+        return NULL;
+    }
+
+    uint32_t low;
+    uint32_t high;
+    if (id_range(&statement->where, &low, &high)) {
+        for (uint32_t i = 0; i < set->num_shards; i++) {
+            if (set->shards[i].lower_bound <= high && shard_upper_bound(set, i) >= low) {
+                ShardStream* stream = &scan->streams[scan->num_streams++];
+                stream->owner       = scan;
+                stream->table       = set->shards[i].table;
+                stream->statement   = *statement;
+            }
+        }
+    }
+
+    bool     threaded = scan->num_streams > 1;
+    uint32_t slots    = threaded ? SHARD_QUEUE_BATCHES : 1;
+    for (uint32_t i = 0; i < scan->num_streams; i++) {
+        scan->streams[i].batches  = malloc((size_t) slots * SHARD_BATCH_ROWS * ROW_SIZE);
+        scan->streams[i].threaded = threaded;
+        if (scan->streams[i].batches == NULL) {
+            shard_scan_free(scan);
+            return NULL;
+        }
+    }
+
+    pthread_mutex_init(&scan->mutex, NULL);
+    pthread_cond_init(&scan->changed, NULL);
+    set->open_scans++;
+    for (uint32_t i = 0; i < scan->num_streams; i++) {
+        ShardStream* stream = &scan->streams[i];
+        if (threaded && pthread_create(&stream->thread, NULL, shard_stream_main, stream) != 0) {
+            printf("Unable to start a shard scan thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return scan;
+}
+
+/* Order by's order, ties by ascending id as the sorter breaks them */
+static bool row_before(OrderBy* order_by, const char* a, const char* b) {
+    uint32_t offset     = order_by->column == COLUMN_USERNAME ? USERNAME_OFFSET : EMAIL_OFFSET;
+    int      comparison = strcmp(a + offset, b + offset);
+    if (comparison != 0) {
+        return order_by->descending ? comparison > 0 : comparison < 0;
+    }
+    uint32_t a_id;
+    uint32_t b_id;
+    memcpy(&a_id, a + ID_OFFSET, sizeof(a_id));
+    memcpy(&b_id, b + ID_OFFSET, sizeof(b_id));
+    return a_id < b_id;
+}
+
+void* shard_scan_next(ShardScan* scan) {
+    if (scan->returned >= scan->limit) {
+        return NULL;
+    }
+    ShardStream* best     = NULL;
+    char*        best_row = NULL;
+    if (!scan->order_by.present) {
+        while (scan->next_stream < scan->num_streams) {
+            best     = &scan->streams[scan->next_stream];
+            best_row = shard_stream_peek(scan, best);
+            if (best_row != NULL) {
+                break;
+            }
+            scan->next_stream++;
+        }
+    } else {
+        for (uint32_t i = 0; i < scan->num_streams; i++) {
+            char* row = shard_stream_peek(scan, &scan->streams[i]);
+            if (row != NULL && (best_row == NULL || row_before(&scan->order_by, row, best_row))) {
+                best     = &scan->streams[i];
+                best_row = row;
+            }
+        }
+    }
+    if (best_row == NULL || scan->failed) {
+        return NULL;
+    }
+    memcpy(scan->row, best_row, ROW_SIZE);
+    best->position++;
+    scan->returned++;
+    return scan->row;
+}
+
+bool shard_scan_failed(ShardScan* scan) {
+    return scan->failed;
+}
+
+void shard_scan_close(ShardScan* scan) {
+    pthread_mutex_lock(&scan->mutex);
+    scan->stopping = true;
+    pthread_cond_broadcast(&scan->changed);
+    pthread_mutex_unlock(&scan->mutex);
+
+    for (uint32_t i = 0; i < scan->num_streams; i++) {
+        ShardStream* stream = &scan->streams[i];
+        if (stream->threaded) {
+            pthread_join(stream->thread, NULL);
+        }
+        if (stream->opened) {
+            pager_begin(stream->table->pager, true);
+            scan_close(&stream->scan);
+            pager_end(stream->table->pager);
+        }
+    }
+    scan->set->open_scans--;
+    pthread_cond_destroy(&scan->changed);
+    pthread_mutex_destroy(&scan->mutex);
+    shard_scan_free(scan);
+}
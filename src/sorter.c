@@ -0,0 +1,421 @@
+#include "sorter.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define SORT_ENTRY_HEADER_SIZE offsetof(SortEntry, key)
+
+/* Bytes a tuple takes in the arena, padded so the next one stays aligned */
+static size_t sort_entry_size(uint32_t length) {
+    size_t alignment = _Alignof(SortEntry);
+    return (SORT_ENTRY_HEADER_SIZE + length + alignment - 1) & ~(alignment - 1);
+}
+
+static int compare_keys(const SortEntry* a, const SortEntry* b) {
+    uint16_t length     = a->length < b->length ? a->length : b->length;
+    int      comparison = memcmp(a->key, b->key, length);
+    if (comparison != 0) {
+        return comparison;
+    }
+    return (a->length > b->length) - (a->length < b->length);
+}
+
+/* Key order, flipped for desc; ties always go by ascending id */
+static int compare_entries(bool descending, const SortEntry* a, const SortEntry* b) {
+    int comparison = descending ? compare_keys(b, a) : compare_keys(a, b);
+    if (comparison != 0) {
+        return comparison;
+    }
+    return (a->id > b->id) - (a->id < b->id);
+}
+
+static int compare_ascending(const void* a, const void* b) {
+    return compare_entries(false, *(SortEntry* const*) a, *(SortEntry* const*) b);
+}
+
+static int compare_descending(const void* a, const void* b) {
+    return compare_entries(true, *(SortEntry* const*) a, *(SortEntry* const*) b);
+}
+
+static void sorter_sort_entries(Sorter* sorter) {
+    qsort(sorter->entries, sorter->num_entries, sizeof(SortEntry*),
+          sorter->descending ? compare_descending : compare_ascending);
+}
+
+static FILE* sorter_run_file(void) {
+    FILE* file = tmpfile();
+    if (file == NULL) {
+        printf("Unable to create a sort run file\n");
+        exit(EXIT_FAILURE);
+    }
+    return file;
+}
+
+static void sorter_write_entry(FILE* file, SortEntry* entry) {
+    if (fwrite(entry, SORT_ENTRY_HEADER_SIZE + entry->length, 1, file) != 1) {
+        printf("Error writing sort run\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static bool sorter_read_entry(FILE* file, SortEntry* entry) {
+    if (fread(entry, SORT_ENTRY_HEADER_SIZE, 1, file) != 1) {
+        return false;
+    }
+    if (entry->length > 0 && fread(entry->key, entry->length, 1, file) != 1) {
+        printf("Error reading sort run\n");
+        exit(EXIT_FAILURE);
+    }
+    return true;
+}
+
+/*
+ * `size` bytes of arena for one tuple, or NULL. Without top-K the arena stops
+ * at the budget, which leaves `failed` clear for the caller to spill; a chunk
+ * that cannot be allocated sets it.
+ */
+static SortEntry* sorter_reserve(Sorter* sorter, size_t size) {
+    while (sorter->chunk == NULL || sorter->chunk_used + size > sorter->chunk->size) {
+        if (sorter->chunk != NULL && sorter->chunk->next != NULL) {
+            sorter->chunk      = sorter->chunk->next;
+            sorter->chunk_used = 0;
+            continue;
+        }
+        size_t chunk_size = sorter->arena_size > SORTER_CHUNK_SIZE ? sorter->arena_size
+                                                                  : SORTER_CHUNK_SIZE;
+        if (!sorter->top_k) {
+            size_t room = sorter->budget - sorter->arena_size;
+            if (room < size) {
+                return NULL;
+            }
+            chunk_size = chunk_size < room ? chunk_size : room;
+        }
+        chunk_size       = chunk_size > size ? chunk_size : size;
+        SortChunk* chunk = malloc(sizeof(SortChunk) + chunk_size);
+        if (chunk == NULL) {
+            sorter->failed = true;
+            return NULL;
+        }
+        chunk->next = NULL;
+        chunk->size = chunk_size;
+        if (sorter->chunk == NULL) {
+            sorter->chunks = chunk;
+        } else {
+            sorter->chunk->next = chunk;
+        }
+        sorter->chunk       = chunk;
+        sorter->chunk_used  = 0;
+        sorter->arena_size += chunk_size;
+    }
+    SortEntry* entry = (SortEntry*) (sorter->chunk->data + sorter->chunk_used);
+    sorter->chunk_used += size;
+    return entry;
+}
+
+/* Room for one more entry pointer */
+static bool sorter_reserve_entry(Sorter* sorter) {
+    if (sorter->num_entries < sorter->entries_capacity) {
+        return true;
+    }
+    uint32_t    capacity = sorter->entries_capacity ? sorter->entries_capacity * 2 : 1024;
+    SortEntry** entries  = realloc(sorter->entries, (size_t) capacity * sizeof(SortEntry*));
+    if (entries == NULL) {
+        sorter->failed = true;
+        return false;
+    }
+    sorter->entries          = entries;
+    sorter->entries_capacity = capacity;
+    return true;
+}
+
+/* Sorts the arena's batch into a new run file and empties the arena for reuse */
+static bool sorter_spill(Sorter* sorter) {
+    FILE** runs = realloc(sorter->runs, (sorter->num_runs + 1) * sizeof(FILE*));
+    if (runs == NULL) {
+        sorter->failed = true;
+        return false;
+    }
+    sorter->runs = runs;
+
+    sorter_sort_entries(sorter);
+    FILE* file = sorter_run_file();
+    for (uint32_t i = 0; i < sorter->num_entries; i++) {
+        sorter_write_entry(file, sorter->entries[i]);
+    }
+
+    sorter->runs[sorter->num_runs++] = file;
+    sorter->total_runs++;
+    sorter->num_entries = 0;
+    sorter->chunk       = sorter->chunks;
+    sorter->chunk_used  = 0;
+    return true;
+}
+
+/* Top-K heap: the root is the worst of the best K seen so far */
+static void top_k_sift_down(Sorter* sorter, uint32_t index) {
+    SortEntry** heap = sorter->entries;
+    while (true) {
+        uint32_t worst = index;
+        uint32_t left  = 2 * index + 1;
+        uint32_t right = left + 1;
+        if (left < sorter->num_entries &&
+            compare_entries(sorter->descending, heap[left], heap[worst]) > 0) {
+            worst = left;
+        }
+        if (right < sorter->num_entries &&
+            compare_entries(sorter->descending, heap[right], heap[worst]) > 0) {
+            worst = right;
+        }
+        if (worst == index) {
+            return;
+        }
+        SortEntry* swap = heap[index];
+        heap[index]     = heap[worst];
+        heap[worst]     = swap;
+        index           = worst;
+    }
+}
+
+static bool sorter_add_top_k(Sorter* sorter, const char* key, uint16_t length, uint32_t id) {
+    if (sorter->limit == 0) {
+        return true;
+    }
+    SortEntry* candidate = sorter->scratch;
+    candidate->id        = id;
+    candidate->length    = length;
+    memcpy(candidate->key, key, length);
+
+    if (sorter->num_entries < sorter->limit) {
+        /* Still filling: keep every tuple in a slot of its own, and heapify once all K are in */
+        SortEntry* scratch = sorter_reserve(sorter, sort_entry_size(sorter->key_size));
+        if (scratch == NULL || !sorter_reserve_entry(sorter)) {
+            sorter->failed = true;
+            return false;
+        }
+        sorter->scratch                        = scratch;
+        sorter->entries[sorter->num_entries++] = candidate;
+        if (sorter->num_entries == sorter->limit) {
+            for (uint32_t i = sorter->num_entries / 2; i-- > 0;) {
+                top_k_sift_down(sorter, i);
+            }
+        }
+        return true;
+    }
+    if (compare_entries(sorter->descending, candidate, sorter->entries[0]) >= 0) {
+        return true;
+    }
+    sorter->scratch    = sorter->entries[0];
+    sorter->entries[0] = candidate;
+    top_k_sift_down(sorter, 0);
+    return true;
+}
+
+Sorter* sorter_create(uint32_t key_size, bool descending, uint32_t limit, size_t budget) {
+    Sorter* sorter = calloc(1, sizeof(Sorter));
+    if (sorter == NULL) {
+        return NULL;
+    }
+    sorter->key_size   = key_size;
+    sorter->descending = descending;
+    sorter->limit      = limit;
+    sorter->budget     = budget < SORTER_MIN_BUDGET ? SORTER_MIN_BUDGET : budget;
+
+    /* K fixed-size slots plus the scratch one, if they fit the budget */
+    size_t slot_size = sort_entry_size(key_size);
+    sorter->top_k    = limit != SORTER_NO_LIMIT &&
+                    ((size_t) limit + 1) * (slot_size + sizeof(SortEntry*)) <= sorter->budget;
+
+    /* Slots are taken as the heap fills, so a large K costs nothing until rows arrive */
+    if (sorter->top_k) {
+        sorter->scratch = sorter_reserve(sorter, slot_size);
+        if (sorter->scratch == NULL) {
+            sorter_destroy(sorter);
+            return NULL;
+        }
+    }
+    return sorter;
+}
+
+bool sorter_add(Sorter* sorter, const char* key, uint32_t id) {
+    const char* end    = memchr(key, '\0', sorter->key_size);
+    uint16_t    length = end != NULL ? (uint16_t) (end - key) : (uint16_t) sorter->key_size;
+    if (sorter->top_k) {
+        return sorter_add_top_k(sorter, key, length, id);
+    }
+
+    size_t     size  = sort_entry_size(length);
+    SortEntry* entry = sorter_reserve(sorter, size);
+    if (entry == NULL && !sorter->failed && sorter_spill(sorter)) {
+        entry = sorter_reserve(sorter, size);
+    }
+    if (entry == NULL || !sorter_reserve_entry(sorter)) {
+        sorter->failed = true;
+        return false;
+    }
+
+    entry->id     = id;
+    entry->length = length;
+    memcpy(entry->key, key, length);
+    sorter->entries[sorter->num_entries++] = entry;
+    return true;
+}
+
+/* Merge heap: the root is the run whose head comes out next */
+static void merge_sift_down(Sorter* sorter, uint32_t index) {
+    SortRun* heap = sorter->merge;
+    while (true) {
+        uint32_t first = index;
+        uint32_t left  = 2 * index + 1;
+        uint32_t right = left + 1;
+        if (left < sorter->merge_size &&
+            compare_entries(sorter->descending, heap[left].head, heap[first].head) < 0) {
+            first = left;
+        }
+        if (right < sorter->merge_size &&
+            compare_entries(sorter->descending, heap[right].head, heap[first].head) < 0) {
+            first = right;
+        }
+        if (first == index) {
+            return;
+        }
+        SortRun swap = heap[index];
+        heap[index]  = heap[first];
+        heap[first]  = swap;
+        index        = first;
+    }
+}
+
+/*
+ * Takes ownership of the files and loads each one's first tuple. Everything
+ * is allocated before any file is taken, so on failure they are all still
+ * the caller's.
+ */
+static bool merge_open(Sorter* sorter, FILE** files, uint32_t count) {
+    SortRun* merge = malloc(count * sizeof(SortRun));
+    uint32_t heads = 0;
+    while (merge != NULL && heads < count &&
+           (merge[heads].head = malloc(sort_entry_size(sorter->key_size))) != NULL) {
+        heads++;
+    }
+    if (heads < count) {
+        for (uint32_t i = 0; merge != NULL && i < heads; i++) {
+            free(merge[i].head);
+        }
+        free(merge);
+        sorter->failed = true;
+        return false;
+    }
+
+    sorter->merge      = merge;
+    sorter->merge_size = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        /* Runs that turn out empty are dropped, so later ones slide into freed places */
+        SortEntry* head = merge[i].head;
+        SortRun*   run  = &merge[sorter->merge_size];
+        run->file       = files[i];
+        run->head       = head;
+        rewind(run->file);
+        if (sorter_read_entry(run->file, run->head)) {
+            sorter->merge_size++;
+        } else {
+            fclose(run->file);
+            free(run->head);
+        }
+    }
+    for (uint32_t i = sorter->merge_size / 2; i-- > 0;) {
+        merge_sift_down(sorter, i);
+    }
+    return true;
+}
+
+/* Replaces the root's head with the next tuple of its run, dropping the run at its end */
+static void merge_advance(Sorter* sorter) {
+    SortRun* root = &sorter->merge[0];
+    if (!sorter_read_entry(root->file, root->head)) {
+        fclose(root->file);
+        free(root->head);
+        *root = sorter->merge[--sorter->merge_size];
+    }
+    merge_sift_down(sorter, 0);
+}
+
+static void merge_close(Sorter* sorter) {
+    for (uint32_t i = 0; i < sorter->merge_size; i++) {
+        fclose(sorter->merge[i].file);
+        free(sorter->merge[i].head);
+    }
+    free(sorter->merge);
+    sorter->merge      = NULL;
+    sorter->merge_size = 0;
+}
+
+bool sorter_finish(Sorter* sorter) {
+    sorter->finished = true;
+    if (sorter->num_runs == 0) {
+        sorter_sort_entries(sorter);
+        return true;
+    }
+    if (sorter->num_entries > 0 && !sorter_spill(sorter)) {
+        return false;
+    }
+
+    /* Too many runs to hold open at once: fold the oldest into one until they fit */
+    while (sorter->num_runs > SORTER_MAX_FAN_IN) {
+        if (!merge_open(sorter, sorter->runs, SORTER_MAX_FAN_IN)) {
+            return false;
+        }
+        FILE* merged = sorter_run_file();
+        while (sorter->merge_size > 0) {
+            sorter_write_entry(merged, sorter->merge[0].head);
+            merge_advance(sorter);
+        }
+        merge_close(sorter);
+
+        sorter->num_runs -= SORTER_MAX_FAN_IN;
+        memmove(sorter->runs, sorter->runs + SORTER_MAX_FAN_IN, sorter->num_runs * sizeof(FILE*));
+        sorter->runs[sorter->num_runs++] = merged;
+        sorter->total_runs++;
+    }
+    if (!merge_open(sorter, sorter->runs, sorter->num_runs)) {
+        return false;
+    }
+    sorter->num_runs = 0;
+    return true;
+}
+
+bool sorter_next(Sorter* sorter, uint32_t* id) {
+    if (sorter->emitted >= sorter->limit) {
+        return false;
+    }
+    if (sorter->merge != NULL) {
+        if (sorter->merge_size == 0) {
+            return false;
+        }
+        *id = sorter->merge[0].head->id;
+        merge_advance(sorter);
+    } else {
+        if (sorter->next_entry >= sorter->num_entries) {
+            return false;
+        }
+        *id = sorter->entries[sorter->next_entry++]->id;
+    }
+    sorter->emitted++;
+    return true;
+}
+
+void sorter_destroy(Sorter* sorter) {
+    if (sorter == NULL) {
+        return;
+    }
+    merge_close(sorter);
+    for (uint32_t i = 0; i < sorter->num_runs; i++) {
+        fclose(sorter->runs[i]);
+    }
+    free(sorter->runs);
+    free(sorter->entries);
+    while (sorter->chunks != NULL) {
+        SortChunk* next = sorter->chunks->next;
+        free(sorter->chunks);
+        sorter->chunks = next;
+    }
+    free(sorter);
+}
@@ -1,32 +1,329 @@
 #include "statement.h"
+#include "checkpoint.h"
+#include "columnar.h"
+#include "defrag.h"
+#include "profile.h"
+#include "replication.h"
+#include "string_match.h"
+#include "warmup.h"
+#include <ctype.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-MetaCommandResult execute_meta_command(InputBuffer* input_buffer, Table* table) {
-    if (strcmp(input_buffer->buffer, ".exit") == 0) {
-        close_input_buffer(input_buffer);
-        db_close(table);
-        exit(EXIT_SUCCESS);
-    } else if (strcmp(input_buffer->buffer, ".btree") == 0) {
+/* A whole decimal number no larger than `max`, where atoi would take "12abc" or wrap */
+bool parse_count(const char* text, unsigned long max, unsigned long* value) {
+    char* end;
+    if (!isdigit((unsigned char) text[0])) {
+        return false;
+    }
+    errno  = 0;
+    *value = strtoul(text, &end, 10);
+    return *end == '\0' && errno == 0 && *value <= max;
+}
+
+/* .checkpoint runs one now; .checkpoint on [interval_ms [dirty_percent]] | off drives the thread */
+static MetaCommandResult execute_checkpoint_command(const char* command, Pager* pager) {
+    char buffer[64];
+    if (strlen(command) >= sizeof(buffer)) {
+        return META_COMMAND_UNRECOGNIZED_COMMAND;
+    }
+    strcpy(buffer, command);
+    strtok(buffer, " "); // skip ".checkpoint"
+    char* mode          = strtok(NULL, " ");
+    char* interval      = strtok(NULL, " ");
+    char* dirty_percent = strtok(NULL, " ");
+
+    if (mode == NULL) {
+        printf("Checkpointed %u pages.\n", checkpoint(pager));
+        return META_COMMAND_SUCCESS;
+    }
+    if (strcmp(mode, "off") == 0 && interval == NULL) {
+        checkpointer_stop(pager);
+        return META_COMMAND_SUCCESS;
+    }
+    if (strcmp(mode, "on") != 0 || strtok(NULL, " ") != NULL) {
+        return META_COMMAND_UNRECOGNIZED_COMMAND;
+    }
+
+    unsigned long interval_ms = CHECKPOINT_DEFAULT_INTERVAL_MS;
+    unsigned long percent     = CHECKPOINT_DEFAULT_DIRTY_PERCENT;
+    if ((interval != NULL && !parse_count(interval, UINT32_MAX, &interval_ms)) ||
+        (dirty_percent != NULL && !parse_count(dirty_percent, 100, &percent)) ||
+        interval_ms == 0 || percent == 0) {
+        return META_COMMAND_UNRECOGNIZED_COMMAND;
+    }
+    checkpointer_start(pager, interval_ms, percent);
+    return META_COMMAND_SUCCESS;
+}
+
+/*
+ * .defrag clusters every leaf now, .defrag status only counts, and
+ * .defrag on [interval_ms] [pages] | off runs it a few pages at a time in
+ * the background, which .defrag wait blocks on until it has caught up. A
+ * pass waits for no select, so it refuses while one is open.
+ */
+static MetaCommandResult execute_defrag_command(const char* command, Table* table) {
+    char buffer[64];
+    if (strlen(command) >= sizeof(buffer)) {
+        return META_COMMAND_UNRECOGNIZED_COMMAND;
+    }
+    strcpy(buffer, command);
+    strtok(buffer, " "); // skip ".defrag"
+    char* mode     = strtok(NULL, " ");
+    char* interval = strtok(NULL, " ");
+    char* pages    = strtok(NULL, " ");
+
+    if (mode == NULL || (strcmp(mode, "status") == 0 && interval == NULL)) {
+        bool measure = mode != NULL;
+        pager_begin(table->pager, measure);
+        if (!measure && table->open_scans > 0) {
+            pager_end(table->pager);
+            printf("Error: A select is still open.\n");
+            return META_COMMAND_SUCCESS;
+        }
+        DefragResult result = defrag(table, measure ? 0 : DEFRAG_ALL_PAGES);
+        pager_end(table->pager);
+        if (result.failed) {
+            printf("Error: Not enough memory to walk the tree.\n");
+            return META_COMMAND_SUCCESS;
+        }
+        if (!measure) {
+            printf("Moved %u pages. ", result.moved);
+        }
+        printf("%u leaves in %u runs.\n", result.leaves, result.runs);
+        return META_COMMAND_SUCCESS;
+    }
+    if (strcmp(mode, "off") == 0 && interval == NULL) {
+        defragger_stop(table);
+        return META_COMMAND_SUCCESS;
+    }
+    if (strcmp(mode, "wait") == 0 && interval == NULL) {
+        defragger_wait(table);
+        return META_COMMAND_SUCCESS;
+    }
+    if (strcmp(mode, "on") != 0 || strtok(NULL, " ") != NULL) {
+        return META_COMMAND_UNRECOGNIZED_COMMAND;
+    }
+
+    unsigned long interval_ms = DEFRAG_DEFAULT_INTERVAL_MS;
+    unsigned long batch       = DEFRAG_DEFAULT_PAGES;
+    if ((interval != NULL && !parse_count(interval, UINT32_MAX, &interval_ms)) ||
+        (pages != NULL && !parse_count(pages, UINT32_MAX, &batch)) || interval_ms == 0 ||
+        batch == 0) {
+        return META_COMMAND_UNRECOGNIZED_COMMAND;
+    }
+    defragger_start(table, interval_ms, batch);
+    return META_COMMAND_SUCCESS;
+}
+
+/* .export <file> writes every row as a columnar stream; .import <file> inserts one */
+static MetaCommandResult execute_columnar_command(const char* command, Table* table) {
+    bool        import = strncmp(command, ".import ", 8) == 0;
+    const char* path   = command + 8;
+    if (*path == '\0') {
+        return META_COMMAND_UNRECOGNIZED_COMMAND;
+    }
+
+    uint32_t       num_rows;
+    uint32_t       num_duplicates = 0;
+    ColumnarResult result;
+    pager_begin(table->pager, !import);
+    if (import) {
+        result = columnar_import(table, path, &num_rows, &num_duplicates);
+    } else {
+        result = columnar_export(table, path, &num_rows);
+    }
+    pager_end(table->pager);
+
+    if (result == COLUMNAR_IO_ERROR) {
+        printf("Unable to %s %s\n", import ? "read" : "write", path);
+    } else if (result == COLUMNAR_BAD_FORMAT) {
+        printf("Not a cqlite columnar file: %s\n", path);
+    } else if (result == COLUMNAR_NO_MEMORY) {
+        printf("Error: Not enough memory.\n");
+    } else if (result == COLUMNAR_TABLE_FULL) {
+        printf("Error: Table full.\n");
+    } else if (result == COLUMNAR_LOG_FAILED) {
+        printf("Error: Unable to write the replication log.\n");
+    }
+    if (result != COLUMNAR_IO_ERROR && result != COLUMNAR_NO_MEMORY) {
+        printf("%s %u rows.\n", import ? "Imported" : "Exported", num_rows);
+    }
+    if (num_duplicates > 0) {
+        printf("Skipped %u duplicate keys.\n", num_duplicates);
+    }
+    return META_COMMAND_SUCCESS;
+}
+
+/*
+ * .replication reports the LSN and lag; .replication wait [lsn] first blocks
+ * until a follower has applied that LSN, or caught up with the primary. Both
+ * run outside the pager lock, which the follower's applier needs.
+ */
+static MetaCommandResult execute_replication_command(const char* command, Table* table) {
+    const char* argument = command + 12;
+    if (strncmp(argument, " wait", 5) == 0 && (argument[5] == '\0' || argument[5] == ' ')) {
+        replication_wait(table, strtoull(argument + 5, NULL, 10));
+    } else if (*argument != '\0') {
+        return META_COMMAND_UNRECOGNIZED_COMMAND;
+    }
+    replication_print_status(table);
+    return META_COMMAND_SUCCESS;
+}
+
+/*
+ * .profile on | off | reset, or on its own the breakdown by phase of every
+ * statement since it was turned on or reset. Profiling is per handle and
+ * costs nothing but a branch per hook while off.
+ */
+static MetaCommandResult execute_profile_command(const char* command, Table* table) {
+    const char* argument = command + 8;
+    if (strcmp(argument, " on") == 0) {
+        if (table->profile == NULL) {
+            table->profile = profile_open();
+        }
+        switch (profile_source(table->profile)) {
+            case PROFILE_HARDWARE:
+                printf("Profiling with hardware counters.\n");
+                break;
+            case PROFILE_SOFTWARE:
+                printf("Profiling with software counters; hardware counters unavailable.\n");
+                break;
+            case PROFILE_RUSAGE:
+                printf("Profiling with getrusage; perf events unavailable.\n");
+                break;
+        }
+    } else if (strcmp(argument, " off") == 0) {
+        profile_close(table->profile);
+        table->profile = NULL;
+    } else if (strcmp(argument, " reset") == 0) {
+        if (table->profile != NULL) {
+            profile_reset(table->profile);
+        }
+    } else if (*argument != '\0') {
+        return META_COMMAND_UNRECOGNIZED_COMMAND;
+    } else if (table->profile == NULL) {
+        printf("Profile: off.\n");
+    } else {
+        profile_print(table->profile);
+    }
+    return META_COMMAND_SUCCESS;
+}
+
+/* Commands that only look at pages run as a read-only section of the pager */
+static MetaCommandResult execute_inspect_command(const char* command, Table* table) {
+    if (strcmp(command, ".btree") == 0) {
         printf("Tree:\n");
-        print_tree(table->pager, 0, 0);
+        print_tree(table->pager, table->root_page_num, 0);
         return META_COMMAND_SUCCESS;
-    } else if (strcmp(input_buffer->buffer, ".constants") == 0) {
+    } else if (strcmp(command, ".constants") == 0) {
         printf("Constants:\n");
-        print_constants();
+        print_constants(table->pager);
         return META_COMMAND_SUCCESS;
-    } else if (strcmp(input_buffer->buffer, ".printstats") == 0) {
+    } else if (strcmp(command, ".printstats") == 0) {
         print_btree_stats(table->pager, table->root_page_num);
         return META_COMMAND_SUCCESS;
+    } else if (strcmp(command, ".stats") == 0 || strcmp(command, ".stats json") == 0) {
+        print_stats(table, strcmp(command, ".stats json") == 0);
+        return META_COMMAND_SUCCESS;
+    } else if (strcmp(command, ".stats reset") == 0) {
+        reset_stats(table);
+        return META_COMMAND_SUCCESS;
+    } else if (strcmp(command, ".latency") == 0) {
+        print_latency(table);
+        return META_COMMAND_SUCCESS;
+    } else if (strcmp(command, ".latency reset") == 0) {
+        reset_latency(table);
+        return META_COMMAND_SUCCESS;
+    } else if (strncmp(command, ".sort_budget ", 13) == 0) {
+        /* In KiB; order by spills sorted runs to temp files past this */
+        unsigned long budget_kib;
+        if (!parse_count(command + 13, SORTER_MAX_BUDGET / 1024, &budget_kib) || budget_kib == 0) {
+            return META_COMMAND_UNRECOGNIZED_COMMAND;
+        }
+        table->sort_budget = (size_t) budget_kib * 1024;
+        return META_COMMAND_SUCCESS;
     } else {
         return META_COMMAND_UNRECOGNIZED_COMMAND;
     }
 }
 
-static PrepareResult prepare_insert(InputBuffer* input_buffer, Statement* statement) {
+/* .memtable <rows> | on | off sizes the insert buffer; rows already in it are merged first */
+static bool execute_memtable_command(const char* command, Table* table) {
+    const char*   size = command + 10;
+    unsigned long capacity;
+    if (strcmp(size, "off") == 0) {
+        capacity = 0;
+    } else if (strcmp(size, "on") == 0) {
+        capacity = MEMTABLE_DEFAULT_CAPACITY;
+    } else if (!parse_count(size, MEMTABLE_MAX_CAPACITY, &capacity) || capacity == 0) {
+        return false;
+    }
+    if (!memtable_resize(&table->memtable, capacity)) {
+        printf("Error: Not enough memory for a memtable of %lu rows.\n", capacity);
+    }
+    return true;
+}
+
+MetaCommandResult execute_meta_command(const char* command, Table* table) {
+    /* Commands see the tree on its own, so buffered inserts go into it first */
+    if (table->memtable.num_rows > 0) {
+        pager_begin(table->pager, false);
+        table_merge_memtable(table);
+        pager_end(table->pager);
+    }
+    if (strncmp(command, ".memtable ", 10) == 0) {
+        return execute_memtable_command(command, table) ? META_COMMAND_SUCCESS
+                                                        : META_COMMAND_UNRECOGNIZED_COMMAND;
+    }
+    if (strncmp(command, ".checkpoint", 11) == 0 && (command[11] == '\0' || command[11] == ' ')) {
+        return execute_checkpoint_command(command, table->pager);
+    }
+    /* .warmup waits for the preload from the last session's cached pages to finish */
+    if (strcmp(command, ".warmup") == 0) {
+        printf("Warmed %u pages.\n", warmup_wait(table->pager));
+        return META_COMMAND_SUCCESS;
+    }
+    if (strncmp(command, ".replication", 12) == 0) {
+        return execute_replication_command(command, table);
+    }
+    if (strncmp(command, ".defrag", 7) == 0 && (command[7] == '\0' || command[7] == ' ')) {
+        return execute_defrag_command(command, table);
+    }
+    if (strncmp(command, ".profile", 8) == 0) {
+        return execute_profile_command(command, table);
+    }
+    if (strncmp(command, ".import ", 8) == 0 && replication_is_follower(table)) {
+        printf("Error: Read-only replica.\n");
+        return META_COMMAND_SUCCESS;
+    }
+    if (strncmp(command, ".export ", 8) == 0 || strncmp(command, ".import ", 8) == 0) {
+        return execute_columnar_command(command, table);
+    }
+
+    pager_begin(table->pager, true);
+    MetaCommandResult result = execute_inspect_command(command, table);
+    pager_end(table->pager);
+    return result;
+}
+
+/*
+ * A `?` in place of a value leaves it to be bound later; the slot is
+ * recorded so cqlite_bind_* knows which field the Nth parameter fills.
+ */
+static bool is_placeholder(const char* token, Statement* statement, ParamTarget target) {
+    if (strcmp(token, "?") != 0) {
+        return false;
+    }
+    statement->params[statement->num_params++] = target;
+    return true;
+}
+
+static PrepareResult prepare_insert(char* sql, Statement* statement) {
     statement->type = STATEMENT_INSERT;
-    strtok(input_buffer->buffer, " "); // skip "insert"
+    strtok(sql, " "); // skip "insert"
     char* id_string = strtok(NULL, " ");
     char* username  = strtok(NULL, " ");
     char* email     = strtok(NULL, " ");
@@ -35,72 +332,692 @@ static PrepareResult prepare_insert(InputBuffer* input_buffer, Statement* statem
         return PREPARE_SYNTAX_ERROR;
     }
 
-    int id = atoi(id_string);
-    if (id < 0) {
-        return PREPARE_NEGATIVE_ID;
+    memset(&statement->row_to_insert, 0, sizeof(Row));
+    if (!is_placeholder(id_string, statement, PARAM_INSERT_ID)) {
+        int id = atoi(id_string);
+        if (id < 0) {
+            return PREPARE_NEGATIVE_ID;
+        }
+        statement->row_to_insert.id = id;
+    }
+    if (!is_placeholder(username, statement, PARAM_INSERT_USERNAME)) {
+        if (strlen(username) > COLUMN_USERNAME_SIZE) {
+            return PREPARE_STRING_TOO_LONG;
+        }
+        strcpy(statement->row_to_insert.username, username);
+    }
+    if (!is_placeholder(email, statement, PARAM_INSERT_EMAIL)) {
+        if (strlen(email) > COLUMN_EMAIL_SIZE) {
+            return PREPARE_STRING_TOO_LONG;
+        }
+        strcpy(statement->row_to_insert.email, email);
+    }
+
+    return PREPARE_SUCCESS;
+}
+
+static bool parse_column(const char* token, Column* column) {
+    if (token == NULL) {
+        return false;
+    } else if (strcmp(token, "id") == 0) {
+        *column = COLUMN_ID;
+    } else if (strcmp(token, "username") == 0) {
+        *column = COLUMN_USERNAME;
+    } else if (strcmp(token, "email") == 0) {
+        *column = COLUMN_EMAIL;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool parse_compare_op(const char* token, CompareOp* op) {
+    if (token == NULL) {
+        return false;
+    } else if (strcmp(token, "=") == 0) {
+        *op = COMPARE_EQUAL;
+    } else if (strcmp(token, "<") == 0) {
+        *op = COMPARE_LESS;
+    } else if (strcmp(token, "<=") == 0) {
+        *op = COMPARE_LESS_EQUAL;
+    } else if (strcmp(token, ">") == 0) {
+        *op = COMPARE_GREATER;
+    } else if (strcmp(token, ">=") == 0) {
+        *op = COMPARE_GREATER_EQUAL;
+    } else if (strcmp(token, "contains") == 0) {
+        *op = COMPARE_CONTAINS;
+    } else if (strcmp(token, "like") == 0) {
+        *op = COMPARE_EQUAL; /* until where_set_text reads the pattern */
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/* Strips one pair of surrounding single quotes: 'alice' -> alice */
+static char* unquote(char* token) {
+    size_t length = strlen(token);
+    if (length >= 2 && token[0] == '\'' && token[length - 1] == '\'') {
+        token[length - 1] = '\0';
+        return token + 1;
     }
-    if (strlen(username) > COLUMN_USERNAME_SIZE || strlen(email) > COLUMN_EMAIL_SIZE) {
+    return token;
+}
+
+/*
+ * Stores the value a text column is compared against. Under `like`, 'abc%'
+ * is a prefix match, '%abc%' a substring match and a value without % plain
+ * equality; % anywhere else is not supported.
+ */
+PrepareResult where_set_text(WhereClause* where, const char* value) {
+    size_t length = strlen(value);
+    if (where->like) {
+        where->op = COMPARE_EQUAL;
+        if (length >= 2 && value[0] == '%' && value[length - 1] == '%') {
+            where->op = COMPARE_CONTAINS;
+            value++;
+            length -= 2;
+        } else if (length >= 1 && value[length - 1] == '%') {
+            where->op = COMPARE_PREFIX;
+            length--;
+        }
+        if (memchr(value, '%', length) != NULL) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+    }
+    if (length > COLUMN_EMAIL_SIZE) {
         return PREPARE_STRING_TOO_LONG;
     }
+    memcpy(where->text, value, length);
+    where->text[length] = '\0';
+    where->text_length  = length;
+    return PREPARE_SUCCESS;
+}
+
+/* Parses `<column> <op> <value>`, continuing the caller's strtok */
+static PrepareResult prepare_where(Statement* statement) {
+    WhereClause* where       = &statement->where;
+    char*        column_name = strtok(NULL, " ");
+    char*        op          = strtok(NULL, " ");
+    char*        value       = strtok(NULL, " ");
+
+    if (!parse_column(column_name, &where->column) || !parse_compare_op(op, &where->op) ||
+        value == NULL) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    where->present = true;
+    where->like    = strcmp(op, "like") == 0;
+
+    bool text_only = where->like || where->op == COMPARE_CONTAINS;
+    if (text_only && where->column == COLUMN_ID) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    if (is_placeholder(value, statement, PARAM_WHERE_VALUE)) {
+        return PREPARE_SUCCESS;
+    }
+    if (where->column == COLUMN_ID) {
+        int id = atoi(value);
+        if (id < 0) {
+            return PREPARE_NEGATIVE_ID;
+        }
+        where->id = id;
+        return PREPARE_SUCCESS;
+    }
 
-    statement->row_to_insert.id = id;
-    strcpy(statement->row_to_insert.username, username);
-    strcpy(statement->row_to_insert.email, email);
+    return where_set_text(where, unquote(value));
+}
+
+/* Parses `by <column> [asc|desc]` after "order" and leaves the token after it in *next */
+static PrepareResult prepare_order_by(Statement* statement, char** next) {
+    OrderBy* order_by    = &statement->order_by;
+    char*    by          = strtok(NULL, " ");
+    char*    column_name = strtok(NULL, " ");
 
+    /* Rows already come out in id order */
+    if (by == NULL || strcmp(by, "by") != 0 || !parse_column(column_name, &order_by->column) ||
+        order_by->column == COLUMN_ID) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    order_by->present    = true;
+    order_by->descending = false;
+
+    *next = strtok(NULL, " ");
+    if (*next != NULL && (strcmp(*next, "asc") == 0 || strcmp(*next, "desc") == 0)) {
+        order_by->descending = strcmp(*next, "desc") == 0;
+        *next                = strtok(NULL, " ");
+    }
     return PREPARE_SUCCESS;
 }
 
-PrepareResult prepare_statement(InputBuffer* input_buffer, Statement* statement) {
-    if (strncmp(input_buffer->buffer, "insert", 6) == 0) {
-        return prepare_insert(input_buffer, statement);
+static PrepareResult prepare_limit(Statement* statement) {
+    char* count = strtok(NULL, " ");
+    if (count == NULL) {
+        return PREPARE_SYNTAX_ERROR;
     }
-    if (strcmp(input_buffer->buffer, "select") == 0) {
-        statement->type = STATEMENT_SELECT;
+    if (is_placeholder(count, statement, PARAM_SELECT_LIMIT)) {
         return PREPARE_SUCCESS;
     }
+    if (count[0] == '-') {
+        return PREPARE_NEGATIVE_ID;
+    }
+    /* SORTER_NO_LIMIT itself is reserved for no limit clause */
+    unsigned long limit;
+    if (!parse_count(count, SORTER_NO_LIMIT - 1, &limit)) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    statement->limit = limit;
+    return PREPARE_SUCCESS;
+}
+
+/* select [where <column> <op> <value>] [order by <column> [asc|desc]] [limit <n>] */
+static PrepareResult prepare_select(char* sql, Statement* statement) {
+    statement->type = STATEMENT_SELECT;
+    strtok(sql, " "); // skip "select"
+    char*         keyword = strtok(NULL, " ");
+    PrepareResult result  = PREPARE_SUCCESS;
+
+    if (keyword != NULL && strcmp(keyword, "where") == 0) {
+        result  = prepare_where(statement);
+        keyword = strtok(NULL, " ");
+    }
+    if (result == PREPARE_SUCCESS && keyword != NULL && strcmp(keyword, "order") == 0) {
+        result = prepare_order_by(statement, &keyword);
+    }
+    if (result == PREPARE_SUCCESS && keyword != NULL && strcmp(keyword, "limit") == 0) {
+        result  = prepare_limit(statement);
+        keyword = strtok(NULL, " ");
+    }
+    if (result == PREPARE_SUCCESS && keyword != NULL) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    return result;
+}
+
+/* create index on username|email, or create hash index on id */
+static PrepareResult prepare_create_index(char* sql, Statement* statement) {
+    statement->type       = STATEMENT_CREATE_INDEX;
+    statement->index_type = INDEX_BTREE;
+    strtok(sql, " "); // skip "create"
+    char* keyword = strtok(NULL, " ");
+
+    if (keyword != NULL && strcmp(keyword, "hash") == 0) {
+        statement->index_type = INDEX_HASH;
+        keyword               = strtok(NULL, " ");
+    }
+    char* on_keyword  = strtok(NULL, " ");
+    char* column_name = strtok(NULL, " ");
+
+    if (keyword == NULL || strcmp(keyword, "index") != 0 || on_keyword == NULL ||
+        strcmp(on_keyword, "on") != 0 || !parse_column(column_name, &statement->index_column) ||
+        strtok(NULL, " ") != NULL) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    /* id is already the key of the table tree; the hash only makes sense there */
+    bool on_id = statement->index_column == COLUMN_ID;
+    if (on_id != (statement->index_type == INDEX_HASH)) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    return PREPARE_SUCCESS;
+}
+
+static bool starts_with_keyword(const char* sql, const char* keyword) {
+    size_t length = strlen(keyword);
+    return strncmp(sql, keyword, length) == 0 && (sql[length] == '\0' || sql[length] == ' ');
+}
+
+PrepareResult prepare_statement(char* sql, Statement* statement) {
+    statement->num_params    = 0;
+    statement->where.present    = false;
+    statement->where.like       = false;
+    statement->order_by.present = false;
+    statement->limit            = SORTER_NO_LIMIT;
+    if (strncmp(sql, "insert", 6) == 0) {
+        return prepare_insert(sql, statement);
+    }
+    if (starts_with_keyword(sql, "select")) {
+        return prepare_select(sql, statement);
+    }
+    if (starts_with_keyword(sql, "create")) {
+        return prepare_create_index(sql, statement);
+    }
     return PREPARE_UNRECOGNIZED_STATEMENT;
 }
 
-static ExecuteResult execute_insert(Statement* statement, Table* table) {
-    void*    node          = get_page(table->pager, table->root_page_num);
-    uint32_t num_cells     = (*leaf_node_num_cells(node));
-    Row*     row_to_insert = &statement->row_to_insert;
+static ExecuteResult insert_row(Row* row_to_insert, Table* table) {
     uint32_t key_to_insert = row_to_insert->id;
-    Cursor*  cursor        = table_find(table, key_to_insert);
 
-    if (cursor->cell_num < num_cells) {
-        uint32_t key_at_index = *leaf_node_key(node, cursor->cell_num);
+    /* With a hash index a duplicate is rejected without descending the tree */
+    bool hashed = hash_index_exists(table);
+    if (hashed && hash_index_contains(table, key_to_insert)) {
+        return EXECUTE_DUPLICATE_KEY;
+    }
+
+    /*
+     * Buffered only while no index needs the row's leaf or column right away.
+     * Without memory for the id filter the buffer is merged and the row goes
+     * straight into the tree, so running short only costs speed.
+     */
+    Memtable* memtable = &table->memtable;
+    if (memtable->capacity > 0 && !hashed && !index_exists(table, COLUMN_USERNAME) &&
+        !index_exists(table, COLUMN_EMAIL)) {
+        if (table_buffer_ready(table)) {
+            return table_buffer_row(table, row_to_insert) ? EXECUTE_SUCCESS
+                                                          : EXECUTE_DUPLICATE_KEY;
+        }
+        table_merge_memtable(table);
+    }
+
+    Cursor cursor;
+    table_find(table, key_to_insert, &cursor);
+
+    /* The duplicate can only live in the leaf the cursor landed on, not the root */
+    void*    node      = get_page(table->pager, cursor.page_num);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+
+    if (!hashed && cursor.cell_num < num_cells) {
+        uint32_t key_at_index = *leaf_node_key(node, cursor.cell_num);
         if (key_at_index == key_to_insert) {
             return EXECUTE_DUPLICATE_KEY;
         }
     }
-    leaf_node_insert(cursor, row_to_insert->id, row_to_insert);
-    free(cursor);
+    leaf_node_insert(&cursor, row_to_insert->id, row_to_insert);
+    if (memtable->filter != NULL) {
+        memtable_filter_add(memtable, key_to_insert);
+    }
+
+    if (hashed) {
+        hash_index_insert(table, key_to_insert, cursor.page_num);
+    }
+
+    index_insert_row(table, row_to_insert);
     return EXECUTE_SUCCESS;
 }
 
-static ExecuteResult execute_select(Statement* statement, Table* table) {
-    Row row;
+static bool row_exists(Table* table, uint32_t id) {
+    if (hash_index_exists(table)) {
+        return hash_index_contains(table, id);
+    }
+    if (memtable_find(&table->memtable, id) != NULL) {
+        return true;
+    }
+    Cursor cursor;
+    table_find(table, id, &cursor);
+    void* node = get_page(table->pager, cursor.page_num);
+    return cursor.cell_num < *leaf_node_num_cells(node) &&
+           *leaf_node_key(node, cursor.cell_num) == id;
+}
 
-    Cursor* cursor = table_start(table);
-    (void) statement; // mark as intentionally unused
-    while (!(cursor->end_of_table)) {
-        deserialize_row(cursor_value(cursor), &row);
-        print_row(&row);
-        cursor_advance(cursor);
+/*
+ * A primary checks for the duplicate up front and logs the row before storing
+ * it, so a row it could not log is never stored; the insert then cannot fail.
+ */
+ExecuteResult execute_insert(Statement* statement, Table* table) {
+    if (replication_is_primary(table)) {
+        if (row_exists(table, statement->row_to_insert.id)) {
+            return EXECUTE_DUPLICATE_KEY;
+        }
+        if (!replication_log(table, statement)) {
+            return EXECUTE_LOG_FAILED;
+        }
     }
+    return insert_row(&statement->row_to_insert, table);
+}
 
-    free(cursor);
+static bool index_already_exists(Statement* statement, Table* table) {
+    return statement->index_type == INDEX_HASH ? hash_index_exists(table)
+                                               : index_exists(table, statement->index_column);
+}
+
+static ExecuteResult create_index(Statement* statement, Table* table) {
+    if (index_already_exists(statement, table)) {
+        return EXECUTE_INDEX_EXISTS;
+    }
+
+    /* Indexes are built from the tree and kept in step by every insert from then on */
+    table_merge_memtable(table);
+    if (statement->index_type == INDEX_HASH) {
+        hash_index_create(table);
+    } else {
+        index_create(table, statement->index_column);
+    }
     return EXECUTE_SUCCESS;
 }
 
-ExecuteResult execute_statement(Statement* statement, Table* table) {
-    switch (statement->type) {
-        case STATEMENT_INSERT:
-            return execute_insert(statement, table);
-        case STATEMENT_SELECT:
-            return execute_select(statement, table);
+/* Logged ahead like an insert */
+ExecuteResult execute_create_index(Statement* statement, Table* table) {
+    if (replication_is_primary(table)) {
+        if (index_already_exists(statement, table)) {
+            return EXECUTE_INDEX_EXISTS;
+        }
+        if (!replication_log(table, statement)) {
+            return EXECUTE_LOG_FAILED;
+        }
+    }
+    return create_index(statement, table);
+}
+
+static uint32_t row_id(void* row) {
+    uint32_t id;
+    memcpy(&id, row + ID_OFFSET, sizeof(id));
+    return id;
+}
+
+static bool comparison_matches(CompareOp op, int comparison) {
+    switch (op) {
+        case COMPARE_EQUAL:
+            return comparison == 0;
+        case COMPARE_LESS:
+            return comparison < 0;
+        case COMPARE_LESS_EQUAL:
+            return comparison <= 0;
+        case COMPARE_GREATER:
+            return comparison > 0;
+        case COMPARE_GREATER_EQUAL:
+            return comparison >= 0;
+        default:
+            return false;
+    }
+}
+
+/* Equality, prefix and substring tests run on the column bytes without copying them out */
+static bool text_matches(WhereClause* where, const char* field, uint32_t field_size) {
+    switch (where->op) {
+        case COMPARE_EQUAL:
+            return string_match_equal(field, field_size, where->text, where->text_length);
+        case COMPARE_PREFIX:
+            return string_match_prefix(field, field_size, where->text, where->text_length);
+        case COMPARE_CONTAINS:
+            return string_match_contains(field, field_size, where->text, where->text_length);
+        default:
+            return comparison_matches(where->op, strcmp(field, where->text));
+    }
+}
+
+/* Evaluates the where clause directly against the serialized row */
+static bool row_matches(WhereClause* where, void* row) {
+    if (!where->present) {
+        return true;
+    }
+
+    switch (where->column) {
+        case COLUMN_ID: {
+            uint32_t id = row_id(row);
+            return comparison_matches(where->op, (id > where->id) - (id < where->id));
+        }
+        case COLUMN_USERNAME:
+            return text_matches(where, row + USERNAME_OFFSET, COLUMN_USERNAME_SIZE + 1);
+        case COLUMN_EMAIL:
+            return text_matches(where, row + EMAIL_OFFSET, COLUMN_EMAIL_SIZE + 1);
+    }
+    return false;
+}
+
+/* table_find can leave the cursor one past the last cell of a leaf */
+static void scan_settle_cursor(Scan* scan) {
+    Cursor* cursor = &scan->cursor;
+    void*   node   = get_page(scan->table->pager, cursor->page_num);
+    if (cursor->cell_num < *leaf_node_num_cells(node)) {
+        return;
+    }
+    uint32_t next_page_num = *leaf_node_next_leaf(node);
+    if (next_page_num == 0) {
+        cursor->end_of_table = true;
+    } else {
+        cursor->page_num = next_page_num;
+        cursor->cell_num = 0;
+    }
+}
+
+void scan_open(Scan* scan, Statement* statement, Table* table) {
+    WhereClause* where = &statement->where;
+
+    scan->table     = table;
+    scan->statement = statement;
+    scan->sorter    = NULL;
+    scan->row       = NULL;
+    scan->returned  = 0;
+    scan->done      = false;
+    scan->started   = false;
+    scan->tree_row  = NULL;
+    scan->tree_done = false;
+    scan->counted   = true;
+    scan->failed    = false;
+    table->open_scans++;
+
+    /* Buffered rows below an id range's lower bound can be skipped outright */
+    memtable_sort(&table->memtable);
+    bool lower_bound = where->present && where->column == COLUMN_ID &&
+                       where->op != COMPARE_LESS && where->op != COMPARE_LESS_EQUAL;
+    scan->memtable_next = lower_bound ? memtable_seek(&table->memtable, where->id) : 0;
+
+    if (where->present && where->column == COLUMN_ID) {
+        scan->plan = SCAN_ID_RANGE;
+        if (where->op == COMPARE_EQUAL && hash_index_exists(table)) {
+            /* Point lookup: the range scan stops right after the one row */
+            scan->done = !hash_index_find(table, where->id, &scan->cursor);
+        } else if (where->op == COMPARE_LESS || where->op == COMPARE_LESS_EQUAL) {
+            table_start(table, &scan->cursor);
+        } else {
+            table_find(table, where->id, &scan->cursor);
+            scan_settle_cursor(scan);
+        }
+    } else if (where->present && where->op == COMPARE_EQUAL && index_exists(table, where->column)) {
+        scan->plan = SCAN_INDEX;
+        index_key_init(&scan->index_key, where->text, 0);
+        index_seek(table, where->column, &scan->index_key, &scan->index_cursor);
+    } else {
+        scan->plan = SCAN_FULL;
+        table_start(table, &scan->cursor);
+    }
+}
+
+/* Next candidate row for the plan, or NULL when the plan has nothing left */
+static void* scan_advance(Scan* scan) {
+    bool first    = !scan->started;
+    scan->started = true;
+
+    if (scan->plan != SCAN_INDEX) {
+        if (!first) {
+            cursor_advance(&scan->cursor);
+        }
+        return scan->cursor.end_of_table ? NULL : cursor_value(&scan->cursor);
+    }
+
+    IndexCursor* index_cursor = &scan->index_cursor;
+    if (!first) {
+        index_cursor_advance(index_cursor);
+    }
+    if (index_cursor->end_of_index) {
+        return NULL;
+    }
+    IndexKey* key = index_cursor_key(index_cursor);
+    if (memcmp(key->prefix, scan->index_key.prefix, INDEX_KEY_PREFIX_SIZE) != 0) {
+        return NULL;
+    }
+
+    Cursor cursor;
+    table_find(scan->table, key->id, &cursor);
+    return cursor_value(&cursor);
+}
+
+/* Rows come out of the table tree in id order, so id bounds can end the scan early */
+static bool scan_past_range(Scan* scan, void* row) {
+    WhereClause* where = &scan->statement->where;
+    if (scan->plan != SCAN_ID_RANGE) {
+        return false;
+    }
+    switch (where->op) {
+        case COMPARE_EQUAL:
+        case COMPARE_LESS_EQUAL:
+            return row_id(row) > where->id;
+        case COMPARE_LESS:
+            return row_id(row) >= where->id;
         default:
-            return EXECUTE_SUCCESS;
+            return false;
+    }
+}
+
+/*
+ * A full scan walks each leaf's cells in place, fetching the page once per
+ * leaf instead of once per row, so a selective filter runs at memory speed.
+ */
+static bool scan_next_full(Scan* scan) {
+    Cursor* cursor = &scan->cursor;
+    if (scan->started) {
+        cursor->cell_num++;
+    }
+    scan->started = true;
+
+    while (!scan->done && !cursor->end_of_table) {
+        void*    node      = get_page(scan->table->pager, cursor->page_num);
+        uint32_t num_cells = *leaf_node_num_cells(node);
+        for (; cursor->cell_num < num_cells; cursor->cell_num++) {
+            void* row = leaf_node_value(node, cursor->cell_num);
+            if (row_matches(&scan->statement->where, row)) {
+                scan->row = row;
+                return true;
+            }
+        }
+
+        uint32_t next_page_num = *leaf_node_next_leaf(node);
+        if (next_page_num == 0) {
+            cursor->end_of_table = true;
+        } else {
+            cursor->page_num = next_page_num;
+            cursor->cell_num = 0;
+        }
+    }
+    scan->done = true;
+    scan->row  = NULL;
+    return false;
+}
+
+static bool scan_next_tree_row(Scan* scan) {
+    if (scan->plan == SCAN_FULL) {
+        return scan_next_full(scan);
+    }
+    while (!scan->done) {
+        void* row = scan_advance(scan);
+        if (row == NULL || scan_past_range(scan, row)) {
+            break;
+        }
+        if (row_matches(&scan->statement->where, row)) {
+            scan->row = row;
+            return true;
+        }
+    }
+    scan->done = true;
+    scan->row  = NULL;
+    return false;
+}
+
+/*
+ * Hands out whichever comes first by id: the tree's next matching row, held in
+ * tree_row once read, or the memtable's. Both sides are already in id order.
+ */
+static bool scan_next_row(Scan* scan) {
+    Memtable* memtable = &scan->table->memtable;
+    if (scan->plan == SCAN_INDEX || memtable->num_rows == 0) {
+        return scan_next_tree_row(scan);
+    }
+
+    if (scan->tree_row == NULL && !scan->tree_done) {
+        scan->tree_done = !scan_next_tree_row(scan);
+        scan->tree_row  = scan->row;
+        scan->done      = false;
+    }
+    while (scan->memtable_next < memtable->num_rows) {
+        void* row = memtable_row(memtable, scan->memtable_next);
+        if (scan->tree_row != NULL && row_id(scan->tree_row) < row_id(row)) {
+            break;
+        }
+        if (scan_past_range(scan, row)) {
+            scan->memtable_next = memtable->num_rows;
+            break;
+        }
+        scan->memtable_next++;
+        if (row_matches(&scan->statement->where, row)) {
+            scan->row = row;
+            return true;
+        }
+    }
+    scan->row      = scan->tree_row;
+    scan->tree_row = NULL;
+    return scan->row != NULL;
+}
+
+/*
+ * Drains the plan into a sorter of (column value, id) tuples. Only the ids
+ * come back out, so each sorted row is found again with a descent. False if
+ * the sorter ran out of memory.
+ */
+static bool scan_sort(Scan* scan) {
+    Statement* statement = scan->statement;
+    bool       username  = statement->order_by.column == COLUMN_USERNAME;
+    uint32_t   offset    = username ? USERNAME_OFFSET : EMAIL_OFFSET;
+    uint32_t   key_size  = (username ? COLUMN_USERNAME_SIZE : COLUMN_EMAIL_SIZE) + 1;
+
+    scan->sorter = sorter_create(key_size, statement->order_by.descending, statement->limit,
+                                 scan->table->sort_budget);
+    if (scan->sorter == NULL) {
+        return false;
+    }
+    while (scan_next_row(scan)) {
+        if (!sorter_add(scan->sorter, scan->row + offset, row_id(scan->row))) {
+            return false;
+        }
+    }
+    if (!sorter_finish(scan->sorter)) {
+        return false;
+    }
+    scan->table->stats.sort_runs += scan->sorter->total_runs;
+    scan->done = false;
+    return true;
+}
+
+static bool scan_next_sorted(Scan* scan) {
+    uint32_t id;
+    while (sorter_next(scan->sorter, &id)) {
+        scan->row = memtable_find(&scan->table->memtable, id);
+        if (scan->row != NULL) {
+            return true;
+        }
+        table_find(scan->table, id, &scan->cursor);
+        void* node = get_page(scan->table->pager, scan->cursor.page_num);
+        if (scan->cursor.cell_num < *leaf_node_num_cells(node) &&
+            *leaf_node_key(node, scan->cursor.cell_num) == id) {
+            scan->row = cursor_value(&scan->cursor);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool scan_next(Scan* scan) {
+    if (scan->statement->order_by.present && scan->sorter == NULL && !scan->done &&
+        !scan_sort(scan)) {
+        scan->failed = true;
+        scan->done   = true;
+    }
+    bool found = !scan->done && scan->returned < scan->statement->limit &&
+                 (scan->sorter != NULL ? scan_next_sorted(scan) : scan_next_row(scan));
+    if (!found) {
+        scan_close(scan);
+        return false;
+    }
+    scan->returned++;
+    return true;
+}
+
+/* Called inside a pager section, as the defragger reads open_scans under the lock */
+void scan_close(Scan* scan) {
+    if (scan->counted) {
+        scan->table->open_scans--;
+        scan->counted = false;
     }
+    sorter_destroy(scan->sorter);
+    scan->sorter = NULL;
+    scan->row    = NULL;
+    scan->done   = true;
 }
@@ -0,0 +1,166 @@
+#include "string_match.h"
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define STRING_MATCH_X86
+#endif
+
+#ifdef STRING_MATCH_X86
+
+/* Mask with the low `count` bits set, for up to 32 bits */
+static uint32_t low_bits(uint32_t count) {
+    return count >= 32 ? UINT32_MAX : (1u << count) - 1;
+}
+
+/* Whole vectors, then one more ending exactly at `length` that may overlap the last */
+static bool bytes_equal_sse2(const char* a, const char* b, uint32_t length) {
+    if (length <= 16) {
+        __m128i  eq   = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) a),
+                                       _mm_loadu_si128((const __m128i*) b));
+        uint32_t mask = low_bits(length);
+        return ((uint32_t) _mm_movemask_epi8(eq) & mask) == mask;
+    }
+    for (uint32_t i = 0; i + 16 < length; i += 16) {
+        __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (a + i)),
+                                    _mm_loadu_si128((const __m128i*) (b + i)));
+        if (_mm_movemask_epi8(eq) != 0xFFFF) {
+            return false;
+        }
+    }
+    uint32_t tail = length - 16;
+    __m128i  eq   = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (a + tail)),
+                                   _mm_loadu_si128((const __m128i*) (b + tail)));
+    return _mm_movemask_epi8(eq) == 0xFFFF;
+}
+
+__attribute__((target("avx2"))) static bool bytes_equal_avx2(const char* a, const char* b,
+                                                             uint32_t length) {
+    if (length <= 32) {
+        __m256i  eq   = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) a),
+                                          _mm256_loadu_si256((const __m256i*) b));
+        uint32_t mask = low_bits(length);
+        return ((uint32_t) _mm256_movemask_epi8(eq) & mask) == mask;
+    }
+    for (uint32_t i = 0; i + 32 < length; i += 32) {
+        __m256i eq = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (a + i)),
+                                       _mm256_loadu_si256((const __m256i*) (b + i)));
+        if ((uint32_t) _mm256_movemask_epi8(eq) != UINT32_MAX) {
+            return false;
+        }
+    }
+    uint32_t tail = length - 32;
+    __m256i  eq   = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (a + tail)),
+                                      _mm256_loadu_si256((const __m256i*) (b + tail)));
+    return (uint32_t) _mm256_movemask_epi8(eq) == UINT32_MAX;
+}
+
+/*
+ * Checks 16 start positions at once by comparing the needle's first and last
+ * bytes against two shifted loads, then confirms candidates with memcmp.
+ * Starts at *next, stops where the next loads would leave the field and
+ * leaves in *next the first start position it did not check.
+ */
+static bool contains_sse2(const char* hay, uint32_t hay_size, const char* needle, uint32_t length,
+                          uint32_t last_start, uint32_t* next) {
+    __m128i  first = _mm_set1_epi8(needle[0]);
+    __m128i  last  = _mm_set1_epi8(needle[length - 1]);
+    uint32_t i     = *next;
+    for (; i <= last_start && i + length - 1 + 16 <= hay_size; i += 16) {
+        __m128i  block_first = _mm_loadu_si128((const __m128i*) (hay + i));
+        __m128i  block_last  = _mm_loadu_si128((const __m128i*) (hay + i + length - 1));
+        uint32_t mask        = _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last)));
+        mask &= low_bits(last_start - i + 1);
+        while (mask != 0) {
+            uint32_t position = i + __builtin_ctz(mask);
+            if (length <= 2 || memcmp(hay + position + 1, needle + 1, length - 2) == 0) {
+                return true;
+            }
+            mask &= mask - 1;
+        }
+    }
+    *next = i;
+    return false;
+}
+
+__attribute__((target("avx2"))) static bool contains_avx2(const char* hay, uint32_t hay_size,
+                                                          const char* needle, uint32_t length,
+                                                          uint32_t last_start, uint32_t* next) {
+    __m256i  first = _mm256_set1_epi8(needle[0]);
+    __m256i  last  = _mm256_set1_epi8(needle[length - 1]);
+    uint32_t i     = *next;
+    for (; i <= last_start && i + length - 1 + 32 <= hay_size; i += 32) {
+        __m256i  block_first = _mm256_loadu_si256((const __m256i*) (hay + i));
+        __m256i  block_last  = _mm256_loadu_si256((const __m256i*) (hay + i + length - 1));
+        uint32_t mask        = _mm256_movemask_epi8(_mm256_and_si256(
+            _mm256_cmpeq_epi8(first, block_first), _mm256_cmpeq_epi8(last, block_last)));
+        mask &= low_bits(last_start - i + 1);
+        while (mask != 0) {
+            uint32_t position = i + __builtin_ctz(mask);
+            if (length <= 2 || memcmp(hay + position + 1, needle + 1, length - 2) == 0) {
+                return true;
+            }
+            mask &= mask - 1;
+        }
+    }
+    *next = i;
+    return false;
+}
+
+#endif // STRING_MATCH_X86
+
+static bool bytes_equal(const char* a, const char* b, uint32_t length) {
+#ifdef STRING_MATCH_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return bytes_equal_avx2(a, b, length);
+    }
+    return bytes_equal_sse2(a, b, length);
+#else
+    return memcmp(a, b, length) == 0;
+#endif
+}
+
+bool string_match_equal(const char* field, uint32_t field_size, const char* text,
+                        uint32_t length) {
+    /* The terminating NUL takes part, so a longer field does not match */
+    return length < field_size && bytes_equal(field, text, length + 1);
+}
+
+bool string_match_prefix(const char* field, uint32_t field_size, const char* prefix,
+                         uint32_t length) {
+    return length < field_size && bytes_equal(field, prefix, length);
+}
+
+bool string_match_contains(const char* field, uint32_t field_size, const char* needle,
+                           uint32_t length) {
+    const char* end        = memchr(field, '\0', field_size);
+    uint32_t    hay_length = end != NULL ? (uint32_t) (end - field) : field_size;
+    if (length == 0) {
+        return true;
+    }
+    if (length > hay_length) {
+        return false;
+    }
+
+    uint32_t last_start = hay_length - length;
+    uint32_t start      = 0;
+#ifdef STRING_MATCH_X86
+    /* Wide vectors first; near the end of the field narrower ones still fit */
+    if (__builtin_cpu_supports("avx2") &&
+        contains_avx2(field, field_size, needle, length, last_start, &start)) {
+        return true;
+    }
+    if (contains_sse2(field, field_size, needle, length, last_start, &start)) {
+        return true;
+    }
+#endif
+
+    /* Start positions too close to the end of the field for any vector load */
+    for (uint32_t i = start; i <= last_start; i++) {
+        if (field[i] == needle[0] && memcmp(field + i, needle, length) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
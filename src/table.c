@@ -1,7 +1,15 @@
+#define _GNU_SOURCE
 #include "table.h"
+#include "checkpoint.h"
+#include "defrag.h"
+#include "profile.h"
+#include "replication.h"
+#include "sorter.h"
+#include "warmup.h"
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -20,7 +28,7 @@ const uint32_t EMAIL_OFFSET    = USERNAME_OFFSET + USERNAME_SIZE;
 
 const uint32_t ROW_SIZE = ID_SIZE + USERNAME_SIZE + EMAIL_SIZE;
 
-const uint32_t PAGE_SIZE = 4096;
+static void page_layout_init(PageLayout* layout, uint32_t page_size);
 
 void serialize_row(Row* source, void* destination) {
     memcpy(destination + ID_OFFSET, &(source->id), ID_SIZE);
@@ -29,13 +37,11 @@ void serialize_row(Row* source, void* destination) {
 }
 
 void deserialize_row(void* source, Row* destination) {
+    profile_enter(PROFILE_DESERIALIZE);
     memcpy(&(destination->id), source + ID_OFFSET, ID_SIZE);
     memcpy(&(destination->username), source + USERNAME_OFFSET, USERNAME_SIZE);
     memcpy(&(destination->email), source + EMAIL_OFFSET, EMAIL_SIZE);
-}
-
-void print_row(Row* row) {
-    printf("(%d %s %s)\n", row->id, row->username, row->email);
+    profile_exit();
 }
 
 void* cursor_value(Cursor* cursor) {
@@ -44,122 +50,240 @@ void* cursor_value(Cursor* cursor) {
     return leaf_node_value(page, cursor->cell_num);
 }
 
+static void page_mark_dirty(Pager* pager, PageTableEntry* entry) {
+    if (!pager->in_memory && !entry->dirty) {
+        entry->dirty = true;
+        pager->num_dirty++;
+        if (pager->checkpointer != NULL) {
+            checkpointer_note_dirty(pager);
+        }
+    }
+}
+
 void* get_page(Pager* pager, uint32_t page_num) {
     if (page_num > TABLE_MAX_PAGES) {
-        printf("Tried to fetch page number out of bounds.%d > %d\n", page_num, TABLE_MAX_PAGES);
+        printf("Tried to fetch page number out of bounds.%u > %u\n", page_num, TABLE_MAX_PAGES);
         exit(EXIT_FAILURE);
     }
 
-    if (pager->pages[page_num] == NULL) {
+    PageTableEntry* entry = page_table_entry(&pager->pages, page_num);
+    if (entry->frame != NULL) {
+        pager->stats.page_hits++;
+    } else {
         // Cache miss . Allocate memory and load from file.
-        void*    page      = malloc(PAGE_SIZE);
-        uint32_t num_pages = pager->file_length / PAGE_SIZE;
-
-        if (pager->file_length % PAGE_SIZE) {
-            num_pages += 1;
-        }
-
-        if (page_num <= num_pages) {
-            lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-            ssize_t bytes_read = read(pager->file_descriptor, page, PAGE_SIZE);
+        pager->stats.page_misses++;
+        void* page   = frame_slab_alloc(&pager->frames);
+        off_t offset = (off_t) page_num * pager->layout.page_size;
+
+        if ((uint64_t) offset < pager->file_length) {
+            profile_enter(PROFILE_PAGE_IO);
+            uint64_t start = monotonic_ns();
+            ssize_t  bytes_read =
+                pread(pager->file_descriptor, page, pager->layout.page_size, offset);
+            histogram_record(&pager->latency.read, monotonic_ns() - start);
+            profile_exit();
 
             if (bytes_read == -1) {
                 printf("Error reading file %d \n", errno);
                 exit(EXIT_FAILURE);
             }
+            pager->stats.bytes_read += bytes_read;
         }
-        pager->pages[page_num] = page;
-        if (page_num >= pager->num_pages) {
-            pager->num_pages = page_num + 1;
-        }
+        entry->frame = page;
+    }
+    /* Also on a hit: bench resets a table by lowering num_pages over cached frames */
+    if (page_num >= pager->num_pages) {
+        pager->num_pages = page_num + 1;
     }
 
-    return pager->pages[page_num];
+    return entry->frame;
+}
+
+/* get_page for a caller about to change the page, which marks it dirty first */
+void* get_page_for_write(Pager* pager, uint32_t page_num) {
+    if (pager->read_only) {
+        printf("Tried to write page %u in a read-only section.\n", page_num);
+        exit(EXIT_FAILURE);
+    }
+    void* page = get_page(pager, page_num);
+    page_mark_dirty(pager, page_table_entry(&pager->pages, page_num));
+    return page;
+}
+
+/* Also for a change made to a cached page inside a read-only section */
+void pager_mark_dirty(Pager* pager, uint32_t page_num) {
+    page_mark_dirty(pager, page_table_entry(&pager->pages, page_num));
+}
+
+/* Caches a page read from the file outside get_page, clean; false if it is cached already */
+bool pager_install(Pager* pager, uint32_t page_num, const void* data) {
+    PageTableEntry* entry = page_table_entry(&pager->pages, page_num);
+    if (entry->frame != NULL) {
+        return false;
+    }
+    entry->frame = frame_slab_alloc(&pager->frames);
+    memcpy(entry->frame, data, pager->layout.page_size);
+    pager->stats.pages_warmed++;
+    return true;
+}
+
+bool page_size_valid(uint32_t page_size) {
+    return page_size >= MIN_PAGE_SIZE && page_size <= MAX_PAGE_SIZE &&
+           (page_size & (page_size - 1)) == 0;
 }
 
-Pager* pager_open(const char* filename) {
-    int fd = open(filename, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+/*
+ * Files from before the header page have the root node on page 0, flagged as
+ * the root; they are a format this build no longer reads rather than corrupt.
+ */
+static void exit_no_header(void* page) {
+    if (get_node_type(page) <= NODE_LEAF && is_node_root(page)) {
+        printf("Db file is in the format from before the header page, which is not supported.\n");
+    } else {
+        printf("Db file has no valid header. Corrupt file.\n");
+    }
+    exit(EXIT_FAILURE);
+}
 
-    if (fd == -1) {
-        printf("Unable to open File \n");
+/* The header sits at offset 0 whatever the page size, so it can be read before paging starts */
+static uint32_t read_file_page_size(int fd) {
+    DatabaseHeader header;
+    if (pread(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header)) {
+        printf("Db file has no valid header. Corrupt file.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (memcmp(header.magic, DB_HEADER_MAGIC, DB_HEADER_MAGIC_SIZE) != 0) {
+        exit_no_header(&header);
+    }
+    if (header.page_size == 0) {
+        return DEFAULT_PAGE_SIZE;
+    }
+    if (!page_size_valid(header.page_size)) {
+        printf("Db file has an unsupported page size %u. Corrupt file.\n", header.page_size);
         exit(EXIT_FAILURE);
     }
+    return header.page_size;
+}
 
-    off_t file_length = lseek(fd, 0, SEEK_END);
+Pager* pager_open(const char* filename, uint32_t page_size) {
+    /* Every page of an in-memory database is a miss past the end of an empty file */
+    bool  in_memory   = strcmp(filename, DB_IN_MEMORY) == 0;
+    int   fd          = -1;
+    off_t file_length = 0;
+
+    if (!in_memory) {
+        fd = open(filename, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+        if (fd == -1) {
+            printf("Unable to open File \n");
+            exit(EXIT_FAILURE);
+        }
+        file_length = lseek(fd, 0, SEEK_END);
+    }
+    if (file_length > 0) {
+        page_size = read_file_page_size(fd);
+    }
 
     Pager* pager           = malloc(sizeof(Pager));
     pager->file_descriptor = fd;
+    pager->in_memory       = in_memory;
     pager->file_length     = file_length;
-    pager->num_pages       = (file_length / PAGE_SIZE);
-    if (file_length % PAGE_SIZE != 0) {
+    pager->num_pages       = (file_length / page_size);
+    page_layout_init(&pager->layout, page_size);
+    memset(&pager->stats, 0, sizeof(PagerStats));
+    memset(&pager->latency, 0, sizeof(PagerLatency));
+    pager->num_dirty    = 0;
+    pager->read_only    = false;
+    pager->checkpointer = NULL;
+    pager->warmup       = NULL;
+    page_table_init(&pager->pages);
+    frame_slab_init(&pager->frames, page_size);
+    pthread_mutex_init(&pager->lock, NULL);
+    pthread_mutex_init(&pager->checkpoint_lock, NULL);
+    if (file_length % page_size != 0) {
         printf("Db file is not a whole number of pages. Corrupt file.\n");
         exit(EXIT_FAILURE);
     }
 
-    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-        pager->pages[i] = NULL;
-    }
-
     return pager;
 }
 
 void db_close(Table* table) {
     Pager* pager = table->pager;
-
-    for (uint32_t i = 0; i < pager->num_pages; i++) {
-        if (pager->pages[i] == NULL) {
-            continue;
+    replication_stop(table);
+    defragger_stop(table);
+    profile_close(table->profile);
+    checkpointer_stop(pager);
+    warmup_stop(pager);
+    table_merge_memtable(table);
+    memtable_destroy(&table->memtable);
+
+    /* Whatever the checkpointer has not written yet */
+    uint32_t        page_num = 0;
+    PageTableEntry* entry;
+    while ((entry = page_table_next(&pager->pages, &page_num)) != NULL) {
+        if (entry->dirty) {
+            pager_flush(pager, page_num);
         }
-
-        pager_flush(pager, i);
-        free(pager->pages[i]);
-        pager->pages[i] = NULL;
+        page_num++;
     }
-    int result = close(pager->file_descriptor);
-
-    if (result == -1) {
+    warmup_finish(pager);
+    if (!pager->in_memory && close(pager->file_descriptor) == -1) {
         printf("Error while closing the dB file\n");
         exit(EXIT_FAILURE);
     }
 
-    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-        void* page = pager->pages[i];
-        if (page) {
-            free(page);
-            pager->pages[i] = NULL;
-        }
-    }
+    page_table_destroy(&pager->pages);
+    frame_slab_destroy(&pager->frames);
+    pthread_mutex_destroy(&pager->lock);
+    pthread_mutex_destroy(&pager->checkpoint_lock);
     free(pager);
     free(table);
 }
 
+void pager_begin(Pager* pager, bool read_only) {
+    pthread_mutex_lock(&pager->lock);
+    pager->read_only = read_only;
+}
+
+void pager_end(Pager* pager) {
+    pager->read_only = false;
+    pthread_mutex_unlock(&pager->lock);
+}
+
 void pager_flush(Pager* pager, uint32_t page_num) {
-    if (pager->pages[page_num] == NULL) {
+    PageTableEntry* entry = page_table_lookup(&pager->pages, page_num);
+    if (entry == NULL || entry->frame == NULL) {
         printf("Tried to flush NULL Page\n");
         exit(EXIT_FAILURE);
     }
 
-    off_t offset = lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-    if (offset == -1) {
-        printf("Error seeking: %d\n", errno);
-        exit(EXIT_FAILURE);
-    }
+    uint64_t start  = monotonic_ns();
+    off_t    offset = (off_t) page_num * pager->layout.page_size;
 
-    ssize_t bytes_written = write(pager->file_descriptor, pager->pages[page_num], PAGE_SIZE);
+    ssize_t bytes_written =
+        pwrite(pager->file_descriptor, entry->frame, pager->layout.page_size, offset);
 
     if (bytes_written == -1) {
         printf("Error writing: %d\n", errno);
         exit(EXIT_FAILURE);
     }
+    histogram_record(&pager->latency.flush, monotonic_ns() - start);
+    pager->stats.flushes++;
+    pager->stats.bytes_written += bytes_written;
+
+    if (entry->dirty) {
+        entry->dirty = false;
+        pager->num_dirty--;
+    }
 }
 
-Cursor* leaf_node_find(Table* table, uint32_t page_num, uint32_t key) {
+void leaf_node_find(Table* table, uint32_t page_num, uint32_t key, Cursor* cursor) {
     void*    node      = get_page(table->pager, page_num);
     uint32_t num_cells = *leaf_node_num_cells(node);
 
-    Cursor* cursor   = malloc(sizeof(Cursor));
-    cursor->table    = table;
-    cursor->page_num = page_num;
+    cursor->table        = table;
+    cursor->page_num     = page_num;
+    cursor->end_of_table = false;
 
     uint32_t min_index          = 0;
     uint32_t one_past_max_index = num_cells;
@@ -169,7 +293,7 @@ Cursor* leaf_node_find(Table* table, uint32_t page_num, uint32_t key) {
         uint32_t key_at_index = *leaf_node_key(node, index);
         if (key == key_at_index) {
             cursor->cell_num = index;
-            return cursor;
+            return;
         }
         if (key < key_at_index) {
             one_past_max_index = index;
@@ -179,7 +303,6 @@ Cursor* leaf_node_find(Table* table, uint32_t page_num, uint32_t key) {
     }
 
     cursor->cell_num = min_index;
-    return cursor;
 }
 
 NodeType get_node_type(void* node) {
@@ -252,11 +375,6 @@ const uint32_t LEAF_NODE_VALUE_OFFSET = LEAF_NODE_KEY_OFFSET + LEAF_NODE_KEY_SIZ
 
 const uint32_t LEAF_NODE_CELL_SIZE = LEAF_NODE_KEY_SIZE + LEAF_NODE_VALUE_SIZE;
 
-const uint32_t LEAF_NODE_SPACE_FOR_CELLS   = PAGE_SIZE - LEAF_NODE_HEADER_SIZE;
-const uint32_t LEAF_NODE_MAX_CELLS         = LEAF_NODE_SPACE_FOR_CELLS / LEAF_NODE_CELL_SIZE;
-const uint32_t LEAF_NODE_RIGHT_SPLIT_COUNT = (LEAF_NODE_MAX_CELLS + 1) / 2;
-const uint32_t LEAF_NODE_LEFT_SPLIT_COUNT = (LEAF_NODE_MAX_CELLS + 1) - LEAF_NODE_RIGHT_SPLIT_COUNT;
-
 uint32_t* leaf_node_num_cells(void* node) {
     return node + LEAF_NODE_NUM_CELLS_OFFSET;
 }
@@ -352,8 +470,21 @@ const uint32_t INTERNAL_NODE_HEADER_SIZE =
 const uint32_t INTERNAL_NODE_KEY_SIZE   = sizeof(uint32_t);
 const uint32_t INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t);
 const uint32_t INTERNAL_NODE_CELL_SIZE  = INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE;
-const uint32_t INTERNAL_NODE_MAX_KEYS =
-    (PAGE_SIZE - INTERNAL_NODE_HEADER_SIZE) / INTERNAL_NODE_CELL_SIZE;
+
+/*
+ * How many cells fit depends on the file's page size. A full leaf plus the
+ * cell being inserted is split as evenly as possible, the extra one going left.
+ */
+static void page_layout_init(PageLayout* layout, uint32_t page_size) {
+    uint32_t max_cells = (page_size - LEAF_NODE_HEADER_SIZE) / LEAF_NODE_CELL_SIZE;
+    uint32_t max_keys  = (page_size - INTERNAL_NODE_HEADER_SIZE) / INTERNAL_NODE_CELL_SIZE;
+
+    layout->page_size                   = page_size;
+    layout->leaf_node_max_cells         = max_cells;
+    layout->leaf_node_right_split_count = (max_cells + 1) / 2;
+    layout->leaf_node_left_split_count  = (max_cells + 1) - layout->leaf_node_right_split_count;
+    layout->internal_node_max_keys      = max_keys;
+}
 
 uint32_t* internal_node_num_keys(void* node) {
     return node + INTERNAL_NODE_NUM_KEYS_OFFSET;
@@ -387,6 +518,11 @@ uint32_t* internal_node_key(void* node, uint32_t key_num) {
     return (void*) internal_node_cell(node, key_num) + INTERNAL_NODE_CHILD_SIZE;
 }
 
+/*
+ * Walks the right spine down to a leaf, so it costs one page per level. The
+ * split paths read high keys off separators instead and only call this a
+ * constant number of times per split.
+ */
 uint32_t get_node_max_key(Pager* pager, void* node) {
     if (get_node_type(node) == NODE_LEAF) {
         return *leaf_node_key(node, *leaf_node_num_cells(node) - 1);
@@ -405,9 +541,9 @@ void initialize_internal_node(void* node) {
     set_node_root(node, false);
     *internal_node_num_keys(node) = 0;
     /*
-    Necessary because the root page number is 0; by not initializing an internal
-    node's right child to an invalid page number when initializing the node, we may
-    end up with 0 as the node's right child, which makes the node a parent of the root
+    Necessary because page 0 is a valid page number (the header); by not initializing an
+    internal node's right child to an invalid page number when initializing the node, we
+    may end up with 0 as the node's right child, which makes the node a parent of the header
     */
     *internal_node_right_child(node) = INVALID_PAGE_NUM;
 }
@@ -430,11 +566,13 @@ void create_new_root(Table* table, uint32_t right_child_page_num) {
         Re-initialize root page to contain the new root node.
         New root node points to two children.
     */
+    table->stats.root_splits++;
+    table->splits++;
 
-    void*    root                = get_page(table->pager, table->root_page_num);
-    void*    right_child         = get_page(table->pager, right_child_page_num);
+    void*    root                = get_page_for_write(table->pager, table->root_page_num);
+    void*    right_child         = get_page_for_write(table->pager, right_child_page_num);
     uint32_t left_child_page_num = get_unused_page_num(table->pager);
-    void*    left_child          = get_page(table->pager, left_child_page_num);
+    void*    left_child          = get_page_for_write(table->pager, left_child_page_num);
 
     if (get_node_type(root) == NODE_INTERNAL) {
         initialize_internal_node(right_child);
@@ -442,17 +580,16 @@ void create_new_root(Table* table, uint32_t right_child_page_num) {
     }
 
     /* Left child has data copied from old root */
-    memcpy(left_child, root, PAGE_SIZE);
+    memcpy(left_child, root, table->pager->layout.page_size);
     set_node_root(left_child, false);
 
     if (get_node_type(left_child) == NODE_INTERNAL) {
         void* child;
-        for (int i = 0; i < (int) *internal_node_num_keys(left_child); i++) {
-            child               = get_page(table->pager, *internal_node_child(left_child, i));
-            *node_parent(child) = left_child_page_num;
+        for (int i = 0; i <= (int) *internal_node_num_keys(left_child); i++) {
+            uint32_t child_page_num = *internal_node_child(left_child, i);
+            child                   = get_page_for_write(table->pager, child_page_num);
+            *node_parent(child)     = left_child_page_num;
         }
-        child               = get_page(table->pager, *internal_node_right_child(left_child));
-        *node_parent(child) = left_child_page_num;
     }
 
     /* Root node is a new internal node with one key and two children */
@@ -492,7 +629,7 @@ uint32_t internal_node_find_child(void* node, uint32_t key) {
     return min_index;
 }
 
-Cursor* internal_node_find(Table* table, uint32_t page_num, uint32_t key) {
+void internal_node_find(Table* table, uint32_t page_num, uint32_t key, Cursor* cursor) {
     void* node = get_page(table->pager, page_num);
 
     uint32_t child_index = internal_node_find_child(node, key);
@@ -500,16 +637,20 @@ Cursor* internal_node_find(Table* table, uint32_t page_num, uint32_t key) {
     void*    child       = get_page(table->pager, child_num);
     switch (get_node_type(child)) {
         case NODE_LEAF:
-            return leaf_node_find(table, child_num, key);
+            leaf_node_find(table, child_num, key, cursor);
+            return;
         case NODE_INTERNAL:
-            return internal_node_find(table, child_num, key);
+            internal_node_find(table, child_num, key, cursor);
+            return;
     }
-    return NULL;
 }
 
 void update_internal_node_key(void* node, uint32_t old_key, uint32_t new_key) {
-    uint32_t old_child_index                  = internal_node_find_child(node, old_key);
-    *internal_node_key(node, old_child_index) = new_key;
+    uint32_t old_child_index = internal_node_find_child(node, old_key);
+    /* The right child has no key of its own; its max is the parent's */
+    if (old_child_index < *internal_node_num_keys(node)) {
+        *internal_node_key(node, old_child_index) = new_key;
+    }
 }
 
 void internal_node_insert(Table* table, uint32_t parent_page_num, uint32_t child_page_num) {
@@ -517,14 +658,14 @@ void internal_node_insert(Table* table, uint32_t parent_page_num, uint32_t child
     Add a new child/key pair to parent that corresponds to child
     */
 
-    void*    parent        = get_page(table->pager, parent_page_num);
+    void*    parent        = get_page_for_write(table->pager, parent_page_num);
     void*    child         = get_page(table->pager, child_page_num);
     uint32_t child_max_key = get_node_max_key(table->pager, child);
     uint32_t index         = internal_node_find_child(parent, child_max_key);
 
     uint32_t original_num_keys = *internal_node_num_keys(parent);
 
-    if (original_num_keys >= INTERNAL_NODE_MAX_KEYS) {
+    if (original_num_keys >= table->pager->layout.internal_node_max_keys) {
         internal_node_split_and_insert(table, parent_page_num, child_page_num);
         return;
     }
@@ -554,11 +695,8 @@ void internal_node_insert(Table* table, uint32_t parent_page_num, uint32_t child
         *internal_node_right_child(parent)            = child_page_num;
     } else {
         /* Make room for the new cell */
-        for (uint32_t i = original_num_keys; i > index; i--) {
-            void* destination = internal_node_cell(parent, i);
-            void* source      = internal_node_cell(parent, i - 1);
-            memcpy(destination, source, INTERNAL_NODE_CELL_SIZE);
-        }
+        memmove(internal_node_cell(parent, index + 1), internal_node_cell(parent, index),
+                (original_num_keys - index) * INTERNAL_NODE_CELL_SIZE);
         *internal_node_child(parent, index) = child_page_num;
         *internal_node_key(parent, index)   = child_max_key;
     }
@@ -566,11 +704,13 @@ void internal_node_insert(Table* table, uint32_t parent_page_num, uint32_t child
 
 void internal_node_split_and_insert(Table* table, uint32_t parent_page_num,
                                     uint32_t child_page_num) {
+    table->stats.internal_splits++;
+    table->splits++;
     uint32_t old_page_num = parent_page_num;
-    void*    old_node     = get_page(table->pager, parent_page_num);
+    void*    old_node     = get_page_for_write(table->pager, parent_page_num);
     uint32_t old_max      = get_node_max_key(table->pager, old_node);
 
-    void*    child     = get_page(table->pager, child_page_num);
+    void*    child     = get_page_for_write(table->pager, child_page_num);
     uint32_t child_max = get_node_max_key(table->pager, child);
 
     uint32_t new_page_num = get_unused_page_num(table->pager);
@@ -591,70 +731,60 @@ void internal_node_split_and_insert(Table* table, uint32_t parent_page_num,
     uint32_t splitting_root = is_node_root(old_node);
 
     void* parent;
-    void* new_node;
     if (splitting_root) {
         create_new_root(table, new_page_num);
-        parent = get_page(table->pager, table->root_page_num);
+        parent = get_page_for_write(table->pager, table->root_page_num);
         /*
         If we are splitting the root, we need to update old_node to point
         to the new root's left child, new_page_num will already point to
         the new root's right child
         */
         old_page_num = *internal_node_child(parent, 0);
-        old_node     = get_page(table->pager, old_page_num);
+        old_node     = get_page_for_write(table->pager, old_page_num);
     } else {
-        parent   = get_page(table->pager, *node_parent(old_node));
-        new_node = get_page(table->pager, new_page_num);
-        initialize_internal_node(new_node);
+        parent = get_page_for_write(table->pager, *node_parent(old_node));
     }
-
-    uint32_t* old_num_keys = internal_node_num_keys(old_node);
-
-    uint32_t cur_page_num = *internal_node_right_child(old_node);
-    void*    cur          = get_page(table->pager, cur_page_num);
+    void* new_node = get_page_for_write(table->pager, new_page_num);
+    initialize_internal_node(new_node);
 
     /*
-    First put right child into new node and set right child of old node to invalid page number
+    Cells right of the middle key move to the new node in one copy, along with the right
+    child. The child left of the middle key becomes the old node's right child, so the
+    middle key is the old node's new max and nothing has to descend to find it.
     */
-    internal_node_insert(table, new_page_num, cur_page_num);
-    *node_parent(cur)                    = new_page_num;
-    *internal_node_right_child(old_node) = INVALID_PAGE_NUM;
-    /*
-    For each key until you get to the middle key, move the key and the child to the new node
-    */
-    for (int i = (int) INTERNAL_NODE_MAX_KEYS - 1; i > (int) INTERNAL_NODE_MAX_KEYS / 2; i--) {
-        cur_page_num = *internal_node_child(old_node, i);
-        cur          = get_page(table->pager, cur_page_num);
-
-        internal_node_insert(table, new_page_num, cur_page_num);
-        *node_parent(cur) = new_page_num;
-
-        (*old_num_keys)--;
+    uint32_t* old_num_keys = internal_node_num_keys(old_node);
+    uint32_t  middle       = *old_num_keys / 2;
+    uint32_t  num_moved    = *old_num_keys - middle - 1;
+    uint32_t  left_max     = *internal_node_key(old_node, middle);
+
+    memcpy(internal_node_cell(new_node, 0), internal_node_cell(old_node, middle + 1),
+           num_moved * INTERNAL_NODE_CELL_SIZE);
+    *internal_node_num_keys(new_node)    = num_moved;
+    *internal_node_right_child(new_node) = *internal_node_right_child(old_node);
+    *internal_node_right_child(old_node) = *internal_node_child(old_node, middle);
+    *old_num_keys                        = middle;
+
+    for (uint32_t i = 0; i <= num_moved; i++) {
+        void* moved         = get_page_for_write(table->pager, *internal_node_child(new_node, i));
+        *node_parent(moved) = new_page_num;
     }
 
-    /*
-    Set child before middle key, which is now the highest key, to be node's right child,
-    and decrement number of keys
-    */
-    *internal_node_right_child(old_node) = *internal_node_child(old_node, *old_num_keys - 1);
-    (*old_num_keys)--;
-
     /*
     Determine which of the two nodes after the split should contain the child to be inserted,
     and insert the child
     */
-    uint32_t max_after_split = get_node_max_key(table->pager, old_node);
-
-    uint32_t destination_page_num = child_max < max_after_split ? old_page_num : new_page_num;
+    uint32_t destination_page_num = child_max < left_max ? old_page_num : new_page_num;
 
     internal_node_insert(table, destination_page_num, child_page_num);
     *node_parent(child) = destination_page_num;
 
-    update_internal_node_key(parent, old_max, get_node_max_key(table->pager, old_node));
+    /* A child bigger than left_max went right, so the old node's max is still left_max */
+    update_internal_node_key(parent, old_max, left_max);
 
     if (!splitting_root) {
-        internal_node_insert(table, *node_parent(old_node), new_page_num);
+        /* Set first: if the parent splits in turn, it moves new_node and repoints this */
         *node_parent(new_node) = *node_parent(old_node);
+        internal_node_insert(table, *node_parent(old_node), new_page_num);
     }
 }
 
@@ -664,11 +794,16 @@ void leaf_node_split_and_insert(Cursor* cursor, uint32_t key, Row* value) {
         insert new value in any one of node.
         Update parent or create a new one.
     */
-    void*    old_node     = get_page(cursor->table->pager, cursor->page_num);
-    uint32_t old_max      = get_node_max_key(cursor->table->pager, old_node);
-    uint32_t new_page_num = get_unused_page_num(cursor->table->pager);
-
-    void* new_node = get_page(cursor->table->pager, new_page_num);
+    cursor->table->stats.leaf_splits++;
+    cursor->table->splits++;
+    PageLayout* layout       = &cursor->table->pager->layout;
+    uint32_t    left_count   = layout->leaf_node_left_split_count;
+    uint32_t    right_count  = layout->leaf_node_right_split_count;
+    void*       old_node     = get_page_for_write(cursor->table->pager, cursor->page_num);
+    uint32_t    old_max      = get_node_max_key(cursor->table->pager, old_node);
+    uint32_t    new_page_num = get_unused_page_num(cursor->table->pager);
+
+    void* new_node = get_page_for_write(cursor->table->pager, new_page_num);
     initialize_leaf_node(new_node);
     *node_parent(new_node)         = *node_parent(old_node);
     *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_node);
@@ -677,34 +812,36 @@ void leaf_node_split_and_insert(Cursor* cursor, uint32_t key, Row* value) {
     /*
         All existing keys plus new key should be divided
         evenly between old (left) and new (right) nodes.
-        Starting from the right, move each key to correct position.
+        Cells move as whole runs on either side of the new cell's slot.
     */
-
-    for (int32_t i = (int32_t) LEAF_NODE_MAX_CELLS; i >= 0; i--) {
-        void* destination_node;
-
-        if (i >= (int32_t) LEAF_NODE_LEFT_SPLIT_COUNT) {
-            destination_node = new_node;
-        } else {
-            destination_node = old_node;
-        }
-        uint32_t index_within_node = i % (int32_t) LEAF_NODE_LEFT_SPLIT_COUNT;
-        void*    destination       = leaf_node_cell(destination_node, index_within_node);
-
-        if (i == (int32_t) cursor->cell_num) {
-            serialize_row(value, leaf_node_value(destination_node, index_within_node));
-            *leaf_node_key(destination_node, index_within_node) = key;
-        } else if (i > (int32_t) cursor->cell_num) {
-            memcpy(destination, leaf_node_cell(old_node, i - 1), LEAF_NODE_CELL_SIZE);
-        } else {
-            memcpy(destination, leaf_node_cell(old_node, i), LEAF_NODE_CELL_SIZE);
-        }
+    uint32_t cell_num = cursor->cell_num;
+    void*    destination_node;
+    uint32_t index_within_node;
+
+    if (cell_num < left_count) {
+        /* The new cell stays left, pushing the left half's last cell over */
+        void* right_half = leaf_node_cell(old_node, left_count - 1);
+        memcpy(leaf_node_cell(new_node, 0), right_half,
+               right_count * LEAF_NODE_CELL_SIZE);
+        memmove(leaf_node_cell(old_node, cell_num + 1), leaf_node_cell(old_node, cell_num),
+                (left_count - 1 - cell_num) * LEAF_NODE_CELL_SIZE);
+        destination_node  = old_node;
+        index_within_node = cell_num;
+    } else {
+        index_within_node = cell_num - left_count;
+        memcpy(leaf_node_cell(new_node, 0), leaf_node_cell(old_node, left_count),
+               index_within_node * LEAF_NODE_CELL_SIZE);
+        memcpy(leaf_node_cell(new_node, index_within_node + 1), leaf_node_cell(old_node, cell_num),
+               (layout->leaf_node_max_cells - cell_num) * LEAF_NODE_CELL_SIZE);
+        destination_node = new_node;
     }
+    *leaf_node_key(destination_node, index_within_node) = key;
+    serialize_row(value, leaf_node_value(destination_node, index_within_node));
 
     /* Update cell count on both leaf nodes */
 
-    *(leaf_node_num_cells(old_node)) = LEAF_NODE_LEFT_SPLIT_COUNT;
-    *(leaf_node_num_cells(new_node)) = LEAF_NODE_RIGHT_SPLIT_COUNT;
+    *(leaf_node_num_cells(old_node)) = left_count;
+    *(leaf_node_num_cells(new_node)) = right_count;
 
     // update the parent Node if present or create a new one
     if (is_node_root(old_node)) {
@@ -712,7 +849,7 @@ void leaf_node_split_and_insert(Cursor* cursor, uint32_t key, Row* value) {
     } else {
         uint32_t parent_page_num = *node_parent(old_node);
         uint32_t new_max         = get_node_max_key(cursor->table->pager, old_node);
-        void*    parent          = get_page(cursor->table->pager, parent_page_num);
+        void*    parent          = get_page_for_write(cursor->table->pager, parent_page_num);
         update_internal_node_key(parent, old_max, new_max);
         internal_node_insert(cursor->table, parent_page_num, new_page_num);
         return;
@@ -720,10 +857,10 @@ void leaf_node_split_and_insert(Cursor* cursor, uint32_t key, Row* value) {
 }
 
 void leaf_node_insert(Cursor* cursor, uint32_t key, Row* value) {
-    void* node = get_page(cursor->table->pager, cursor->page_num);
+    void* node = get_page_for_write(cursor->table->pager, cursor->page_num);
 
     uint32_t num_cells = *leaf_node_num_cells(node);
-    if (num_cells >= LEAF_NODE_MAX_CELLS) {
+    if (num_cells >= cursor->table->pager->layout.leaf_node_max_cells) {
         // Node full
         leaf_node_split_and_insert(cursor, key, value);
         return;
@@ -731,38 +868,363 @@ void leaf_node_insert(Cursor* cursor, uint32_t key, Row* value) {
 
     if (cursor->cell_num < num_cells) {
         // Make room for new cell
-        for (uint32_t i = num_cells; i > cursor->cell_num; i--) {
-            memcpy(leaf_node_cell(node, i), leaf_node_cell(node, i - 1), LEAF_NODE_CELL_SIZE);
-        }
+        cursor->table->stats.cells_shifted += num_cells - cursor->cell_num;
+        memmove(leaf_node_cell(node, cursor->cell_num + 1), leaf_node_cell(node, cursor->cell_num),
+                (num_cells - cursor->cell_num) * LEAF_NODE_CELL_SIZE);
     }
     *(leaf_node_num_cells(node)) += 1;
     *(leaf_node_key(node, cursor->cell_num)) = key;
     serialize_row(value, leaf_node_value(node, cursor->cell_num));
 }
 
-Table* db_open(const char* filename) {
-    Pager* pager         = pager_open(filename);
-    Table* table         = (Table*) malloc(sizeof(Table));
-    table->pager         = pager;
-    table->root_page_num = 0;
+Table* db_open(const char* filename, uint32_t page_size) {
+    if (!page_size_valid(page_size)) {
+        printf("Page size must be a power of two from %u to %u.\n", MIN_PAGE_SIZE, MAX_PAGE_SIZE);
+        exit(EXIT_FAILURE);
+    }
+    Pager* pager = pager_open(filename, page_size);
+    Table* table = (Table*) malloc(sizeof(Table));
+    table->pager = pager;
+    memset(&table->stats, 0, sizeof(TableStats));
+    memset(&table->latency, 0, sizeof(StatementLatency));
+    table->sort_budget = SORTER_DEFAULT_BUDGET;
+    memtable_init(&table->memtable, ROW_SIZE);
+    table->replication = NULL;
+    table->profile     = NULL;
+    table->defragger   = NULL;
+    table->open_scans  = 0;
+    table->splits      = 0;
 
     if (pager->num_pages == 0) {
-        // New database file. Initialize page 0 as leaf node.
-        void* root_node = get_page(pager, 0);
+        // New database file. Page 0 is the header, page 1 the root leaf.
+        DatabaseHeader* header = get_page_for_write(pager, DB_HEADER_PAGE_NUM);
+        memset(header, 0, pager->layout.page_size);
+        memcpy(header->magic, DB_HEADER_MAGIC, DB_HEADER_MAGIC_SIZE);
+        header->root_page_num  = 1;
+        header->page_size      = pager->layout.page_size;
+        header->format_version = DB_FORMAT_VERSION;
+
+        void* root_node = get_page_for_write(pager, header->root_page_num);
         initialize_leaf_node(root_node);
         set_node_root(root_node, true);
     }
 
+    DatabaseHeader* header = db_header(table);
+    if (memcmp(header->magic, DB_HEADER_MAGIC, DB_HEADER_MAGIC_SIZE) != 0) {
+        exit_no_header(header);
+    }
+    if (header->format_version > DB_FORMAT_VERSION) {
+        printf("Db file format version %u is newer than this build supports.\n",
+               header->format_version);
+        exit(EXIT_FAILURE);
+    }
+    if (header->page_size == 0) {
+        /* Written before the header recorded its layout: stamp the 4 KiB it was made with */
+        header                 = db_header_for_write(table);
+        header->page_size      = pager->layout.page_size;
+        header->format_version = DB_FORMAT_VERSION;
+    }
+    table->root_page_num = header->root_page_num;
+
     return table;
 }
 
-void print_constants() {
+DatabaseHeader* db_header(Table* table) {
+    return get_page(table->pager, DB_HEADER_PAGE_NUM);
+}
+
+DatabaseHeader* db_header_for_write(Table* table) {
+    return get_page_for_write(table->pager, DB_HEADER_PAGE_NUM);
+}
+
+/*
+ * Fills a leaf's `count` free cells from sorted memtable rows in one pass from
+ * the back, so each existing cell moves at most once however many land in it.
+ * Each row's slot is binary searched among the cells not yet moved.
+ */
+static void leaf_node_merge(Table* table, void* node, uint32_t first, uint32_t count) {
+    Memtable* memtable = &table->memtable;
+    uint32_t  existing = *leaf_node_num_cells(node);
+    uint32_t  dest     = existing + count;
+
+    *leaf_node_num_cells(node) = dest;
+
+    while (count > 0) {
+        uint32_t key       = memtable_key(memtable, first + count - 1);
+        uint32_t run       = existing;
+        uint32_t min_index = 0;
+        while (min_index != existing) {
+            uint32_t index = (min_index + existing) / 2;
+            if (*leaf_node_key(node, index) > key) {
+                existing = index;
+            } else {
+                min_index = index + 1;
+            }
+        }
+        if (run > existing) {
+            dest -= run - existing;
+            memmove(leaf_node_cell(node, dest), leaf_node_cell(node, existing),
+                    (run - existing) * LEAF_NODE_CELL_SIZE);
+            table->stats.cells_shifted += run - existing;
+        }
+        dest--;
+        count--;
+        *leaf_node_key(node, dest) = key;
+        memcpy(leaf_node_value(node, dest), memtable_row(memtable, first + count), ROW_SIZE);
+    }
+}
+
+/*
+ * Rewrites a leaf whose buffered rows do not all fit as several leaves, filled
+ * evenly from one merged run of its cells and the rows. Every leaf after the
+ * first is hooked in after its left neighbour the way a split hooks in its
+ * right half, so the result is what that many splits would leave behind.
+ */
+static void leaf_node_merge_split(Table* table, uint32_t page_num, uint32_t first, uint32_t count,
+                                  char* scratch) {
+    Memtable* memtable   = &table->memtable;
+    void*     node       = get_page_for_write(table->pager, page_num);
+    uint32_t  existing   = *leaf_node_num_cells(node);
+    uint32_t  total      = existing + count;
+    uint32_t  max_cells  = table->pager->layout.leaf_node_max_cells;
+    uint32_t  num_leaves = (total + max_cells - 1) / max_cells;
+    uint32_t  old_max    = existing > 0 ? *leaf_node_key(node, existing - 1) : 0;
+
+    /* The leaf's own cells move out of the way; the first output overwrites them */
+    memcpy(scratch, leaf_node_cell(node, 0), existing * LEAF_NODE_CELL_SIZE);
+    uint32_t from_leaf = 0;
+    uint32_t from_rows = first;
+    uint32_t end       = first + count;
+
+    uint32_t prev_page_num = page_num;
+    for (uint32_t leaf = 0; leaf < num_leaves; leaf++) {
+        uint32_t leaf_page_num = page_num;
+        if (leaf > 0) {
+            leaf_page_num = get_unused_page_num(table->pager);
+            node          = get_page_for_write(table->pager, leaf_page_num);
+            initialize_leaf_node(node);
+            void* prev                 = get_page_for_write(table->pager, prev_page_num);
+            *leaf_node_next_leaf(node) = *leaf_node_next_leaf(prev);
+            *leaf_node_next_leaf(prev) = leaf_page_num;
+        }
+
+        uint32_t size = total / num_leaves + (leaf < total % num_leaves);
+        for (uint32_t cell = 0; cell < size; cell++) {
+            char* from_cell = scratch + from_leaf * LEAF_NODE_CELL_SIZE;
+            if (from_leaf < existing &&
+                (from_rows == end || *(uint32_t*) from_cell < memtable_key(memtable, from_rows))) {
+                memcpy(leaf_node_cell(node, cell), from_cell, LEAF_NODE_CELL_SIZE);
+                from_leaf++;
+            } else {
+                *leaf_node_key(node, cell) = memtable_key(memtable, from_rows);
+                memcpy(leaf_node_value(node, cell), memtable_row(memtable, from_rows), ROW_SIZE);
+                from_rows++;
+            }
+        }
+        *leaf_node_num_cells(node) = size;
+        if (leaf == 0) {
+            continue;
+        }
+
+        table->stats.leaf_splits++;
+        table->splits++;
+        void* prev = get_page(table->pager, prev_page_num);
+        if (is_node_root(prev)) {
+            create_new_root(table, leaf_page_num);
+        } else {
+            uint32_t parent_page_num = *node_parent(prev);
+            if (leaf == 1) {
+                void* parent = get_page_for_write(table->pager, parent_page_num);
+                update_internal_node_key(parent, old_max, get_node_max_key(table->pager, prev));
+            }
+            *node_parent(node) = parent_page_num;
+            internal_node_insert(table, parent_page_num, leaf_page_num);
+        }
+        prev_page_num = leaf_page_num;
+    }
+}
+
+/* First index in [first, last) whose id is above `key` */
+static uint32_t memtable_upper_bound(Memtable* memtable, uint32_t first, uint32_t last,
+                                     uint32_t key) {
+    while (first != last) {
+        uint32_t index = (first + last) / 2;
+        if (memtable_key(memtable, index) <= key) {
+            first = index + 1;
+        } else {
+            last = index;
+        }
+    }
+    return first;
+}
+
+/*
+ * Records the leaf each sorted memtable row in [first, last) belongs in. Rows
+ * are split between children by their separators, so every internal node on
+ * the way is visited once per merge rather than once per row. `height` counts
+ * the internal levels left, which keeps the leaves themselves untouched here.
+ */
+static void memtable_route(Table* table, uint32_t page_num, uint32_t height, uint32_t first,
+                           uint32_t last, uint32_t* leaves) {
+    if (height == 0) {
+        for (; first < last; first++) {
+            leaves[first] = page_num;
+        }
+        return;
+    }
+
+    Memtable* memtable = &table->memtable;
+    void*     node     = get_page(table->pager, page_num);
+    uint32_t  num_keys = *internal_node_num_keys(node);
+    while (first < last) {
+        uint32_t child = internal_node_find_child(node, memtable_key(memtable, first));
+        uint32_t end   = last;
+        if (child < num_keys) {
+            end = memtable_upper_bound(memtable, first, last, *internal_node_key(node, child));
+        }
+        memtable_route(table, *internal_node_child(node, child), height - 1, first, end, leaves);
+        first = end;
+    }
+}
+
+/*
+ * Moves every buffered row into the tree in key order. The rows are routed to
+ * their leaves in one pass down the tree, then each leaf takes its rows in a
+ * single merge, or is rewritten as several leaves when they do not fit. That
+ * only adds leaves after it, so the leaves the later rows were routed to stay put.
+ */
+void table_merge_memtable(Table* table) {
+    Memtable* memtable = &table->memtable;
+    uint32_t  num_rows = memtable->num_rows;
+    if (num_rows == 0) {
+        return;
+    }
+    table->stats.memtable_merges++;
+    memtable_sort(memtable);
+
+    /* Every leaf sits at the same depth, so the leftmost path gives the height */
+    uint32_t height = 0;
+    void*    node   = get_page(table->pager, table->root_page_num);
+    while (get_node_type(node) == NODE_INTERNAL) {
+        node = get_page(table->pager, *internal_node_child(node, 0));
+        height++;
+    }
+
+    uint32_t* leaves  = malloc((size_t) num_rows * sizeof(uint32_t));
+    char*     scratch = malloc(table->pager->layout.page_size);
+    if (leaves == NULL || scratch == NULL) {
+        /* Without memory to route them the rows go in one insert at a time, which needs none */
+        free(leaves);
+        free(scratch);
+        for (uint32_t i = 0; i < num_rows; i++) {
+            Row    row;
+            Cursor cursor;
+            deserialize_row(memtable_row(memtable, i), &row);
+            table_find(table, row.id, &cursor);
+            leaf_node_insert(&cursor, row.id, &row);
+        }
+        memtable_clear(memtable);
+        return;
+    }
+    memtable_route(table, table->root_page_num, height, 0, num_rows, leaves);
+
+    uint32_t index = 0;
+    while (index < num_rows) {
+        uint32_t page_num = leaves[index];
+        uint32_t end      = index + 1;
+        while (end < num_rows && leaves[end] == page_num) {
+            end++;
+        }
+
+        node           = get_page_for_write(table->pager, page_num);
+        uint32_t room  = table->pager->layout.leaf_node_max_cells - *leaf_node_num_cells(node);
+        uint32_t count = end - index;
+        if (count <= room) {
+            leaf_node_merge(table, node, index, count);
+        } else {
+            leaf_node_merge_split(table, page_num, index, count, scratch);
+        }
+        index = end;
+    }
+    free(scratch);
+    free(leaves);
+    memtable_clear(memtable);
+}
+
+/*
+ * Sizes the id filter for every row in the tree and the memtable, and adds
+ * them. False if there is no filter at all for want of memory.
+ */
+static bool table_build_filter(Table* table) {
+    Memtable* memtable = &table->memtable;
+    uint64_t  num_rows = memtable->num_rows;
+    Cursor    cursor;
+    table_start(table, &cursor);
+
+    for (uint32_t page_num = cursor.page_num; page_num != 0;) {
+        void* node = get_page(table->pager, page_num);
+        num_rows += *leaf_node_num_cells(node);
+        page_num = *leaf_node_next_leaf(node);
+    }
+    if (!memtable_filter_reset(memtable, num_rows)) {
+        return memtable->filter != NULL;
+    }
+
+    for (uint32_t page_num = cursor.page_num; page_num != 0;) {
+        void*    node      = get_page(table->pager, page_num);
+        uint32_t num_cells = *leaf_node_num_cells(node);
+        for (uint32_t i = 0; i < num_cells; i++) {
+            memtable_filter_add(memtable, *leaf_node_key(node, i));
+        }
+        page_num = *leaf_node_next_leaf(node);
+    }
+    for (uint32_t slot = 0; slot < memtable->num_rows; slot++) {
+        memtable_filter_add(memtable, memtable->keys[slot]);
+    }
+    return true;
+}
+
+bool table_buffer_ready(Table* table) {
+    return !memtable_filter_full(&table->memtable) || table_build_filter(table);
+}
+
+/*
+ * Buffers a row, or returns false if its id is taken. The tree is descended
+ * only when the id filter cannot rule the id out, so a fresh id costs a hash
+ * probe and a copy.
+ */
+bool table_buffer_row(Table* table, Row* row) {
+    Memtable* memtable = &table->memtable;
+    if (memtable_filter_may_contain(memtable, row->id)) {
+        if (memtable_find(memtable, row->id) != NULL) {
+            return false;
+        }
+        Cursor cursor;
+        table_find(table, row->id, &cursor);
+        void* node = get_page(table->pager, cursor.page_num);
+        if (cursor.cell_num < *leaf_node_num_cells(node) &&
+            *leaf_node_key(node, cursor.cell_num) == row->id) {
+            return false;
+        }
+    }
+
+    serialize_row(row, memtable_add(memtable, row->id));
+    memtable_filter_add(memtable, row->id);
+    if (memtable_full(memtable)) {
+        table_merge_memtable(table);
+    }
+    return true;
+}
+
+void print_constants(Pager* pager) {
+    printf("PAGE_SIZE: %d\n", pager->layout.page_size);
     printf("ROW_SIZE: %d\n", ROW_SIZE);
     printf("COMMON_NODE_HEADER_SIZE: %d\n", COMMON_NODE_HEADER_SIZE);
     printf("LEAF_NODE_HEADER_SIZE: %d\n", LEAF_NODE_HEADER_SIZE);
     printf("LEAF_NODE_CELL_SIZE: %d\n", LEAF_NODE_CELL_SIZE);
-    printf("LEAF_NODE_SPACE_FOR_CELLS: %d\n", LEAF_NODE_SPACE_FOR_CELLS);
-    printf("LEAF_NODE_MAX_CELLS: %d\n", LEAF_NODE_MAX_CELLS);
+    printf("LEAF_NODE_SPACE_FOR_CELLS: %d\n", pager->layout.page_size - LEAF_NODE_HEADER_SIZE);
+    printf("LEAF_NODE_MAX_CELLS: %d\n", pager->layout.leaf_node_max_cells);
+    printf("INTERNAL_NODE_MAX_KEYS: %d\n", pager->layout.internal_node_max_keys);
 }
 
 void indent(uint32_t level) {
@@ -804,30 +1266,31 @@ void print_tree(Pager* pager, uint32_t page_num, uint32_t indentation_level) {
     }
 }
 
-Cursor* table_find(Table* table, uint32_t key) {
+void table_find(Table* table, uint32_t key, Cursor* cursor) {
     uint32_t root_page_num = table->root_page_num;
+    table->stats.descents++;
+    profile_enter(PROFILE_DESCENT);
 
     void* root_node = get_page(table->pager, root_page_num);
     if (get_node_type(root_node) == NODE_LEAF) {
-        return leaf_node_find(table, root_page_num, key);
+        leaf_node_find(table, root_page_num, key, cursor);
     } else {
-        return internal_node_find(table, root_page_num, key);
+        internal_node_find(table, root_page_num, key, cursor);
     }
+    profile_exit();
 }
 
-Cursor* table_start(Table* table) {
+void table_start(Table* table, Cursor* cursor) {
     /*
      *Even if key 0 does not exist in the table,
      *this method will return the position of the lowest id (the start of the left-most leaf node)
      */
-    Cursor* cursor    = table_find(table, 0);
-    void*   root_node = get_page(table->pager, cursor->page_num);
+    table_find(table, 0, cursor);
+    void* root_node = get_page(table->pager, cursor->page_num);
 
     uint32_t num_cells = *leaf_node_num_cells(root_node);
 
     cursor->end_of_table = (num_cells == 0);
-
-    return cursor;
 }
 
 void cursor_advance(Cursor* cursor) {
@@ -879,4 +1342,63 @@ void print_btree_stats(Pager* pager, uint32_t root_page_num) {
     printf("Internal nodes:  %u\n", stats.internal_nodes);
     printf("Tree depth:      %u\n", stats.max_depth);
     printf("========================\n\n");
-}
\ No newline at end of file
+}
+
+void print_stats(Table* table, bool json) {
+    PagerStats* pager = &table->pager->stats;
+    TableStats* tree  = &table->stats;
+
+    if (json) {
+        printf("{\"page_hits\": %" PRIu64 ", \"page_misses\": %" PRIu64 ", ", pager->page_hits,
+               pager->page_misses);
+        printf("\"bytes_read\": %" PRIu64 ", \"bytes_written\": %" PRIu64 ", ", pager->bytes_read,
+               pager->bytes_written);
+        printf("\"flushes\": %" PRIu64 ", \"pages_warmed\": %" PRIu64 ", ", pager->flushes,
+               pager->pages_warmed);
+        printf("\"descents\": %" PRIu64 ", ", tree->descents);
+        printf("\"leaf_splits\": %" PRIu64 ", \"internal_splits\": %" PRIu64 ", ",
+               tree->leaf_splits, tree->internal_splits);
+        printf("\"root_splits\": %" PRIu64 ", \"cells_shifted\": %" PRIu64 ", ",
+               tree->root_splits, tree->cells_shifted);
+        printf("\"sort_runs\": %" PRIu64 ", \"memtable_merges\": %" PRIu64 "}\n", tree->sort_runs,
+               tree->memtable_merges);
+        return;
+    }
+
+    printf("\n===== COUNTERS =====\n");
+    printf("Page hits:       %" PRIu64 "\n", pager->page_hits);
+    printf("Page misses:     %" PRIu64 "\n", pager->page_misses);
+    printf("Bytes read:      %" PRIu64 "\n", pager->bytes_read);
+    printf("Bytes written:   %" PRIu64 "\n", pager->bytes_written);
+    printf("Flushes:         %" PRIu64 "\n", pager->flushes);
+    printf("Pages warmed:    %" PRIu64 "\n", pager->pages_warmed);
+    printf("Descents:        %" PRIu64 "\n", tree->descents);
+    printf("Leaf splits:     %" PRIu64 "\n", tree->leaf_splits);
+    printf("Internal splits: %" PRIu64 "\n", tree->internal_splits);
+    printf("Root splits:     %" PRIu64 "\n", tree->root_splits);
+    printf("Cells shifted:   %" PRIu64 "\n", tree->cells_shifted);
+    printf("Sort runs:       %" PRIu64 "\n", tree->sort_runs);
+    printf("Memtable merges: %" PRIu64 "\n", tree->memtable_merges);
+    printf("====================\n\n");
+}
+
+void reset_stats(Table* table) {
+    memset(&table->pager->stats, 0, sizeof(PagerStats));
+    memset(&table->stats, 0, sizeof(TableStats));
+}
+
+void print_latency(Table* table) {
+    printf("\n===== LATENCY =====\n");
+    histogram_print_header();
+    histogram_print("insert", &table->latency.insert);
+    histogram_print("select", &table->latency.select);
+    histogram_print("lookup", &table->latency.lookup);
+    histogram_print("page read", &table->pager->latency.read);
+    histogram_print("page flush", &table->pager->latency.flush);
+    printf("===================\n\n");
+}
+
+void reset_latency(Table* table) {
+    memset(&table->pager->latency, 0, sizeof(PagerLatency));
+    memset(&table->latency, 0, sizeof(StatementLatency));
+}
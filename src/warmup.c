@@ -0,0 +1,175 @@
+#define _GNU_SOURCE
+#include "warmup.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+struct Warmup {
+    Pager*    pager;
+    char*     path; /* the sidecar */
+    pthread_t thread;
+    bool      running;  /* a thread was started and not yet joined */
+    bool      stopping; /* under the pager lock */
+    uint32_t* page_nums;
+    uint32_t  num_pages;
+    uint32_t  warmed;
+};
+
+/* Page numbers from the sidecar, or NULL when it is missing or does not fit this file */
+static uint32_t* warmup_load(Warmup* warmup, uint32_t* num_pages) {
+    FILE* file = fopen(warmup->path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    Pager*    pager = warmup->pager;
+    char      magic[sizeof(WARMUP_MAGIC)];
+    uint32_t  page_size;
+    uint32_t* page_nums = NULL;
+
+    bool ok = fread(magic, sizeof(magic), 1, file) == 1 &&
+              fread(&page_size, sizeof(page_size), 1, file) == 1 &&
+              fread(num_pages, sizeof(*num_pages), 1, file) == 1 &&
+              memcmp(magic, WARMUP_MAGIC, sizeof(magic)) == 0 &&
+              page_size == pager->layout.page_size && *num_pages <= pager->num_pages;
+    if (ok) {
+        page_nums = malloc((*num_pages + 1) * sizeof(uint32_t));
+        ok        = fread(page_nums, sizeof(uint32_t), *num_pages, file) == *num_pages;
+    }
+    for (uint32_t i = 0; ok && i < *num_pages; i++) {
+        ok = page_nums[i] < pager->num_pages && (i == 0 || page_nums[i - 1] < page_nums[i]);
+    }
+    fclose(file);
+
+    if (!ok) {
+        free(page_nums);
+        return NULL;
+    }
+    return page_nums;
+}
+
+static void* warmup_main(void* arg) {
+    Warmup*  warmup    = arg;
+    Pager*   pager     = warmup->pager;
+    uint32_t page_size = pager->layout.page_size;
+    char*    buffer    = malloc(WARMUP_BATCH_PAGES * page_size);
+
+    uint32_t next = 0;
+    while (next < warmup->num_pages) {
+        uint32_t first = warmup->page_nums[next];
+        uint32_t run   = 1;
+        while (next + run < warmup->num_pages && run < WARMUP_BATCH_PAGES &&
+               warmup->page_nums[next + run] == first + run) {
+            run++;
+        }
+        ssize_t bytes = pread(pager->file_descriptor, buffer, (size_t) run * page_size,
+                              (off_t) first * page_size);
+        if (bytes != (ssize_t) run * page_size) {
+            break;
+        }
+
+        pthread_mutex_lock(&pager->lock);
+        bool stopping = warmup->stopping;
+        for (uint32_t i = 0; !stopping && i < run; i++) {
+            if (pager_install(pager, first + i, buffer + (size_t) i * page_size)) {
+                warmup->warmed++;
+            }
+        }
+        pager->stats.bytes_read += bytes;
+        pthread_mutex_unlock(&pager->lock);
+        if (stopping) {
+            break;
+        }
+        next += run;
+    }
+    free(buffer);
+    return NULL;
+}
+
+void warmup_start(Pager* pager, const char* filename) {
+    if (pager->in_memory) {
+        return;
+    }
+    Warmup* warmup = calloc(1, sizeof(Warmup));
+    warmup->pager  = pager;
+    warmup->path   = malloc(strlen(filename) + sizeof(WARMUP_SUFFIX));
+    sprintf(warmup->path, "%s%s", filename, WARMUP_SUFFIX);
+    pager->warmup = warmup;
+
+    warmup->page_nums = warmup_load(warmup, &warmup->num_pages);
+    if (warmup->page_nums == NULL || warmup->num_pages == 0) {
+        return;
+    }
+    if (pthread_create(&warmup->thread, NULL, warmup_main, warmup) != 0) {
+        printf("Unable to start the warmup thread\n");
+        exit(EXIT_FAILURE);
+    }
+    warmup->running = true;
+}
+
+uint32_t warmup_wait(Pager* pager) {
+    Warmup* warmup = pager->warmup;
+    if (warmup == NULL) {
+        return 0;
+    }
+    if (warmup->running) {
+        pthread_join(warmup->thread, NULL);
+        warmup->running = false;
+    }
+    return warmup->warmed;
+}
+
+/* Every cached page, in file order; written aside and renamed so a crash leaves the old one */
+static void warmup_save(Warmup* warmup) {
+    Pager*   pager    = warmup->pager;
+    char*    tmp_path = malloc(strlen(warmup->path) + sizeof(".tmp"));
+    uint32_t count    = 0;
+    sprintf(tmp_path, "%s.tmp", warmup->path);
+
+    FILE* file = fopen(tmp_path, "wb");
+    if (file == NULL) {
+        free(tmp_path);
+        return;
+    }
+    bool ok = fwrite(WARMUP_MAGIC, sizeof(WARMUP_MAGIC), 1, file) == 1 &&
+              fwrite(&pager->layout.page_size, sizeof(uint32_t), 1, file) == 1 &&
+              fwrite(&count, sizeof(count), 1, file) == 1;
+    for (uint32_t page_num = 0; ok && page_table_next(&pager->pages, &page_num) != NULL;
+         page_num++) {
+        ok = fwrite(&page_num, sizeof(page_num), 1, file) == 1;
+        count++;
+    }
+    ok = ok && fseek(file, sizeof(WARMUP_MAGIC) + sizeof(uint32_t), SEEK_SET) == 0 &&
+         fwrite(&count, sizeof(count), 1, file) == 1;
+
+    if (fclose(file) == 0 && ok) {
+        rename(tmp_path, warmup->path);
+    } else {
+        unlink(tmp_path);
+    }
+    free(tmp_path);
+}
+
+void warmup_stop(Pager* pager) {
+    Warmup* warmup = pager->warmup;
+    if (warmup == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&pager->lock);
+    warmup->stopping = true;
+    pthread_mutex_unlock(&pager->lock);
+    warmup_wait(pager);
+}
+
+void warmup_finish(Pager* pager) {
+    Warmup* warmup = pager->warmup;
+    if (warmup == NULL) {
+        return;
+    }
+    warmup_stop(pager);
+    warmup_save(warmup);
+    pager->warmup = NULL;
+    free(warmup->page_nums);
+    free(warmup->path);
+    free(warmup);
+}
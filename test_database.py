@@ -1,7 +1,13 @@
+import glob
+import json
 import os
+import random
+import socket
+import struct
 import subprocess
 import sys
 import signal
+import time
 
 # ------------------------------------------------------------
 # Locate project root (same level as this script)
@@ -74,6 +80,8 @@ def cleanup_db():
     if os.path.exists(TEST_DB_PATH):
         os.remove(TEST_DB_PATH)
         print("🧹 Removed old test.db")
+    if os.path.exists(TEST_DB_PATH + "-warm"):
+        os.remove(TEST_DB_PATH + "-warm")
 
 
 # ------------------------------------------------------------
@@ -164,12 +172,733 @@ def test_complex_inserts_and_btree():
 
     print("🌳 Complex insert and .btree test passed!")
 
+def test_secondary_index():
+    """
+    Build a username index over existing rows, keep inserting, and check
+    lookups return the same rows before and after a restart.
+    """
+    cleanup_db()
+
+    commands = [f"insert {i} user{i % 7} person{i}@example.com" for i in range(1, 301)]
+    commands += ["create index on username", "create index on username"]
+    commands += [f"insert {i} user{i % 7} person{i}@example.com" for i in range(301, 601)]
+    commands += ["select where username = 'user3'", ".exit"]
+    result = run_script(commands, args=["test.db"])
+
+    assert any("Index already exists" in line for line in result), "❌ Duplicate index was accepted"
+    matches = [line for line in result if " user3 " in line]
+    expected = [i for i in range(1, 601) if i % 7 == 3]
+    assert len(matches) == len(expected), f"❌ Expected {len(expected)} rows, got {len(matches)}"
+
+    result = run_script(["select where username = user3", "select where email = person11@example.com", ".exit"],
+                        args=["test.db"])
+    assert sum(" user3 " in line for line in result) == len(expected), "❌ Index lost on restart"
+    assert any("(11 user4 person11@example.com)" in line for line in result), "❌ Email scan failed"
+
+    print("🔎 Secondary index test passed!")
+
+def test_string_predicates():
+    """
+    Check =, like 'prefix%', like '%sub%' and contains on username and email
+    against the same filters applied in Python, across several leaves.
+    """
+    cleanup_db()
+
+    names = {i: f"{random.choice(['alice', 'bob', 'alicia', 'carol'])}{i % 13}" for i in range(1, 401)}
+    emails = {i: f"{names[i]}.{'x' * (i % 40)}@{random.choice(['mail.com', 'corp.org'])}" for i in names}
+    commands = [f"insert {i} {names[i]} {emails[i]}" for i in names] + [".exit"]
+    run_script(commands, args=["test.db"])
+
+    queries = {
+        "select where username like 'ali%'": lambda i: names[i].startswith("ali"),
+        "select where username like '%ci%'": lambda i: "ci" in names[i],
+        "select where username like 'bob7'": lambda i: names[i] == "bob7",
+        "select where username = carol12": lambda i: names[i] == "carol12",
+        "select where email contains xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx@corp": lambda i: "x" * 35 + "@corp" in emails[i],
+        "select where email like '%.org%'": lambda i: ".org" in emails[i],
+    }
+    for query, predicate in queries.items():
+        result = run_script([query, ".exit"], args=["test.db"])
+        ids = [int(line[line.index("(") + 1:].split()[0]) for line in result if "(" in line]
+        expected = [i for i in names if predicate(i)]
+        assert ids == expected, f"❌ {query}: expected {len(expected)} rows, got {len(ids)}"
+
+    result = run_script(["select where id like '1%'", "select where username like 'a%b'", ".exit"], args=["test.db"])
+    assert sum("Syntax error" in line for line in result) == 2, "❌ Unsupported like pattern was accepted"
+
+    print("🔤 String predicate test passed!")
+
+def test_order_by():
+    """
+    Sort on username and email in memory, with a top-K limit, with a 4 KiB
+    budget that spills enough runs to need more than one merge pass, and with
+    the largest budget on a table of two rows, which must not reserve it.
+    """
+    cleanup_db()
+
+    ids = list(range(1, 5001))
+    random.shuffle(ids)
+    names = {i: random.choice(["ann", "bo", "cy", "dee"]) + str(random.randint(0, 50)) for i in ids}
+    emails = {i: f"{names[i]}.{'z' * random.randint(0, 60)}{random.randint(0, 999)}@example.com" for i in ids}
+    commands = [f"insert {i} {names[i]} {emails[i]}" for i in ids] + [".exit"]
+    run_script(commands, args=["test.db"], timeout=30)
+
+    by_id = sorted(ids)
+    queries = {
+        "select order by username": sorted(by_id, key=lambda i: names[i]),
+        "select order by email desc limit 25": sorted(by_id, key=lambda i: emails[i], reverse=True)[:25],
+        "select where username like 'bo%' order by username desc":
+            sorted([i for i in by_id if names[i].startswith("bo")], key=lambda i: names[i], reverse=True),
+        "select order by email": sorted(by_id, key=lambda i: emails[i]),
+    }
+    for budget in ["", ".sort_budget 4"]:
+        for query, expected in queries.items():
+            result = run_script([budget, query, ".stats json", ".exit"], args=["test.db"], timeout=30)
+            rows = [int(line[line.index("(") + 1:].split()[0]) for line in result if "(" in line]
+            assert rows == expected, f"❌ {query} {budget}: rows out of order"
+            report = next(json.loads(line[line.index("{"):]) for line in result if "sort_runs" in line)
+            if budget and query == "select order by email":
+                assert report["sort_runs"] > 64, f"❌ {query} did not spill past one merge pass"
+
+    result = run_script(["select order by id", "select limit -1", ".exit"], args=["test.db"])
+    assert any("Syntax error" in line for line in result), "❌ order by id was accepted"
+
+    cleanup_db()
+    result = run_script([".sort_budget 16777216", "insert 2 bo b@example.com",
+                         "insert 1 cy a@example.com", "select order by username",
+                         "select order by email limit 100000000", ".exit"], args=["test.db"])
+    rows = [line[line.index("("):] for line in result if "(" in line]
+    assert rows == ["(2 bo b@example.com)", "(1 cy a@example.com)",
+                    "(1 cy a@example.com)", "(2 bo b@example.com)"], "❌ large sort budget failed"
+
+    print("🔢 Order by test passed!")
+
+def test_columnar_export_import():
+    """
+    Export a table to the columnar format, check its first batch reads back
+    little-endian, import it into a fresh database with an index, and check
+    rows, index lookups, duplicates and a corrupt stream.
+    """
+    cleanup_db()
+    export_path = os.path.join(ROOT_DIR, "test.cqcol")
+
+    ids = list(range(1, 10001))
+    random.shuffle(ids)
+    rows = {i: (f"user{i}", f"{'e' * (i % 200)}{i}@example.com") for i in ids}
+    commands = [f"insert {i} {rows[i][0]} {rows[i][1]}" for i in ids]
+    run_script(commands + [f".export {export_path}", ".exit"], args=["test.db"], timeout=30)
+    original = run_script(["select", ".exit"], args=["test.db"], timeout=30)
+    with open(export_path, "rb") as f:
+        assert struct.unpack("<8sII", f.read(16)) == (b"CQLCOL1\0", 1, 3), "❌ bad stream header"
+        for _ in range(3):
+            f.read(f.read(2)[1])
+        num_rows, id_length = struct.unpack("<II", f.read(8))
+        ids_out = struct.unpack(f"<{num_rows}I", f.read(id_length))
+    assert ids_out == tuple(range(1, 4097)), "❌ stream ids are not little-endian and sorted"
+
+    cleanup_db()
+    result = run_script(["create index on email", f".import {export_path}", ".exit"],
+                        args=["test.db"], timeout=30)
+    assert any(line.endswith("Imported 10000 rows.") for line in result), "❌ import did not load every row"
+    imported = run_script(["select", ".exit"], args=["test.db"], timeout=30)
+    assert imported == original, "❌ imported rows differ from the exported table"
+
+    result = run_script([f"select where email = {rows[4242][1]}", f".import {export_path}", ".exit"],
+                        args=["test.db"], timeout=30)
+    assert any(line.endswith(f"(4242 user4242 {rows[4242][1]})") for line in result), \
+        "❌ index lookup missed an imported row"
+    assert any(line.endswith("Skipped 10000 duplicate keys.") for line in result), "❌ re-import did not skip duplicates"
+
+    with open(export_path, "r+b") as f:
+        f.seek(8)
+        f.write(struct.pack("<I", 99))
+    result = run_script([f".import {export_path}", ".exit"], args=["test.db"])
+    assert any("Not a cqlite columnar file" in line for line in result), "❌ bad stream was accepted"
+
+    os.remove(export_path)
+    print("📦 Columnar export/import test passed!")
+
+def test_memtable():
+    """
+    Buffer random inserts on top of an existing tree, and check duplicates,
+    range and ordered selects over unmerged rows, and the rows after a restart.
+    """
+    cleanup_db()
+
+    ids = list(range(1, 5001))
+    random.shuffle(ids)
+    commands = [f"insert {i} user{i} person{i}@example.com" for i in ids[:1000]]
+    commands.append(".memtable 300")
+    commands += [f"insert {i} user{i} person{i}@example.com" for i in ids[1000:]]
+    commands += [f"insert {ids[0]} again again@example.com", f"insert {ids[-1]} again again@example.com"]
+    commands += ["select", "select where id > 4900", "select order by username desc limit 3",
+                 f"select where id = {ids[-1]}", ".stats json", ".exit"]
+    result = run_script(commands, args=["test.db"], timeout=30)
+
+    assert sum("Duplicate key" in line for line in result) == 2, "❌ Duplicate id was accepted"
+    rows = [int(line.split("(")[1].split()[0]) for line in result if "@example.com)" in line]
+    assert rows[:5000] == list(range(1, 5001)), "❌ Full scan missed buffered rows or lost order"
+    assert rows[5000:5100] == list(range(4901, 5001)), "❌ Range scan over buffered rows is wrong"
+    assert rows[5100:5103] == [999, 998, 997], "❌ Order by over buffered rows is wrong"
+    assert rows[5103:] == [ids[-1]], "❌ Point lookup missed a buffered row"
+    stats = next(json.loads(line[line.index("{"):]) for line in result if "memtable_merges" in line)
+    assert stats["memtable_merges"] > 0, "❌ Memtable never merged"
+
+    result = run_script(["select", ".exit"], args=["test.db"], timeout=30)
+    rows = [int(line.split("(")[1].split()[0]) for line in result if "@example.com)" in line]
+    assert rows == list(range(1, 5001)), "❌ Buffered rows were lost on close"
+
+    print("🧮 Memtable test passed!")
+
+def test_hash_index():
+    """
+    Build a hash index on id, keep inserting in random order so leaves split
+    under it, and check point lookups and duplicate rejection across a restart.
+    """
+    cleanup_db()
+
+    ids = list(range(1, 2001))
+    random.shuffle(ids)
+    commands = [f"insert {i} user{i} person{i}@example.com" for i in ids[:500]]
+    commands += ["create hash index on id", "create hash index on id"]
+    commands += [f"insert {i} user{i} person{i}@example.com" for i in ids[500:]]
+    commands += [f"insert {ids[0]} again again@example.com", ".exit"]
+    result = run_script(commands, args=["test.db"])
+
+    assert any("Index already exists" in line for line in result), "❌ Duplicate hash index was accepted"
+    assert sum("Duplicate key" in line for line in result) == 1, "❌ Duplicate id was accepted"
+
+    probes = random.sample(ids, 50) + [0, 5000]
+    result = run_script([f"select where id = {i}" for i in probes] + [".exit"], args=["test.db"])
+    rows = [line for line in result if "(" in line]
+    assert len(rows) == 50, f"❌ Expected 50 rows, got {len(rows)}"
+    for i, line in zip(probes, rows):
+        assert f"({i} user{i} person{i}@example.com)" in line, f"❌ Wrong row for id {i}: {line}"
+
+    print("#️⃣  Hash index test passed!")
+
+def test_stats_counters():
+    """
+    Check the .stats counters follow a known insert workload and that
+    .stats reset zeroes them.
+    """
+    cleanup_db()
+
+    commands = [f"insert {i} user{i} person{i}@example.com" for i in range(100, 0, -1)]
+    commands += [".stats json", ".stats reset", ".stats json", ".exit"]
+    result = run_script(commands, args=["test.db"])
+
+    reports = [json.loads(line[line.index("{"):]) for line in result if "page_hits" in line]
+    assert len(reports) == 2, "❌ Expected two .stats json reports"
+    before, after = reports
+    assert before["descents"] == 100, f"❌ Expected 100 descents, got {before['descents']}"
+    assert before["root_splits"] == 1, "❌ Expected exactly one root split"
+    assert before["leaf_splits"] > 0 and before["cells_shifted"] > 0, "❌ Split/shift counters stayed at 0"
+    assert all(value == 0 for value in after.values()), f"❌ Reset left counters behind: {after}"
+
+    print("📊 Stats counters test passed!")
+
+def test_timer_and_latency():
+    """
+    Check .timer prints a run time per statement and .latency counts each
+    statement under its type.
+    """
+    cleanup_db()
+
+    commands = [".timer on"] + [f"insert {i} user{i} person{i}@example.com" for i in range(1, 51)]
+    commands += [".timer off", "select where id = 7", "select", ".latency", ".exit"]
+    result = run_script(commands, args=["test.db"])
+
+    assert sum("Run Time:" in line for line in result) == 50, "❌ Expected one run time per timed statement"
+    counts = {line.split()[0]: int(line.split()[1]) for line in result
+              if line.split() and line.split()[0] in ("insert", "select", "lookup")}
+    assert counts == {"insert": 50, "select": 1, "lookup": 1}, f"❌ Unexpected latency counts: {counts}"
+
+    print("⏱️  Timer and latency test passed!")
+
+def test_profile():
+    """
+    Profile a scan, an index build and a lookup, and check each phase counted
+    what it should: a return to the scan per row handed out, a deserialize per
+    row indexed, and whichever counters the kernel allows.
+    """
+    cleanup_db()
+
+    commands = [f"insert {i} user{i} person{i}@example.com" for i in range(1, 201)]
+    commands += [".profile", ".profile on", "select", "create index on username",
+                 "select where id = 7", ".profile", ".profile off", ".profile", ".exit"]
+    result = run_script(commands, args=["test.db"])
+
+    assert sum(line.endswith("Profile: off.") for line in result) == 2, "❌ .profile off did not report"
+    assert any("Profiling with" in line for line in result), "❌ .profile on did not name its counters"
+    assert any(line.endswith(", 3 statements.") for line in result), "❌ Expected 3 profiled statements"
+    calls = {line.split()[0]: int(line.split()[1]) for line in result
+             if line.split() and line.split()[0] in ("descent", "deserialize", "output", "total")}
+    assert calls["output"] == 201, f"❌ Expected one output interval per row, got {calls['output']}"
+    assert calls["deserialize"] == 200, f"❌ Expected a deserialize per row, got {calls['deserialize']}"
+    assert calls["descent"] > 0 and calls["total"] == 3, f"❌ Unexpected phase calls: {calls}"
+
+    print("🔬 Profile test passed!")
+
+def test_background_checkpointer():
+    """
+    Run inserts with the checkpointer flushing on a short interval and check
+    it wrote pages before .exit and that every row survives a restart.
+    """
+    cleanup_db()
+
+    ids = list(range(1, 3001))
+    random.shuffle(ids)
+    commands = [".checkpoint on 1 1x", ".checkpoint on 1 1"]
+    commands += [f"insert {i} user{i} person{i}@example.com" for i in ids]
+    commands += [".stats json", ".checkpoint off", ".checkpoint", ".exit"]
+    result = run_script(commands, args=["test.db"])
+
+    report = next(json.loads(line[line.index("{"):]) for line in result if "page_hits" in line)
+    assert report["flushes"] > 0, "❌ Checkpointer flushed nothing before .exit"
+    assert any("Checkpointed" in line for line in result), "❌ Manual .checkpoint did not report"
+    assert any(line.endswith("Unrecognized command '.checkpoint on 1 1x'") for line in result), \
+        "❌ a bad dirty percent was accepted"
+
+    result = run_script(["select", ".exit"], args=["test.db"])
+    rows = [line for line in result if "(" in line]
+    assert len(rows) == len(ids), f"❌ Expected {len(ids)} rows after restart, got {len(rows)}"
+
+    print("💾 Background checkpointer test passed!")
+
+def test_defrag():
+    """
+    Scatter the leaves with shuffled inserts, check .defrag lays them out in
+    one run that survives a restart with every row still in order, that the
+    tree keeps splitting correctly afterwards, that the background mode
+    gets back to one run on its own, also after a second batch of inserts,
+    and that shards only take one-off passes.
+    """
+    cleanup_db()
+
+    ids = list(range(1, 4001))
+    random.shuffle(ids)
+    commands = [f"insert {i} user{i} person{i}@example.com" for i in ids[:3000]]
+    commands += [".defrag status", ".defrag", ".exit"]
+    result = run_script(commands, args=["test.db"], timeout=30)
+    before = next(line for line in result if line.endswith(" runs."))
+    leaves, runs = int(before.split()[-5]), int(before.split()[-2])
+    assert runs > 1, f"❌ shuffled inserts left {leaves} leaves in {runs} runs"
+    assert any(line.endswith(f"{leaves} leaves in 1 runs.") for line in result), \
+        "❌ .defrag did not cluster the leaves"
+
+    commands = [".defrag status", "select"] + [f"insert {i} user{i} person{i}@example.com"
+                                               for i in ids[3000:]]
+    commands += [".defrag on 1 4", "select", ".exit"]
+    result = run_script(commands, args=["test.db"], timeout=30)
+    assert any(line.endswith(f"{leaves} leaves in 1 runs.") for line in result), \
+        "❌ clustering lost on restart"
+    rows = [int(line.split("(")[1].split()[0]) for line in result if "@example.com)" in line]
+    expected = sorted(ids[:3000]) + sorted(ids)
+    assert rows == expected, "❌ rows out of order or missing after .defrag"
+
+    # The later inserts scattered new leaves again; the background mode gathers them
+    result = run_script([".defrag on 1x", ".defrag on 1 64", ".defrag wait", ".defrag off",
+                         ".defrag status", ".exit"], args=["test.db"], timeout=30)
+    assert any(line.endswith(" leaves in 1 runs.") for line in result), \
+        "❌ background mode did not cluster"
+    assert any(line.endswith("Unrecognized command '.defrag on 1x'") for line in result), \
+        "❌ a bad interval was accepted"
+
+    # A wait after more inserts covers their splits too, even with the stats reset between
+    cleanup_db()
+    random.shuffle(ids)
+    commands = [".defrag on 300 100000"]
+    commands += [f"insert {i} user{i} person{i}@example.com" for i in ids[:1500]]
+    commands += [".defrag wait", ".stats reset"]
+    commands += [f"insert {i} user{i} person{i}@example.com" for i in ids[1500:3000]]
+    commands += [".defrag wait", ".defrag status", ".exit"]
+    result = run_script(commands, args=["test.db"], timeout=30)
+    assert result[-2].endswith(" leaves in 1 runs."), "❌ second .defrag wait returned early"
+
+    # A sharded handle takes the one-off pass on each shard but no background thread
+    result = run_script([".defrag", ".defrag on", ".exit"],
+                        args=["test_shards.db", "--shards", "2"], timeout=30)
+    assert sum(line.endswith(" runs.") for line in result) == 2, "❌ .defrag skipped a shard"
+    assert result[-2].endswith("Unrecognized command '.defrag on'"), \
+        "❌ background defrag started on a sharded handle"
+    for path in glob.glob(os.path.join(ROOT_DIR, "test_shards.db*")):
+        os.remove(path)
+
+    print("🗂️ Defrag test passed!")
+
+def test_buffer_pool_warmup():
+    """
+    Close a database and check the sidecar lists its cached pages, that the
+    next open preloads them so a full scan misses nothing, and that a sidecar
+    which does not fit the file is ignored.
+    """
+    cleanup_db()
+    warm_path = TEST_DB_PATH + "-warm"
+
+    commands = [f"insert {i} user{i} person{i}@example.com" for i in range(1, 3001)]
+    run_script(commands + [".exit"], args=["test.db"], timeout=30)
+    with open(warm_path, "rb") as f:
+        magic, page_size, count = struct.unpack("<8sII", f.read(16))
+    num_pages = os.path.getsize(TEST_DB_PATH) // 4096
+    assert magic == b"CQLWARM\0" and page_size == 4096, "❌ bad warmup sidecar header"
+    assert count == num_pages, f"❌ sidecar lists {count} of {num_pages} cached pages"
+
+    result = run_script([".warmup", "select", ".stats json", ".exit"], args=["test.db"], timeout=30)
+    assert any(line.endswith(f"Warmed {num_pages - 1} pages.") for line in result), \
+        "❌ warmup did not preload every page but the header"
+    stats = next(json.loads(line[line.index("{"):]) for line in result if "pages_warmed" in line)
+    assert stats["page_misses"] == 1, f"❌ scan after warmup missed {stats['page_misses']} pages"
+
+    with open(warm_path, "r+b") as f:
+        f.seek(12)
+        f.write(struct.pack("<I", num_pages + 100))
+    result = run_script([".warmup", ".exit"], args=["test.db"])
+    assert any(line.endswith("Warmed 0 pages.") for line in result), "❌ bad sidecar was used"
+
+    print("🔥 Buffer pool warmup test passed!")
+
+def test_large_sparse_file():
+    """
+    Grow the file past 4 GiB with a sparse tail, then check it opens quickly,
+    keeps its rows and can still allocate and flush pages past the tail.
+    """
+    cleanup_db()
+
+    commands = [f"insert {i} user{i} person{i}@example.com" for i in range(1, 101)] + [".exit"]
+    run_script(commands, args=["test.db"])
+    os.truncate(os.path.join(ROOT_DIR, "test.db"), 64 * 1024 * 1024 * 1024)
+
+    start = time.monotonic()
+    commands = [f"insert {i} user{i} person{i}@example.com" for i in range(101, 1001)]
+    result = run_script(commands + [".exit"], args=["test.db"])
+    assert time.monotonic() - start < 5, "❌ Opening a sparse 64 GiB file was not constant time"
+
+    result = run_script(["select", ".exit"], args=["test.db"])
+    rows = [line for line in result if "(" in line]
+    assert len(rows) == 1000, f"❌ Expected 1000 rows past the sparse tail, got {len(rows)}"
+
+    print("🗺️  Large sparse file test passed!")
+
+def test_page_size():
+    """
+    Create a file with 64 KiB pages, check the header keeps that size on reopen
+    and the wider nodes hold the same rows in a shallower tree, and that bad
+    options are refused. A file from before the header recorded its page size
+    still opens as 4 KiB, and one from before the header page is named as such.
+    """
+    cleanup_db()
+    db_path = os.path.join(ROOT_DIR, "test.db")
+
+    ids = list(range(1, 20001))
+    random.shuffle(ids)
+    commands = [f"insert {i} user{i} person{i}@example.com" for i in ids]
+    run_script(commands + [".exit"], args=["test.db", "--page-size", "65536"], timeout=30)
+    assert os.path.getsize(db_path) % 65536 == 0, "❌ file is not made of 64 KiB pages"
+
+    result = run_script([".constants", "select", ".printstats", ".exit"], args=["test.db"], timeout=30)
+    assert any(line.endswith("PAGE_SIZE: 65536") for line in result), "❌ reopen lost the page size"
+    assert any(line.endswith("LEAF_NODE_MAX_CELLS: 220") for line in result), "❌ leaf capacity"
+    rows = [line for line in result if line.startswith("(") or "> (" in line]
+    assert len(rows) == 20000, f"❌ Expected 20000 rows, got {len(rows)}"
+    assert any("Tree depth:      2" in line for line in result), "❌ 64 KiB tree is not shallower"
+
+    process = subprocess.run([BINARY_PATH, "other.db", "--page-size", "5000"], input=".exit\n",
+                             capture_output=True, text=True, cwd=ROOT_DIR, timeout=5)
+    assert process.returncode != 0 and "power of two" in process.stdout, "❌ bad page size was accepted"
+    assert not os.path.exists(os.path.join(ROOT_DIR, "other.db")), "❌ bad page size created a file"
+    for args in [["--page-size", "4k"], ["--shards", "x"], ["--bogus", "1"], ["--shards"]]:
+        process = subprocess.run([BINARY_PATH, "other.db"] + args, input=".exit\n",
+                                 capture_output=True, text=True, cwd=ROOT_DIR, timeout=5)
+        assert process.returncode != 0 and "Usage:" in process.stdout, f"❌ {args} was accepted"
+    assert not os.path.exists(os.path.join(ROOT_DIR, "other.db")), "❌ bad option created a file"
+
+    cleanup_db()
+    run_script(["insert 1 a a@example.com", ".exit"], args=["test.db"])
+    with open(db_path, "r+b") as f:
+        f.seek(24)
+        f.write(bytes(12))
+    result = run_script([".constants", "select", ".exit"], args=["test.db", "--page-size", "16384"])
+    assert any(line.endswith("PAGE_SIZE: 4096") for line in result), "❌ old file not read as 4 KiB"
+    assert any(line.endswith("(1 a a@example.com)") for line in result), "❌ old file lost its row"
+
+    # Before the header page existed, page 0 was the root leaf
+    with open(db_path, "wb") as f:
+        f.write(bytes([1, 1]) + bytes(4094))
+    process = subprocess.run([BINARY_PATH, "test.db"], input=".exit\n",
+                             capture_output=True, text=True, cwd=ROOT_DIR, timeout=5)
+    assert process.returncode != 0 and "from before the header page" in process.stdout, \
+        "❌ a pre-header file was reported as corrupt"
+
+    print("📐 Page size test passed!")
+
+def test_memory_database():
+    """
+    Fill an in-memory database past a few splits with an index on it, and check
+    it serves the rows without writing a byte or leaving a file behind.
+    """
+    ids = list(range(1, 3001))
+    random.shuffle(ids)
+    commands = [f"insert {i} user{i} person{i}@example.com" for i in ids]
+    commands += ["create index on email", "select where email = person1234@example.com", "select",
+                 ".checkpoint", ".stats json", ".exit"]
+    result = run_script(commands, args=[":memory:"], timeout=30)
+
+    rows = [int(line.split("(")[1].split()[0]) for line in result if "@example.com)" in line]
+    assert rows == [1234] + list(range(1, 3001)), "❌ in-memory rows are wrong"
+    assert any(line.endswith("Checkpointed 0 pages.") for line in result), "❌ checkpoint wrote pages"
+    stats = next(json.loads(line[line.index("{"):]) for line in result if "bytes_written" in line)
+    assert stats["bytes_written"] == 0 and stats["bytes_read"] == 0, "❌ in-memory database did I/O"
+    assert not os.path.exists(":memory:"), "❌ a file was created for :memory:"
+
+    result = run_script(["select", ".exit"], args=[":memory:"])
+    assert not any("@example.com)" in line for line in result), "❌ rows outlived the process"
+
+    print("🧠 In-memory database test passed!")
+
+def test_read_replicas():
+    """
+    Ship a primary's writes to followers over a shared directory and over a
+    Unix socket, and check the followers serve them, refuse writes of their
+    own and pick up where they left off.
+    """
+    cleanup_db()
+    replica_path = os.path.join(ROOT_DIR, "test_replica.db")
+    log_dir = os.path.join(ROOT_DIR, "test.rlog")
+    socket_path = os.path.join(ROOT_DIR, "test_replica.sock")
+
+    def cleanup_replica():
+        for path in [replica_path, replica_path + "-warm", socket_path + ".rlog",
+                     os.path.join(log_dir, "cqlite.rlog")]:
+            if os.path.exists(path):
+                os.remove(path)
+        if os.path.isdir(log_dir):
+            os.rmdir(log_dir)
+
+    cleanup_replica()
+    commands = [f"insert {i} user{i} person{i}@example.com" for i in range(1, 501)]
+    commands += ["insert 7 again again@example.com", "create index on email", ".replication", ".exit"]
+    result = run_script(commands, args=["test.db", "--replicate", f"dir:{log_dir}"], timeout=30)
+    assert result[-2].endswith("Replication: primary at LSN 501."), "❌ primary LSN is wrong"
+
+    follower = ["--follow", f"dir:{log_dir}"]
+    result = run_script([".replication wait", "select where email = person321@example.com",
+                         "insert 900 me me@example.com", ".exit"], args=[replica_path] + follower)
+    assert any(line.endswith("Replication: follower at LSN 501 of 501, lag 0 LSN, 0.000 s.")
+               for line in result), "❌ follower did not catch up"
+    assert any(line.endswith("(321 user321 person321@example.com)") for line in result), \
+        "❌ follower row is wrong"
+    assert result[-2].endswith("Error: Read-only replica."), "❌ follower accepted a write"
+
+    run_script(["insert 501 user501 person501@example.com", ".exit"],
+               args=["test.db", "--replicate", f"dir:{log_dir}"])
+    result = run_script([".replication wait", "select", ".exit"], args=[replica_path] + follower)
+    assert any(line.endswith("at LSN 502 of 502, lag 0 LSN, 0.000 s.") for line in result), \
+        "❌ follower did not resume"
+    assert sum("@example.com)" in line for line in result) == 501, "❌ follower rows are wrong"
+
+    # Selects that run while the follower splits leaves each see a prefix of the log
+    cleanup_replica()
+    cleanup_db()
+    order = random.Random(44).sample(range(1, 20001), 20000)
+    commands = [f"insert {i} user{i} person{i}@example.com" for i in order]
+    run_script(commands + [".exit"], args=["test.db", "--replicate", f"dir:{log_dir}"], timeout=60)
+    commands = []
+    for lsn in range(1000, 20000, 1000):
+        commands += [f".replication wait {lsn}", "select", "select"]
+    result = run_script(commands + [".replication wait", "select", ".exit"],
+                        args=[replica_path] + follower, timeout=60)
+    selects, ids = [], None
+    for line in result:
+        if line.endswith("Executed."):
+            selects.append(ids or [])
+            ids = None
+        elif "@example.com)" in line:
+            ids = (ids or []) + [int(line.split("(")[1].split(" ")[0])]
+    assert len(selects) == 39, "❌ selects did not all run"
+    assert all(ids == sorted(order[:len(ids)]) for ids in selects), \
+        "❌ a select saw the follower mid-apply"
+    assert len(selects[-1]) == 20000, "❌ follower did not catch up"
+
+    # Over a socket the primary streams its log to each follower that connects
+    cleanup_replica()
+    cleanup_db()
+    primary = subprocess.Popen([BINARY_PATH, "test.db", "--replicate", f"unix:{socket_path}"],
+                               stdin=subprocess.PIPE, stdout=subprocess.PIPE, text=True)
+    try:
+        primary.stdin.write("".join(f"insert {i} user{i} person{i}@example.com\n"
+                                    for i in range(1, 301)))
+        primary.stdin.flush()
+        result = run_script([".replication wait 300", ".replication", "select where id = 300",
+                             ".exit"], args=[replica_path, "--follow", f"unix:{socket_path}"])
+        assert any(line.endswith("at LSN 300 of 300, lag 0 LSN, 0.000 s.") for line in result), \
+            "❌ socket follower did not catch up"
+        assert any(line.endswith("(300 user300 person300@example.com)") for line in result), \
+            "❌ socket row is wrong"
+    finally:
+        primary.communicate(".exit\n", timeout=10)
+    cleanup_replica()
+    cleanup_db()
+
+    print("📡 Read replicas test passed!")
+
+def test_sharded_table():
+    """
+    Spread rows over key-range shards small enough to split many times, and
+    check scans come back merged in key order, order by across shards, range
+    pruning, and a reopen that finds the shards from the manifest alone.
+    """
+    shard_path = os.path.join(ROOT_DIR, "test_shards.db")
+
+    def cleanup_shards():
+        for path in glob.glob(shard_path + "*"):
+            os.remove(path)
+
+    cleanup_shards()
+    ids = random.sample(range(1, 2000000000), 2000) + list(range(1, 1501))
+    ids = list(dict.fromkeys(ids))
+    random.shuffle(ids)
+    commands = [".shards max_pages 40", "create index on email"]
+    commands += [f"insert {i} user{i % 97} person{i}@example.com" for i in ids]
+    commands += ["select", "select order by username desc limit 20", "select where id < 700",
+                 "select where email = person1234@example.com", ".shards", ".exit"]
+    result = run_script(commands, args=[shard_path, "--shards", "4"], timeout=60)
+
+    blocks = [[]]
+    for line in result:
+        if "@example.com)" in line:
+            blocks[-1].append(int(line.split("(")[1].split()[0]))
+        elif line.endswith("Executed.") and blocks[-1]:
+            blocks.append([])
+    assert blocks[0] == sorted(ids), "❌ sharded scan is not in key order"
+    by_username = sorted(ids, key=lambda i: (f"user{i % 97}", -i), reverse=True)[:20]
+    assert blocks[1] == by_username, "❌ order by across shards is wrong"
+    assert blocks[2] == list(range(1, 700)), "❌ id range over shards is wrong"
+    assert blocks[3] == [1234], "❌ index lookup over shards is wrong"
+    num_shards = next(int(line.split()[-5].rstrip(",")) for line in result if "Shards:" in line)
+    assert num_shards > 4, "❌ no shard was split"
+
+    result = run_script(["select where id >= 1000000000", ".shards split x", ".exit"],
+                        args=[shard_path])
+    rows = [line for line in result if "@example.com)" in line]
+    assert len(rows) == sum(i >= 1000000000 for i in ids), "❌ reopened shards lost rows"
+    assert result[-2].endswith("Unrecognized command '.shards split x'"), \
+        "❌ a bad shard number was accepted"
+    cleanup_shards()
+
+    print("🧩 Sharded table test passed!")
+
+# ------------------------------------------------------------
+# Server mode
+# ------------------------------------------------------------
+TEST_SOCKET_PATH = os.path.join(ROOT_DIR, "test.sock")
+
+def send_frames(sock, statements):
+    payload = b"".join(
+        struct.pack("!I", len(s.encode())) + s.encode() for s in statements
+    )
+    sock.sendall(payload)
+
+def recv_exact(sock, n):
+    data = b""
+    while len(data) < n:
+        chunk = sock.recv(n - len(data))
+        if not chunk:
+            raise RuntimeError("❌ Server closed the connection early")
+        data += chunk
+    return data
+
+def recv_response(sock):
+    (length,) = struct.unpack("!I", recv_exact(sock, 4))
+    body = recv_exact(sock, length)
+    return body[0], body[1:].decode()
+
+def test_server_pipelining():
+    """
+    Start cqlite in server mode, pipeline statements from two clients
+    over the Unix socket, check one that stops reading does not stall the
+    other or lose responses, and check the rows survive a restart.
+    """
+    cleanup_db()
+    server = subprocess.Popen(
+        [BINARY_PATH, "test.db", "--serve", TEST_SOCKET_PATH],
+        stdout=subprocess.PIPE,
+        stderr=subprocess.PIPE,
+        text=True,
+    )
+    try:
+        for _ in range(100):
+            if os.path.exists(TEST_SOCKET_PATH):
+                break
+            time.sleep(0.05)
+
+        first = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        second = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        first.connect(TEST_SOCKET_PATH)
+        second.connect(TEST_SOCKET_PATH)
+
+        send_frames(first, [f"insert {i} user{i} person{i}@example.com" for i in range(1, 51)])
+        for _ in range(50):
+            assert recv_response(first) == (0, "Executed.\n"), "❌ Pipelined insert failed"
+
+        send_frames(second, ["insert 7 dup dup@example.com", "bogus", "select"])
+
+        status, text = recv_response(second)
+        assert status == 1 and "Duplicate key" in text, f"❌ Expected duplicate key, got {text!r}"
+        status, text = recv_response(second)
+        assert status == 1 and "Unrecognized keyword" in text, "❌ Expected unrecognized keyword"
+        status, text = recv_response(second)
+        rows = text.strip().split("\n")
+        assert status == 0 and len(rows) == 51, f"❌ Expected 50 rows + Executed., got {len(rows)}"
+        assert rows[0] == "(1 user1 person1@example.com)", "❌ Rows out of order"
+
+        # A client that stops reading is paused without holding up the others
+        send_frames(second, ["select"] * 3000)
+        time.sleep(0.5)
+        send_frames(first, ["select"])
+        assert recv_response(first)[1] == text, "❌ Backed-up client stalled the server"
+        for _ in range(3000):
+            assert recv_response(second) == (0, text), "❌ Backed-up client lost a response"
+
+        first.close()
+        second.close()
+    finally:
+        server.send_signal(signal.SIGTERM)
+        server.wait(timeout=5)
+
+    assert server.returncode == 0, f"❌ Server exited with {server.returncode}"
+    assert not os.path.exists(TEST_SOCKET_PATH), "❌ Server left its socket behind"
+
+    result = run_script(["select", ".exit"], args=["test.db"])
+    assert any("(50 user50 person50@example.com)" in line for line in result), \
+        "❌ Rows written through the server were not persisted"
+
+    print("🔌 Server pipelining test passed!")
+
 # ------------------------------------------------------------
 # Main
 # ------------------------------------------------------------
 if __name__ == "__main__":
     print(f"🧩 Using binary: {BINARY_PATH}")
     test_complex_inserts_and_btree()
+    test_secondary_index()
+    test_string_predicates()
+    test_order_by()
+    test_columnar_export_import()
+    test_memtable()
+    test_hash_index()
+    test_stats_counters()
+    test_timer_and_latency()
+    test_profile()
+    test_background_checkpointer()
+    test_defrag()
+    test_buffer_pool_warmup()
+    test_large_sparse_file()
+    test_page_size()
+    test_memory_database()
+    test_read_replicas()
+    test_sharded_table()
+    test_server_pipelining()
     cleanup_db()
     test_bulk_insert(75000)
 